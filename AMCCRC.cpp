@@ -0,0 +1,28 @@
+//
+//  AMCCRC.cpp
+//  AMCDrive X2 plugin
+//
+//  X-Modem CRC, see AMCCRC.h
+
+#include "AMCCRC.h"
+
+constexpr AMCCRCTable CAMCCRC::m_Table;
+
+/*
+ The CRC is 16 bits so only the first 2 bytes of each group of 4 mix with it,
+ the 4 lookups are independent and the CPU can run them in parallel.
+ */
+uint16_t CAMCCRC::update(uint16_t nCRC, const unsigned char *pData, size_t nLen)
+{
+    while(nLen >= CRC_SLICES) {
+        nCRC = (uint16_t)(m_Table.nEntry[3][pData[0] ^ (nCRC >> 8)] ^
+                          m_Table.nEntry[2][pData[1] ^ (nCRC & 0xff)] ^
+                          m_Table.nEntry[1][pData[2]] ^
+                          m_Table.nEntry[0][pData[3]]);
+        pData += CRC_SLICES;
+        nLen -= CRC_SLICES;
+    }
+    while(nLen--)
+        nCRC = updateByte(nCRC, *pData++);
+    return nCRC;
+}
@@ -0,0 +1,109 @@
+//
+//  AMCCRC.h
+//  AMCDrive X2 plugin
+//
+//  X-Modem CRC (CRC-CCITT poly 0x1021, start 0, MSB first) used by the AMC
+//  DigiFlex frames. The lookup tables are built by the compiler so there is
+//  nothing to initialize at run time and nothing for two threads to race on.
+//  Blocks are processed 4 bytes at a time (slice-by-4), CAMCCRC can also be
+//  fed a byte or a few bytes at a time as they come off the port.
+
+#ifndef __AMCCRC__
+#define __AMCCRC__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CRC_XMODEM_POLY     0x1021
+#define CRC_XMODEM_START    0x0000
+#define CRC_SLICES          4
+
+struct AMCCRCTable {
+    // nEntry[k][b] is the CRC of byte b followed by k zero bytes
+    uint16_t nEntry[CRC_SLICES][256];
+};
+
+// C++11 constexpr, a single return statement, the VS2015 toolset has no C++14 relaxed constexpr.
+constexpr uint16_t crcTableBits(uint16_t nCRC, int nBits)
+{
+    return nBits == 0 ? nCRC : crcTableBits((nCRC & 0x8000) ? (uint16_t)((nCRC << 1) ^ CRC_XMODEM_POLY) : (uint16_t)(nCRC << 1), nBits - 1);
+}
+
+// one more zero byte after what gave nCRC
+constexpr uint16_t crcTableShift(uint16_t nCRC)
+{
+    return (uint16_t)((nCRC << 8) ^ crcTableBits((uint16_t)(nCRC & 0xff00), 8));
+}
+
+constexpr uint16_t crcTableEntry(int nSlice, int nByte)
+{
+    return nSlice == 0 ? crcTableBits((uint16_t)(nByte << 8), 8) : crcTableShift(crcTableEntry(nSlice - 1, nByte));
+}
+
+/*
+ 0, 1, ... N-1 as a template parameter pack, std::index_sequence is C++14.
+ Built by halves so the template recursion is only log2(N) deep.
+ */
+template <size_t... n>
+struct AMCIndexSequence {};
+
+template <class First, class Second>
+struct AMCJoinSequence;
+
+template <size_t... nFirst, size_t... nSecond>
+struct AMCJoinSequence<AMCIndexSequence<nFirst...>, AMCIndexSequence<nSecond...> > {
+    typedef AMCIndexSequence<nFirst..., (sizeof...(nFirst) + nSecond)...> type;
+};
+
+template <size_t N>
+struct AMCMakeSequence {
+    typedef typename AMCJoinSequence<typename AMCMakeSequence<N / 2>::type, typename AMCMakeSequence<N - N / 2>::type>::type type;
+};
+
+template <>
+struct AMCMakeSequence<0> {
+    typedef AMCIndexSequence<> type;
+};
+
+template <>
+struct AMCMakeSequence<1> {
+    typedef AMCIndexSequence<0> type;
+};
+
+template <size_t... nByte>
+constexpr AMCCRCTable makeCRCTable(AMCIndexSequence<nByte...>)
+{
+    return AMCCRCTable {{ { crcTableEntry(0, nByte)... }, { crcTableEntry(1, nByte)... },
+                          { crcTableEntry(2, nByte)... }, { crcTableEntry(3, nByte)... } }};
+}
+
+static_assert(CRC_SLICES == 4, "makeCRCTable builds 4 slices");
+
+class CAMCCRC
+{
+public:
+    CAMCCRC() : m_nCRC(CRC_XMODEM_START) {}
+
+    void        reset() { m_nCRC = CRC_XMODEM_START; }
+    void        update(unsigned char cByte) { m_nCRC = updateByte(m_nCRC, cByte); }
+    void        update(const unsigned char *pData, size_t nLen) { m_nCRC = update(m_nCRC, pData, nLen); }
+    uint16_t    value() const { return m_nCRC; }
+
+    // constexpr so AMCRegisters.h can compute the frame header CRCs with it
+    static constexpr uint16_t updateByte(uint16_t nCRC, unsigned char cByte)
+    {
+        return (uint16_t)((nCRC << 8) ^ m_Table.nEntry[0][(nCRC >> 8) ^ cByte]);
+    }
+    static uint16_t update(uint16_t nCRC, const unsigned char *pData, size_t nLen);
+    static uint16_t xmodem(const unsigned char *pData, size_t nLen) { return update(CRC_XMODEM_START, pData, nLen); }
+
+    static constexpr AMCCRCTable m_Table = makeCRCTable(AMCMakeSequence<256>::type());
+
+protected:
+    uint16_t    m_nCRC;
+};
+
+// the libcrc byte at a time table and ours have to agree
+static_assert(CAMCCRC::m_Table.nEntry[0][1] == 0x1021 && CAMCCRC::m_Table.nEntry[0][255] == 0x1EF0, "bad CRC table");
+
+#endif
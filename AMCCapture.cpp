@@ -0,0 +1,152 @@
+//
+//  AMCCapture.cpp
+//  AMCDrive X2 plugin
+//
+//  Binary capture of the serial traffic, see AMCCapture.h
+
+#include <string.h>
+#include <chrono>
+
+#if defined(SB_WIN_BUILD)
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+#include "AMCCapture.h"
+#include "AMCRegisters.h"
+
+CAMCCapture::CAMCCapture()
+{
+    m_pHeader = NULL;
+    m_pRecords = NULL;
+    m_nMapSize = 0;
+#if defined(SB_WIN_BUILD)
+    m_hFile = INVALID_HANDLE_VALUE;
+    m_hMapping = NULL;
+#else
+    m_nFd = -1;
+#endif
+}
+
+CAMCCapture::~CAMCCapture()
+{
+    close();
+}
+
+/*
+ Create (or truncate) the capture file at its full size and map it.
+ Allocating everything up front means no file growth or I/O while capturing.
+ */
+bool CAMCCapture::open(const char *pszPath, uint64_t nCapacity)
+{
+    void *pMap;
+
+    close();
+    if(!nCapacity)
+        return false;
+    m_nMapSize = sizeof(AMCCaptureFileHeader) + (size_t)nCapacity * sizeof(AMCCaptureRecord);
+
+#if defined(SB_WIN_BUILD)
+    m_hFile = CreateFileA(pszPath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(m_hFile == INVALID_HANDLE_VALUE)
+        return false;
+    m_hMapping = CreateFileMappingA(m_hFile, NULL, PAGE_READWRITE, (DWORD)((uint64_t)m_nMapSize >> 32), (DWORD)(m_nMapSize & 0xFFFFFFFF), NULL);
+    pMap = m_hMapping ? MapViewOfFile(m_hMapping, FILE_MAP_WRITE, 0, 0, m_nMapSize) : NULL;
+    if(!pMap) {
+        if(m_hMapping)
+            CloseHandle(m_hMapping);
+        CloseHandle(m_hFile);
+        m_hMapping = NULL;
+        m_hFile = INVALID_HANDLE_VALUE;
+        return false;
+    }
+#else
+    m_nFd = ::open(pszPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(m_nFd < 0)
+        return false;
+    if(ftruncate(m_nFd, (off_t)m_nMapSize) != 0 ||
+       (pMap = mmap(NULL, m_nMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_nFd, 0)) == MAP_FAILED) {
+        ::close(m_nFd);
+        m_nFd = -1;
+        return false;
+    }
+#endif
+
+    m_pHeader = (AMCCaptureFileHeader *)pMap;
+    m_pRecords = (AMCCaptureRecord *)((unsigned char *)pMap + sizeof(AMCCaptureFileHeader));
+
+    memset(m_pHeader, 0, sizeof(AMCCaptureFileHeader));
+    memcpy(m_pHeader->szMagic, CAPTURE_MAGIC, sizeof(m_pHeader->szMagic));
+    m_pHeader->nVersion = CAPTURE_VERSION;
+    m_pHeader->nRecordSize = sizeof(AMCCaptureRecord);
+    m_pHeader->nCapacity = nCapacity;
+    m_pHeader->nWritten = 0;
+    m_pHeader->nStartTimeNs = nowNs();
+    m_pHeader->nStartWallUs = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    return true;
+}
+
+void CAMCCapture::close()
+{
+    if(!m_pHeader)
+        return;
+
+#if defined(SB_WIN_BUILD)
+    FlushViewOfFile(m_pHeader, m_nMapSize);
+    UnmapViewOfFile(m_pHeader);
+    CloseHandle(m_hMapping);
+    CloseHandle(m_hFile);
+    m_hMapping = NULL;
+    m_hFile = INVALID_HANDLE_VALUE;
+#else
+    msync(m_pHeader, m_nMapSize, MS_ASYNC);
+    munmap(m_pHeader, m_nMapSize);
+    ::close(m_nFd);
+    m_nFd = -1;
+#endif
+    m_pHeader = NULL;
+    m_pRecords = NULL;
+    m_nMapSize = 0;
+}
+
+void CAMCCapture::record(int nDirection, const unsigned char *pFrame, int nFrameLen, const unsigned char *pRequest, uint64_t nTimeNs, uint32_t nLatencyUs)
+{
+    AMCCaptureRecord *pRecord;
+    int nCopyLen;
+
+    if(!m_pRecords)
+        return;
+
+    pRecord = &m_pRecords[m_pHeader->nWritten % m_pHeader->nCapacity];
+    pRecord->nTimeNs = nTimeNs;
+    pRecord->nLatencyUs = nLatencyUs;
+    pRecord->cDirection = (uint8_t)nDirection;
+    pRecord->cSeq = nFrameLen > 2 ? (pFrame[2] >> 2) & 0x0F : 0;
+    if(pRequest) {
+        pRecord->cOp = pRequest[2] & 0x03;
+        pRecord->cIndex = pRequest[3];
+        pRecord->cOffset = pRequest[4];
+        pRecord->nRequestData = (pRecord->cOp == CB_WRITE && pRequest[5]) ? (uint16_t)(pRequest[FRAME_HEADER_LEN] | pRequest[FRAME_HEADER_LEN + 1] << 8) : 0;
+    }
+    else {
+        pRecord->cOp = 0;
+        pRecord->cIndex = 0;
+        pRecord->cOffset = 0;
+        pRecord->nRequestData = 0;
+    }
+    pRecord->cReserved = 0;
+    pRecord->nReserved = 0;
+    pRecord->nFrameLen = (uint16_t)nFrameLen;
+    nCopyLen = nFrameLen < CAPTURE_FRAME_BYTES ? nFrameLen : CAPTURE_FRAME_BYTES;
+    memcpy(pRecord->cFrame, pFrame, (size_t)nCopyLen);
+    // readers use nWritten to know which records are valid, bump it last
+    m_pHeader->nWritten++;
+}
+
+uint64_t CAMCCapture::nowNs()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
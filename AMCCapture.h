@@ -0,0 +1,87 @@
+//
+//  AMCCapture.h
+//  AMCDrive X2 plugin
+//
+//  Binary capture of the serial traffic. Every frame sent or received is
+//  stored as a fixed size record in a preallocated file that is memory mapped,
+//  so capturing a frame is a memcpy into the page cache, the OS writes it out.
+//  The file is a ring, once nCapacity records have been written the oldest
+//  ones are overwritten. tools/amccapdump decodes it.
+//  All fields are little endian, like every platform the plugin runs on.
+
+#ifndef __AMCCapture__
+#define __AMCCapture__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CAPTURE_MAGIC           "AMCCAP01"
+#define CAPTURE_VERSION         1
+#define CAPTURE_FRAME_BYTES     104     // longer frames are truncated, nFrameLen has the real length
+#define DEF_CAPTURE_RECORDS     524288  // 64MB, about a night of polling every 100ms
+
+enum AMCCaptureDirection {
+    CAPTURE_TX = 0,     // request sent
+    CAPTURE_RX,         // reply matched to its request
+    CAPTURE_RX_STALE,   // late reply to a request we gave up on
+    CAPTURE_TIMEOUT     // no reply, the frame is the request
+};
+
+struct AMCCaptureFileHeader {
+    char        szMagic[8];
+    uint32_t    nVersion;
+    uint32_t    nRecordSize;
+    uint64_t    nCapacity;          // records
+    uint64_t    nWritten;           // records written since the capture started
+    uint64_t    nStartTimeNs;       // monotonic clock when the capture started
+    uint64_t    nStartWallUs;       // wall clock at the same time, µs since the epoch
+    uint8_t     cReserved[16];
+};
+
+struct AMCCaptureRecord {
+    uint64_t    nTimeNs;            // monotonic clock
+    uint32_t    nLatencyUs;         // RX and TIMEOUT : since the request was sent
+    uint8_t     cDirection;
+    uint8_t     cSeq;
+    uint8_t     cOp;                // CB_READ or CB_WRITE of the request
+    uint8_t     cIndex;             // register of the request, for the replies too
+    uint8_t     cOffset;
+    uint8_t     cReserved;
+    uint16_t    nFrameLen;
+    uint16_t    nRequestData;       // first data word of a write request, tells the control word commands apart
+    uint16_t    nReserved;
+    uint8_t     cFrame[CAPTURE_FRAME_BYTES];
+};
+
+static_assert(sizeof(AMCCaptureFileHeader) == 64, "capture file header layout changed");
+static_assert(sizeof(AMCCaptureRecord) == 128, "capture record layout changed");
+
+class CAMCCapture
+{
+public:
+    CAMCCapture();
+    ~CAMCCapture();
+
+    bool        open(const char *pszPath, uint64_t nCapacity = DEF_CAPTURE_RECORDS);
+    void        close();
+    bool        isOpen() const { return m_pRecords != NULL; }
+
+    // not thread safe, the caller serializes (CAMCDrive holds its I/O lock)
+    // pRequest is the request the frame belongs to, NULL for a stale reply
+    void        record(int nDirection, const unsigned char *pFrame, int nFrameLen, const unsigned char *pRequest, uint64_t nTimeNs, uint32_t nLatencyUs);
+
+    static uint64_t nowNs();
+
+protected:
+    AMCCaptureFileHeader    *m_pHeader;
+    AMCCaptureRecord        *m_pRecords;
+    size_t                  m_nMapSize;
+#if defined(SB_WIN_BUILD)
+    void                    *m_hFile;
+    void                    *m_hMapping;
+#else
+    int                     m_nFd;
+#endif
+};
+
+#endif
@@ -12,13 +12,14 @@ CAMCDrive::CAMCDrive()
     // set some sane values
     m_bDebugLog = true;
     
-    m_pSerx = NULL;
+    m_pTransport = &m_SerXTransport;
     m_bIsConnected = false;
 
     m_nNbTicksPerRev = 0;
 
     m_dHomeAz = 0.0;
     m_dParkAz = 0.0;
+    m_dCableWrapLimit = 0.0;
 
     m_dCurrentAzPosition = 0.0;
     m_dCurrentElPosition = 0.0;
@@ -33,39 +34,84 @@ CAMCDrive::CAMCDrive()
     m_nHomingTries = 0;
     m_nGotoTries = 0;
     m_goto_find_home = true;
+    m_dGotoAz = 0.0;
+    m_bGotoPending = false;
+    m_nGotoCancelGeneration = 0;
+    m_nRetargets = 0;
+    m_nCoalescedGotos = 0;
+
+    m_nMotionCmd = NONE;
+    m_nMotionTarget = 0;
+    m_nMotionCmdMs = 0;
+    m_bMotionStarted = false;
+    m_bHaveMotionTicks = false;
+    m_nMotionTicks = 0;
+    m_nSettleTicks = 1;
+    m_dGotoTolerance = DEF_GOTO_TOLERANCE_ARCMIN;
+    m_nGotoToleranceTicks = 1;
 
     m_cSeqNumber = 0;
+    m_nMaxInFlight = DEF_MAX_IN_FLIGHT;
+    m_nInFlightLimit = DEF_MAX_IN_FLIGHT;
+    m_nLastFaultBits = 0;
+    m_nCleanTransactions = 0;
+
+    m_nMotionGeneration = 0;
+    m_nCancelGeneration = 0;
+    m_nBridgeState = BRIDGE_UNKNOWN;
+    m_nPollPeriodMs = 0;
+    m_nNextPollMs = 0;
+    m_bPollNow = false;
+    m_nPollCount = 0;
+    m_nSnapshotMaxAgeMs = DEF_SNAPSHOT_MAX_AGE;
+    m_bPollerRunning = false;
+    memset(&m_CachedStatus, 0, sizeof(StatusSnapshot));
+    m_nLinkDeadlineMs[REQ_SAFETY] = LINK_DEADLINE_SAFETY;
+    m_nLinkDeadlineMs[REQ_MOTION] = LINK_DEADLINE_MOTION;
+    m_nLinkDeadlineMs[REQ_TELEMETRY] = LINK_DEADLINE_TELEMETRY;
+    m_nStopSentMs = 0;
+    m_nStopCommandMs = -1;
+    m_nStopLatencyMs = -1;
+    m_bTracking = false;
+    m_dTrackAz = 0;
+    m_dTrackRate = 0;
+    m_nTrackStartMs = 0;
+    m_dTrackCorrection = 0;
+    m_dTrackErrorSum = 0;
+    memset(&m_TrackStats, 0, sizeof(TrackingStats));
+    m_nShutterState = CLOSED;
 
     memset(m_szFirmwareVersion,0,SERIAL_BUFFER_SIZE);
     memset(m_szProdInfo,0,SERIAL_BUFFER_SIZE);
     memset(m_szLogBuffer,0,LOG_BUFFER_SIZE);
     
-#ifdef LOG_DEBUG
 #if defined(SB_WIN_BUILD)
     m_sLogfilePath = getenv("HOMEDRIVE");
     m_sLogfilePath += getenv("HOMEPATH");
+    m_sCapturePath = m_sLogfilePath + "\\AMCDriveCapture.bin";
+    m_sStatsPath = m_sLogfilePath + "\\AMCDriveStats.json";
     m_sLogfilePath += "\\AMCDriveLog.txt";
 #elif defined(SB_LINUX_BUILD)
     m_sLogfilePath = "/tmp/AMCDriveLog.txt";
+    m_sCapturePath = "/tmp/AMCDriveCapture.bin";
+    m_sStatsPath = "/tmp/AMCDriveStats.json";
 #elif defined(SB_MAC_BUILD)
     m_sLogfilePath = "/tmp/AMCDriveLog.txt";
+    m_sCapturePath = "/tmp/AMCDriveCapture.bin";
+    m_sStatsPath = "/tmp/AMCDriveStats.json";
 #endif
-    Logfile = fopen(m_sLogfilePath.c_str(), "w");
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] CAMCDrive Constructor Called.\n", timestamp);
-    fflush(Logfile);
-#endif
+    setLogLevel(DEF_LOG_LEVEL);
+    if(m_Log.isEnabled(AMC_LOG_INFO))
+        m_Log.out("CAMCDrive Constructor Called.\n");
 
 }
 
 CAMCDrive::~CAMCDrive()
 {
-#ifdef	LOG_DEBUG
-    // Close LogFile
-    if (Logfile) fclose(Logfile);
-#endif
+    stopPoller();
+    m_Capture.close();
+    // write out what is still queued and close the log file
+    m_Log.close();
 
 }
 
@@ -75,17 +121,11 @@ int CAMCDrive::Connect(const char *pszPort)
 {
     int nErr;
     
-#ifdef LOG_DEBUG
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] CAMCDrive::Connect Called %s\n", timestamp, pszPort);
-    fflush(Logfile);
-#endif
+    if(m_Log.isEnabled(AMC_LOG_INFO))
+        m_Log.out("CAMCDrive::Connect Called %s\n", pszPort);
 
 
-    // 9600 8N1
-    if(m_pSerx->open(pszPort, 115200, SerXInterface::B_NOPARITY, "-DTR_CONTROL 1") == 0)
+    if(m_pTransport->open(pszPort) == 0)
         m_bIsConnected = true;
     else
         m_bIsConnected = false;
@@ -93,67 +133,49 @@ int CAMCDrive::Connect(const char *pszPort)
     if(!m_bIsConnected)
         return ERR_COMMNOLINK;
 
-#ifdef LOG_DEBUG
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] CAMCDrive::Connect connected to %s\n", timestamp, pszPort);
-    fflush(Logfile);
-#endif
+    m_pTransport->purgeTxRx();
+    m_RxDecoder.reset();
+    memset(&m_CachedStatus, 0, sizeof(StatusSnapshot));
+    m_nInFlightLimit = m_nMaxInFlight;
+
+    if(m_Log.isEnabled(AMC_LOG_INFO))
+        m_Log.out("CAMCDrive::Connect connected to %s\n", pszPort);
 
     if (m_bDebugLog) {
         snprintf(m_szLogBuffer,LOG_BUFFER_SIZE,"[CAMCDrive::Connect] Connected.");
         m_pLogger->out(m_szLogBuffer);
     }
 
-#ifdef LOG_DEBUG
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] CAMCDrive::Connect gain write access\n", timestamp);
-    fflush(Logfile);
-#endif
+    if(m_Log.isEnabled(AMC_LOG_INFO))
+        m_Log.out("CAMCDrive::Connect gain write access\n");
 
     nErr = gainWriteAccess();
     nErr = abortCurrentCommand();
     nErr = enableBridge();
 
-#ifdef LOG_DEBUG
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] CAMCDrive::Connect Getting Product Info\n", timestamp);
-    fflush(Logfile);
-#endif
+    if(m_Log.isEnabled(AMC_LOG_INFO))
+        m_Log.out("CAMCDrive::Connect Getting Product Info\n");
 
     nErr = getProductInformation(m_szProdInfo, SERIAL_BUFFER_SIZE);
 
-#ifdef LOG_DEBUG
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] CAMCDrive::Connect m_szProdInfo : %s\n", timestamp, m_szProdInfo);
-    fflush(Logfile);
-#endif
+    if(m_Log.isEnabled(AMC_LOG_INFO))
+        m_Log.out("CAMCDrive::Connect m_szProdInfo : %s\n", m_szProdInfo);
 
 
-#ifdef LOG_DEBUG
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] CAMCDrive::Connect Getting Firmware\n", timestamp);
-    fflush(Logfile);
-#endif
+    if(m_Log.isEnabled(AMC_LOG_INFO))
+        m_Log.out("CAMCDrive::Connect Getting Firmware\n");
 
     nErr = getFirmwareVersion(m_szFirmwareVersion, SERIAL_BUFFER_SIZE);
 
-#ifdef LOG_DEBUG
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] CAMCDrive::Connect m_szFirmwareVersion :  %s\n", timestamp, m_szFirmwareVersion);
-    fflush(Logfile);
-#endif
+    // seed the published dome state
+    getDomeAz(m_dCurrentAzPosition);
+    publishFlags();
+
+    if(m_nPollPeriodMs)
+        startPoller();
+
+    if(m_Log.isEnabled(AMC_LOG_INFO))
+        m_Log.out("CAMCDrive::Connect m_szFirmwareVersion :  %s\n", m_szFirmwareVersion);
 
     return SB_OK;
 }
@@ -161,262 +183,447 @@ int CAMCDrive::Connect(const char *pszPort)
 
 void CAMCDrive::Disconnect()
 {
+    stopTracking();
+    stopPoller();
 
     disableBridge();
+    setBridgeState(BRIDGE_UNKNOWN);
 
     if(m_bIsConnected) {
-        m_pSerx->purgeTxRx();
-        m_pSerx->close();
+        m_pTransport->purgeTxRx();
+        m_pTransport->close();
     }
     m_bIsConnected = false;
 }
 
 
-int CAMCDrive::readResponse(unsigned char *szRespBuffer, int nBufferLen)
+/*
+ Get the next complete frame from the RX decoder, reading from the port as needed.
+ The frame can be for any sequence number, matching it is up to the caller.
+ */
+int CAMCDrive::readResponse(unsigned char *szRespBuffer, int nBufferLen, CStopWatch &frameTimer)
 {
     int nErr = OK;
-    unsigned long ulBytesRead = 0;
-    unsigned long ulTotalBytesRead = 0;
-    unsigned char *pszBufPtr;
-    unsigned int nDataLen = 0;
-    uint8_t s1,s2;
-    uint16_t nCRC;
 
     memset(szRespBuffer, 0, (size_t) nBufferLen);
-    pszBufPtr = szRespBuffer;
 
-    // read response header
-    do {
-        nErr = m_pSerx->readFile(pszBufPtr, 1, ulBytesRead, MAX_TIMEOUT);
+    while(!m_RxDecoder.nextFrame(szRespBuffer, nBufferLen)) {
+        nErr = fillRxDecoder(frameTimer);
         if(nErr) {
             if (m_bDebugLog) {
-                snprintf(m_szLogBuffer,LOG_BUFFER_SIZE,"[CAMCDrive::readResponse] header readFile error.");
+                snprintf(m_szLogBuffer,LOG_BUFFER_SIZE,"[CAMCDrive::readResponse] readFile %s.", nErr == BAD_CMD_RESPONSE ? "Timeout" : "error");
                 m_pLogger->out(m_szLogBuffer);
             }
+            if(m_Log.isEnabled(AMC_LOG_ERROR))
+                m_Log.out("CAMCDrive::readResponse Timeout while waiting for response from controller\n");
             return nErr;
         }
+    }
 
-        if (ulBytesRead !=1) {// timeout
-            if (m_bDebugLog) {
-                snprintf(m_szLogBuffer,LOG_BUFFER_SIZE,"[CAMCDrive::readResponse] header readFile Timeout.");
-                m_pLogger->out(m_szLogBuffer);
-            }
-#ifdef LOG_DEBUG
-            ltime = time(NULL);
-            timestamp = asctime(localtime(&ltime));
-            timestamp[strlen(timestamp) - 1] = 0;
-            fprintf(Logfile, "[%s] CAMCDrive::readResponse Timeout while waiting for response header from controller\n", timestamp);
-            fflush(Logfile);
-#endif
-            return BAD_CMD_RESPONSE;
-        }
-        ulTotalBytesRead += ulBytesRead;
-        pszBufPtr++;
-    } while (ulTotalBytesRead < 8); // header with CRC is 8 bytes
-
-    // crc check the header
-    nCRC = crc_xmodem(szRespBuffer, 6);
-#ifdef LOG_DEBUG
-    unsigned char cHexBuf[LOG_BUFFER_SIZE];
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    hexdump(szRespBuffer, cHexBuf, 8, LOG_BUFFER_SIZE);
-    fprintf(Logfile, "[%s] CAMCDrive::readResponse response header : %s\n", timestamp, cHexBuf);
-    fprintf(Logfile, "[%s] CAMCDrive::readResponse response header CRC : %04X\n", timestamp, nCRC);
-    fflush(Logfile);
-#endif
+    return nErr;
+}
+
+/*
+ Check the status of a response frame.
+ The RX decoder only hands out frames whose header CRC matched, so that is
+ already done. nDataCRC is the CRC of the data words, the decoder computed it
+ as they came in, we just compare it to the one in the frame (MSB first).
+ */
+int CAMCDrive::checkResponse(const unsigned char *szRespBuffer, uint16_t nDataCRC)
+{
+    unsigned int nDataLen = 0;
+    uint8_t s1;
+    uint16_t nFrameCRC;
 
+    if(m_Log.isEnabled(AMC_LOG_TRACE))
+        m_Log.outFrame(szRespBuffer, FRAME_HEADER_LEN, "CAMCDrive::checkResponse response header : ");
 
-    // if(!memcmp(&nCRC, szRespBuffer+6, 2)) // CRC error
-    //  return BAD_CMD_RESPONSE;
+    nDataLen = szRespBuffer[5] * 2; // value is in 2 word (2 bytes)
+    if(nDataLen){
+        // crc check the data
+        nFrameCRC = (uint16_t)((szRespBuffer[FRAME_HEADER_LEN + nDataLen] << 8) | szRespBuffer[FRAME_HEADER_LEN + nDataLen + 1]);
+        if(m_Log.isEnabled(AMC_LOG_TRACE)) {
+            m_Log.outFrame(szRespBuffer + FRAME_HEADER_LEN, nDataLen, "CAMCDrive::checkResponse response data : ");
+            m_Log.out("CAMCDrive::checkResponse response data CRC : %04X, computed : %04X\n", nFrameCRC, nDataCRC);
+        }
+        if(nFrameCRC != nDataCRC) {
+            if(m_Log.isEnabled(AMC_LOG_ERROR))
+                m_Log.out("CAMCDrive::checkResponse data CRC error, got %04X expected %04X\n", nFrameCRC, nDataCRC);
+            return BAD_CRC;
+        }
+    }
 
     s1 = szRespBuffer[3];
-    s2 = szRespBuffer[4];
 
     if(s1 != 1) {// error ?
         return BAD_CMD_RESPONSE;
     }
 
-    nDataLen = szRespBuffer[5] * 2; // value is in 2 word (2 bytes)
-    if(nDataLen){
-
-        // read data
-        ulTotalBytesRead = 0;
-        do {
-            nErr = m_pSerx->readFile(pszBufPtr, 1, ulBytesRead, MAX_TIMEOUT);
-            if(nErr) {
-                if (m_bDebugLog) {
-                    snprintf(m_szLogBuffer,LOG_BUFFER_SIZE,"[CAMCDrive::readResponse] data readFile error.");
-                    m_pLogger->out(m_szLogBuffer);
-                }
-                return nErr;
-            }
+    return OK;
+}
 
-            if (ulBytesRead !=1) {// timeout
-                if (m_bDebugLog) {
-                    snprintf(m_szLogBuffer,LOG_BUFFER_SIZE,"[CAMCDrive::readResponse] data readFile Timeout.");
-                    m_pLogger->out(m_szLogBuffer);
-                }
-#ifdef LOG_DEBUG
-                ltime = time(NULL);
-                timestamp = asctime(localtime(&ltime));
-                timestamp[strlen(timestamp) - 1] = 0;
-                fprintf(Logfile, "[%s] CAMCDrive::readResponse Timeout while waiting for response data from controller\n", timestamp);
-                fflush(Logfile);
-#endif
-                return BAD_CMD_RESPONSE;
-            }
-            ulTotalBytesRead += ulBytesRead;
-            pszBufPtr++;
-        } while (ulTotalBytesRead < (nDataLen + 2)); // datalen + crc
+/*
+ Read from the port into the RX decoder. We ask for what the decoder still
+ needs to complete the current frame (header first, then data + crc) or for
+ whatever is already waiting if that's more.
+ frameTimer was started when we began waiting for the frame so the whole
+ frame shares a single MAX_TIMEOUT deadline.
+ */
+int CAMCDrive::fillRxDecoder(CStopWatch &frameTimer)
+{
+    int nErr = OK;
+    int nBytesWaiting = 0;
+    unsigned long ulBytesToRead;
+    unsigned long ulBytesRead = 0;
+    long nTimeLeft;
+    unsigned char szRxBuf[SERIAL_BUFFER_SIZE];
+
+    nTimeLeft = MAX_TIMEOUT - (long)(frameTimer.GetElapsedSeconds() * 1000);
+    if(nTimeLeft <= 0)
+        return BAD_CMD_RESPONSE; // timeout
+
+    m_pTransport->bytesWaitingRx(nBytesWaiting);
+    ulBytesToRead = m_RxDecoder.bytesNeeded();
+    if((unsigned long)nBytesWaiting > ulBytesToRead)
+        ulBytesToRead = nBytesWaiting;
+    if(ulBytesToRead > (unsigned long)m_RxDecoder.freeSpace())
+        ulBytesToRead = m_RxDecoder.freeSpace();
+    if(ulBytesToRead > SERIAL_BUFFER_SIZE)
+        ulBytesToRead = SERIAL_BUFFER_SIZE;
+
+    nErr = m_pTransport->readFile(szRxBuf, ulBytesToRead, ulBytesRead, (unsigned long)nTimeLeft);
+    if(nErr)
+        return nErr;
+    if(!ulBytesRead) // nothing came in before the timeout
+        return BAD_CMD_RESPONSE;
 
-        // crc check the data
-        nCRC = crc_xmodem(szRespBuffer + 8, nDataLen);
-#ifdef LOG_DEBUG
-        unsigned char cHexBuf[LOG_BUFFER_SIZE];
-        ltime = time(NULL);
-        timestamp = asctime(localtime(&ltime));
-        timestamp[strlen(timestamp) - 1] = 0;
-        hexdump(szRespBuffer + 8, cHexBuf, nDataLen, LOG_BUFFER_SIZE);
-        fprintf(Logfile, "[%s] CAMCDrive::readResponse response data : %s\n", timestamp, cHexBuf);
-        fprintf(Logfile, "[%s] CAMCDrive::readResponse response data CRC : %04X\n", timestamp, nCRC);
-        fflush(Logfile);
-#endif
+    m_RxDecoder.push(szRxBuf, (int)ulBytesRead);
+    return nErr;
+}
 
-        // if(!memcmp(&nCRC, szRespBuffer + 8 + nDataLen, 2)) // CRC error
-        //  return BAD_CMD_RESPONSE;
+/*
+ Pull in whatever is already sitting in the port without waiting and throw
+ away any complete frame, they're late replies to commands we gave up on.
+ A partial frame is kept, the sequence number check in readResponse will
+ drop it once it's complete.
+ */
+void CAMCDrive::dropStaleFrames()
+{
+    int nBytesWaiting = 0;
+    unsigned long ulBytesRead = 0;
+    unsigned char szRxBuf[SERIAL_BUFFER_SIZE];
+
+    m_pTransport->bytesWaitingRx(nBytesWaiting);
+    if(nBytesWaiting > m_RxDecoder.freeSpace())
+        nBytesWaiting = m_RxDecoder.freeSpace();
+    if(nBytesWaiting > SERIAL_BUFFER_SIZE)
+        nBytesWaiting = SERIAL_BUFFER_SIZE;
+    if(nBytesWaiting > 0 && m_pTransport->readFile(szRxBuf, nBytesWaiting, ulBytesRead, 0) == 0)
+        m_RxDecoder.push(szRxBuf, (int)ulBytesRead);
+
+    while(m_RxDecoder.nextFrame(szRxBuf, SERIAL_BUFFER_SIZE)) {
+        m_Stats.count(STAT_STALE_FRAMES);
+        if(m_Capture.isOpen())
+            m_Capture.record(CAPTURE_RX_STALE, szRxBuf, CAMCFrameDecoder::frameLength(szRxBuf), NULL, CAMCCapture::nowNs(), 0);
+        if(m_Log.isEnabled(AMC_LOG_TRACE))
+            m_Log.out("CAMCDrive::dropStaleFrames dropping late frame with sequence %d\n", (szRxBuf[2] >> 2) & 0x0F);
     }
-
-    return nErr;
 }
 
 
-int CAMCDrive::domeCommand(const unsigned char *pszCmd, int nCmdSize, unsigned char *pszResult, int nResultMaxLen)
+int CAMCDrive::domeCommand(const unsigned char *pszCmd, int nCmdSize, unsigned char *pszResult, int nResultMaxLen, const uint32_t *pCancelGeneration)
 {
     int nErr = 0;
-    unsigned char szResp[SERIAL_BUFFER_SIZE];
-    unsigned long  ulBytesWrite;
-
-    m_pSerx->purgeTxRx();
+    unsigned char szResp[MAX_FRAME_LEN];
+    AMCRequest request;
 
-#ifdef LOG_DEBUG
-    unsigned char cHexBuf[LOG_BUFFER_SIZE];
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    hexdump(pszCmd , cHexBuf, nCmdSize, LOG_BUFFER_SIZE);
-    fprintf(Logfile, "[%s] CAMCDrive::domeCommand sending : %s\n", timestamp, cHexBuf);
-    fflush(Logfile);
-#endif
+    request.pCmd = pszCmd;
+    request.nCmdSize = nCmdSize;
+    request.pResp = szResp;
+    request.nRespMaxLen = MAX_FRAME_LEN;
 
-    nErr = m_pSerx->writeFile((void *)pszCmd, nCmdSize, ulBytesWrite);
-    m_pSerx->flushTx();
+    nErr = domeTransaction(&request, 1, pCancelGeneration);
     if(nErr)
         return nErr;
-    // read response
-    nErr = readResponse(szResp, SERIAL_BUFFER_SIZE);
-    if(nErr) {
-
-#ifdef LOG_DEBUG
-        ltime = time(NULL);
-        timestamp = asctime(localtime(&ltime));
-        timestamp[strlen(timestamp) - 1] = 0;
-        int resp_len = szResp[5]*2;
-        if(resp_len)
-            resp_len +=2;
-        resp_len += 8; // header
-        hexdump(szResp , cHexBuf, resp_len , LOG_BUFFER_SIZE);
-        fprintf(Logfile, "[%s] CAMCDrive::domeCommand ***** ERROR READING RESPONSE **** error = %d , response : %s\n\n", timestamp, nErr, cHexBuf);
-        fflush(Logfile);
-#endif
-
-        return nErr;
-    }
-#ifdef LOG_DEBUG
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    int resp_len = szResp[5]*2;
-    if(resp_len)
-        resp_len +=2;
-    resp_len += 8; // header
-    hexdump(szResp , cHexBuf, resp_len, LOG_BUFFER_SIZE);
-    fprintf(Logfile, "[%s] CAMCDrive::domeCommand response : %s\n", timestamp, cHexBuf);
-    fflush(Logfile);
-    fprintf(Logfile, "[%s] .................................\n", timestamp);
-    fflush(Logfile);
-#endif
 
     if(pszResult)
-        memcpy(pszResult, szResp, nResultMaxLen);
+        memcpy(pszResult, szResp, nResultMaxLen < MAX_FRAME_LEN ? nResultMaxLen : MAX_FRAME_LEN);
 
     return nErr;
 
 }
 
-#pragma mark - Dome coordinate and state
+/*
+ Reads are telemetry, a write to the control register that stops the dome or
+ disables the bridge is safety, any other write moves or configures the
+ drive and is motion.
+ */
+int CAMCDrive::requestClass(const unsigned char *pCmd)
+{
+    uint16_t nData;
+
+    if((pCmd[2] & 0x03) != CB_WRITE)
+        return REQ_TELEMETRY;
+    if(pCmd[3] == BRIDGE_I && pCmd[4] == BRIDGE_O) {
+        nData = (uint16_t)(pCmd[FRAME_HEADER_LEN] | pCmd[FRAME_HEADER_LEN + 1] << 8);
+        if(nData & (STOP_D | DIS_BRIDGE_D))
+            return REQ_SAFETY;
+    }
+    return REQ_MOTION;
+}
 
-int CAMCDrive::getDomeAz(double &dDomeAz)
+/*
+ Send a batch of requests and collect their responses.
+ Up to m_nInFlightLimit requests are written back to back before we wait for
+ the replies, which are matched to their request with the 4 bits sequence
+ number in the control byte. With m_nInFlightLimit set to 1 this is the plain
+ stop-and-wait we always did.
+ The requests must have been built with consecutive sequence numbers, so
+ there is never more than 15 of them on the wire with the same number.
+ Each request gets its own nErr, the first error is returned.
+ The poller thread shares the link with us, m_LinkArbiter hands it out by
+ request class (see requestClass), a batch takes the class of its most urgent
+ request. A batch that sees a more urgent one waiting stops sending and lets
+ it have the link as soon as its own requests in flight are answered.
+ A batch that can't get the link before its class deadline fails with
+ LINK_TIMEOUT without sending anything.
+ The poller's motion writes (tracking targets, held gotos) pass the
+ m_nCancelGeneration they were decided under. If an abort or the end of
+ tracking bumped it since, what's left of the batch fails with
+ MOTION_CANCELLED. It's checked with m_IOLock held right before each write, so
+ a write either goes out before the abort's STOP or not at all.
+ */
+int CAMCDrive::domeTransaction(AMCRequest *pRequests, int nNbRequests, const uint32_t *pCancelGeneration)
+{
+    int nErr = OK;
+    int nIdx;
+    int nNextToSend = 0;
+    int nInFlight = 0;
+    int nDone = 0;
+    int nSeq;
+    int nRespLen;
+    uint64_t nNowNs;
+    unsigned long  ulBytesWrite;
+    unsigned char szResp[MAX_FRAME_LEN];
+    CStopWatch frameTimer;
+    int nClass = REQ_TELEMETRY;
+
+    for(nIdx = 0; nIdx < nNbRequests; nIdx++)
+        if(requestClass(pRequests[nIdx].pCmd) < nClass)
+            nClass = requestClass(pRequests[nIdx].pCmd);
+
+    CLinkGrant link(m_LinkArbiter, nClass, m_nLinkDeadlineMs[nClass]);
+    if(!link.owned()) {
+        if(m_Log.isEnabled(AMC_LOG_ERROR))
+            m_Log.out("CAMCDrive::domeTransaction no link after %d ms for a class %d batch\n", m_nLinkDeadlineMs[nClass], nClass);
+        for(nIdx = 0; nIdx < nNbRequests; nIdx++)
+            pRequests[nIdx].nErr = LINK_TIMEOUT;
+        m_Stats.count(STAT_LINK_TIMEOUTS);
+        return LINK_TIMEOUT;
+    }
+    std::unique_lock<std::mutex> lock(m_IOLock);
+
+    for(nIdx = 0; nIdx < nNbRequests; nIdx++) {
+        pRequests[nIdx].nErr = OK;
+        pRequests[nIdx].nState = REQ_PENDING;
+        pRequests[nIdx].nRetries = 0;
+        pRequests[nIdx].nSentNs = 0;
+    }
+
+    dropStaleFrames();
+
+    while(nDone < nNbRequests) {
+        // fill the window
+        while(nNextToSend < nNbRequests && nInFlight < m_nInFlightLimit) {
+            if(m_LinkArbiter.preempted(nClass)) {
+                if(nInFlight)
+                    break;
+                // nothing of ours on the wire, step aside until it's done
+                lock.unlock();
+                link.yield();
+                lock.lock();
+            }
+            if(pCancelGeneration && *pCancelGeneration != m_nCancelGeneration) {
+                if(m_Log.isEnabled(AMC_LOG_INFO))
+                    m_Log.outFrame(pRequests[nNextToSend].pCmd, pRequests[nNextToSend].nCmdSize, "CAMCDrive::domeTransaction cancelled by an abort, not sending : ");
+                for(nIdx = nNextToSend; nIdx < nNbRequests; nIdx++)
+                    pRequests[nIdx].nErr = MOTION_CANCELLED;
+                return MOTION_CANCELLED;
+            }
+            if(m_Log.isEnabled(AMC_LOG_TRACE))
+                m_Log.outFrame(pRequests[nNextToSend].pCmd, pRequests[nNextToSend].nCmdSize, "CAMCDrive::domeTransaction sending : ");
+            // always, it's also what the latency histograms use
+            pRequests[nNextToSend].nSentNs = CAMCCapture::nowNs();
+            nErr = m_pTransport->writeFile(pRequests[nNextToSend].pCmd, pRequests[nNextToSend].nCmdSize, ulBytesWrite);
+            if(nErr) {
+                for(nIdx = nNextToSend; nIdx < nNbRequests; nIdx++)
+                    pRequests[nIdx].nErr = nErr;
+                return nErr;
+            }
+            if(m_Capture.isOpen())
+                m_Capture.record(CAPTURE_TX, pRequests[nNextToSend].pCmd, pRequests[nNextToSend].nCmdSize, pRequests[nNextToSend].pCmd, pRequests[nNextToSend].nSentNs, 0);
+            if(!nInFlight)
+                frameTimer.Reset();
+            pRequests[nNextToSend].nState = REQ_IN_FLIGHT;
+            nNextToSend++;
+            nInFlight++;
+        }
+        m_pTransport->flushTx();
+
+        // wait for the next reply
+        nErr = readResponse(szResp, MAX_FRAME_LEN, frameTimer);
+        if(nErr) {
+            m_Stats.count(STAT_TIMEOUTS);
+            if(m_Log.isEnabled(AMC_LOG_ERROR))
+                m_Log.out("CAMCDrive::domeTransaction ***** ERROR READING RESPONSE **** error = %d , %d request(s) in flight\n\n", nErr, nInFlight);
+            // anything still outstanding is lost
+            nNowNs = CAMCCapture::nowNs();
+            for(nIdx = 0; nIdx < nNbRequests; nIdx++) {
+                if(pRequests[nIdx].nState == REQ_IN_FLIGHT && m_Capture.isOpen())
+                    m_Capture.record(CAPTURE_TIMEOUT, pRequests[nIdx].pCmd, pRequests[nIdx].nCmdSize, pRequests[nIdx].pCmd, nNowNs, (uint32_t)((nNowNs - pRequests[nIdx].nSentNs) / 1000));
+                if(pRequests[nIdx].nState != REQ_DONE)
+                    pRequests[nIdx].nErr = nErr;
+            }
+            // a drive that can't queue requests will drop the extra ones, stop-and-wait
+            // for a while. It may just have been line noise, see the end of the loop.
+            if(nInFlight > 1) {
+                m_nInFlightLimit = 1;
+                m_nCleanTransactions = 0;
+                if(m_Log.isEnabled(AMC_LOG_INFO))
+                    m_Log.out("CAMCDrive::domeTransaction timeout with %d requests in flight, stop-and-wait for the next %d transactions\n", nInFlight, IN_FLIGHT_RESTORE_AFTER);
+                if (m_bDebugLog) {
+                    snprintf(m_szLogBuffer,LOG_BUFFER_SIZE,"[CAMCDrive::domeTransaction] Timeout with %d requests in flight, falling back to stop-and-wait.", nInFlight);
+                    m_pLogger->out(m_szLogBuffer);
+                }
+            }
+            return nErr;
+        }
+
+        nSeq = (szResp[2] >> 2) & 0x0F;
+        for(nIdx = 0; nIdx < nNextToSend; nIdx++) {
+            if(pRequests[nIdx].nState == REQ_IN_FLIGHT && ((pRequests[nIdx].pCmd[2] >> 2) & 0x0F) == nSeq)
+                break;
+        }
+        if(nIdx == nNextToSend) {
+            // late reply to an earlier command, drop it and keep waiting for ours
+            m_Stats.count(STAT_STALE_FRAMES);
+            if(m_Log.isEnabled(AMC_LOG_TRACE))
+                m_Log.out("CAMCDrive::domeTransaction dropping stale frame with sequence %d\n", nSeq);
+            if(m_Capture.isOpen())
+                m_Capture.record(CAPTURE_RX_STALE, szResp, CAMCFrameDecoder::frameLength(szResp), NULL, CAMCCapture::nowNs(), 0);
+            continue;
+        }
+
+        if(m_Log.isEnabled(AMC_LOG_TRACE)) {
+            m_Log.outFrame(szResp, CAMCFrameDecoder::frameLength(szResp), "CAMCDrive::domeTransaction response : ");
+            m_Log.out(".................................\n");
+        }
+        nRespLen = CAMCFrameDecoder::frameLength(szResp);
+        nNowNs = CAMCCapture::nowNs();
+        m_Stats.recordRequest(pRequests[nIdx].pCmd[3], (uint32_t)((nNowNs - pRequests[nIdx].nSentNs) / 1000));
+        if(m_Capture.isOpen()) {
+            m_Capture.record(CAPTURE_RX, szResp, nRespLen, pRequests[nIdx].pCmd, nNowNs, (uint32_t)((nNowNs - pRequests[nIdx].nSentNs) / 1000));
+        }
+        pRequests[nIdx].nErr = checkResponse(szResp, m_RxDecoder.lastDataCRC());
+        if(pRequests[nIdx].nErr == BAD_CRC)
+            m_Stats.count(STAT_CRC_ERRORS);
+        if(pRequests[nIdx].nErr == BAD_CRC && pRequests[nIdx].nRetries < MAX_CRC_RETRIES) {
+            // line noise, send just this request again with the same sequence number and keep going
+            pRequests[nIdx].nRetries++;
+            m_Stats.count(STAT_RETRIES);
+            if(m_Log.isEnabled(AMC_LOG_ERROR))
+                m_Log.outFrame(pRequests[nIdx].pCmd, pRequests[nIdx].nCmdSize, "CAMCDrive::domeTransaction CRC error, sending again : ");
+            pRequests[nIdx].nSentNs = CAMCCapture::nowNs();
+            nErr = m_pTransport->writeFile(pRequests[nIdx].pCmd, pRequests[nIdx].nCmdSize, ulBytesWrite);
+            if(nErr) {
+                for(nIdx = 0; nIdx < nNbRequests; nIdx++)
+                    if(pRequests[nIdx].nState != REQ_DONE)
+                        pRequests[nIdx].nErr = nErr;
+                return nErr;
+            }
+            m_pTransport->flushTx();
+            if(m_Capture.isOpen())
+                m_Capture.record(CAPTURE_TX, pRequests[nIdx].pCmd, pRequests[nIdx].nCmdSize, pRequests[nIdx].pCmd, pRequests[nIdx].nSentNs, 0);
+            frameTimer.Reset();
+            continue;
+        }
+        if(nRespLen > pRequests[nIdx].nRespMaxLen)
+            nRespLen = pRequests[nIdx].nRespMaxLen;
+        memset(pRequests[nIdx].pResp, 0, pRequests[nIdx].nRespMaxLen);
+        memcpy(pRequests[nIdx].pResp, szResp, nRespLen);
+        pRequests[nIdx].nState = REQ_DONE;
+        nInFlight--;
+        nDone++;
+        // the next outstanding reply gets a full timeout
+        frameTimer.Reset();
+    }
+
+    for(nIdx = 0; nIdx < nNbRequests; nIdx++)
+        if(pRequests[nIdx].nErr)
+            return pRequests[nIdx].nErr;
+
+    if(m_nInFlightLimit < m_nMaxInFlight && ++m_nCleanTransactions >= IN_FLIGHT_RESTORE_AFTER) {
+        m_nInFlightLimit = m_nMaxInFlight;
+        if(m_Log.isEnabled(AMC_LOG_INFO))
+            m_Log.out("CAMCDrive::domeTransaction %d clean transactions, back to %d requests in flight\n", IN_FLIGHT_RESTORE_AFTER, m_nInFlightLimit);
+    }
+    return OK;
+}
+
+/*
+ Build a read request for nLen words at index/offset, returns the frame size.
+ Only for registers that are not known at compile time, the others use encodeRead.
+ */
+int CAMCDrive::buildReadFrame(unsigned char *cmdBuf, unsigned char cIndex, unsigned char cOffset, unsigned char cLen)
 {
-    int nErr = 0;
     uint16_t nCRC;
-    unsigned char cmdBuf[SERIAL_BUFFER_SIZE];
-    unsigned char szResp[SERIAL_BUFFER_SIZE];
 
-    uint32_t nTicks = 0;
-    
     cmdBuf[0] = SOF;
     cmdBuf[1] = DA;
     cmdBuf[2] = CB_READ | (( m_cSeqNumber++ & 0x0F)<<2);
-    cmdBuf[3] = POS_I;
-    cmdBuf[4] = POS_O;
-    cmdBuf[5] = POS_L;
+    cmdBuf[3] = cIndex;
+    cmdBuf[4] = cOffset;
+    cmdBuf[5] = cLen;
 
-    nCRC = crc_xmodem(cmdBuf, 6);
+    nCRC = CAMCCRC::xmodem(cmdBuf, 6);
     cmdBuf[6] = (unsigned char) ((nCRC>> 8) & 0xff);
     cmdBuf[7] = (unsigned char) (nCRC & 0xff);
 
-#ifdef LOG_DEBUG
-    unsigned char cHexBuf[LOG_BUFFER_SIZE];
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    hexdump(cmdBuf, cHexBuf, 8, LOG_BUFFER_SIZE);
-    fprintf(Logfile, "[%s] CAMCDrive::getDomeAz sending : %s\n", timestamp, cHexBuf);
-    fflush(Logfile);
-#endif
+    return FRAME_HEADER_LEN;
+}
+
+#pragma mark - Dome coordinate and state
+
+int CAMCDrive::getDomeAz(double &dDomeAz)
+{
+    int nErr = 0;
+    unsigned char cmdBuf[PositionReg::nReadFrameLen];
+    unsigned char szResp[MAX_FRAME_LEN];
+    int nCmdLen;
+
+    uint32_t nTicks = 0;
+    
+    nCmdLen = encodeRead<PositionReg>(cmdBuf, m_cSeqNumber++);
+
+    if(m_Log.isEnabled(AMC_LOG_TRACE))
+        m_Log.outFrame(cmdBuf, nCmdLen, "CAMCDrive::getDomeAz sending : ");
     // send command and get response.
-    nErr = domeCommand(cmdBuf, 8, szResp, SERIAL_BUFFER_SIZE);
+    nErr = domeCommand(cmdBuf, nCmdLen, szResp, MAX_FRAME_LEN);
     if(nErr)
         return nErr;
 
     // convert response
     memcpy(&nTicks, szResp+8, 4);
-#ifdef LOG_DEBUG
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    hexdump(cmdBuf, cHexBuf, 8, LOG_BUFFER_SIZE);
-    fprintf(Logfile, "[%s] CAMCDrive::getDomeAz got : %08X (%d ticks)\n", timestamp, nTicks, nTicks);
-    fflush(Logfile);
-#endif
+    if(m_Log.isEnabled(AMC_LOG_TRACE))
+        m_Log.out("CAMCDrive::getDomeAz got : %08X (%d ticks)\n", nTicks, nTicks);
 
     TicksToAz(nTicks, m_dCurrentAzPosition);
     dDomeAz = m_dCurrentAzPosition;
     m_nCurrentTicks = nTicks;
+    publishPosition(m_nCurrentTicks, m_dCurrentAzPosition, monotonicMs());
 
-#ifdef LOG_DEBUG
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    hexdump(cmdBuf, cHexBuf, 8, LOG_BUFFER_SIZE);
-    fprintf(Logfile, "[%s] CAMCDrive::getDomeAz got : %3.2f degrees\n", timestamp, dDomeAz);
-    fflush(Logfile);
-#endif
+    if(m_Log.isEnabled(AMC_LOG_TRACE))
+        m_Log.out("CAMCDrive::getDomeAz got : %3.2f degrees\n", dDomeAz);
 
     return nErr;
 }
@@ -463,51 +670,131 @@ void CAMCDrive::setDebugLog(bool bEnable)
     m_bDebugLog = bEnable;
 }
 
-bool CAMCDrive::isDomeMoving()
+/*
+ AMC_LOG_OFF to AMC_LOG_TRACE. The log file is only created the first time
+ logging is turned on and kept open after that, so it can be switched on and
+ off at any time without losing what was logged before.
+ */
+void CAMCDrive::setLogLevel(int nLevel)
+{
+    if(nLevel > AMC_LOG_OFF && !m_Log.isOpen())
+        m_Log.open(m_sLogfilePath.c_str());
+    m_Log.setLevel(nLevel);
+}
+
+int CAMCDrive::getLogLevel()
+{
+    return m_Log.getLevel();
+}
+
+/*
+ Binary capture of every frame to m_sCapturePath, see AMCCapture.h.
+ Turning it on starts a new capture.
+ */
+void CAMCDrive::setWireCapture(bool bEnable)
+{
+    std::lock_guard<std::mutex> lock(m_IOLock);
+
+    if(bEnable == m_Capture.isOpen())
+        return;
+    if(bEnable) {
+        if(!m_Capture.open(m_sCapturePath.c_str()) && m_Log.isEnabled(AMC_LOG_ERROR))
+            m_Log.out("CAMCDrive::setWireCapture can't create %s\n", m_sCapturePath.c_str());
+    }
+    else
+        m_Capture.close();
+}
+
+bool CAMCDrive::getWireCapture()
+{
+    std::lock_guard<std::mutex> lock(m_IOLock);
+
+    return m_Capture.isOpen();
+}
+
+/*
+ Writes m_Stats as JSON to m_sStatsPath, the counters keep going.
+ */
+int CAMCDrive::dumpStats()
+{
+    if(!m_Stats.dump(m_sStatsPath.c_str())) {
+        if(m_Log.isEnabled(AMC_LOG_ERROR))
+            m_Log.out("CAMCDrive::dumpStats can't create %s\n", m_sStatsPath.c_str());
+        return COMMAND_FAILED;
+    }
+    if(m_Log.isEnabled(AMC_LOG_INFO))
+        m_Log.out("CAMCDrive::dumpStats wrote %s\n", m_sStatsPath.c_str());
+    return OK;
+}
+
+void CAMCDrive::setMaxRequestsInFlight(int nMaxInFlight)
+{
+    if(nMaxInFlight < 1)
+        nMaxInFlight = 1;
+    if(nMaxInFlight > MAX_IN_FLIGHT)
+        nMaxInFlight = MAX_IN_FLIGHT;
+    m_nMaxInFlight = nMaxInFlight;
+    m_nInFlightLimit = nMaxInFlight;
+}
+
+/*
+ Fetch the status block and the position and decide if the dome is moving.
+ The dome is moving when the drive says its velocity isn't zero or when the
+ position changed by more than m_nSettleTicks since the previous read (it can
+ still be creeping to the target with a zero velocity). Right after a goto or
+ a home the drive may not have picked up the command yet, so until it reports
+ the move we assume it's coming, for up to MOTION_START_TIMEOUT. A goto to
+ where we already are never starts, it's done as soon as we see that.
+ The snapshot is returned so the caller can run its other checks on it
+ without going back to the drive.
+ */
+bool CAMCDrive::isDomeMoving(StatusSnapshot &status)
 {
     bool bIsMoving = false;
-    uint16_t nStatus;
+    bool bPositionChanged = false;
+
+    memset(&status, 0, sizeof(StatusSnapshot));
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-    if(timer.GetElapsedSeconds()<2) {
-            // we're checking for movement to quickly, assume it's moving for now
-            // this also help at the end of a goto when it slowly get to the actual position
-            return true;
+    if(!getFreshSnapshot(status))
+        getStatusSnapshot(status, true);
+    if(status.bPositionValid) {
+        m_nCurrentTicks = status.nTicks;
+        m_dCurrentAzPosition = status.dAz;
+        if(m_bHaveMotionTicks)
+            bPositionChanged = ticksDistance(m_nMotionTicks, status.nTicks) > m_nSettleTicks;
+        m_nMotionTicks = status.nTicks;
+        m_bHaveMotionTicks = true;
     }
 
-    nStatus = getStatus(STATUS_2_O);
-
-#ifdef LOG_DEBUG
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] CAMCDrive::isDomeMoving nStatus : %04x\n", timestamp, nStatus);
-    fflush(Logfile);
-#endif
+    if(m_Log.isEnabled(AMC_LOG_TRACE))
+        m_Log.out("CAMCDrive::isDomeMoving nStatus : %04x, position %u%s\n", status.nStatus2, status.nTicks, bPositionChanged ? " (changed)" : "");
 
-    if((nStatus & MOVING) == 0) { // we're moving.. "Zero Velocity" is 0
+    if(!status.bZeroVelocity || bPositionChanged) { // we're moving.. "Zero Velocity" is 0
         bIsMoving = true;
-#ifdef LOG_DEBUG
-        ltime = time(NULL);
-        timestamp = asctime(localtime(&ltime));
-        timestamp[strlen(timestamp) - 1] = 0;
-        fprintf(Logfile, "[%s] CAMCDrive::isDomeMoving Dome is moving\n", timestamp);
-        fflush(Logfile);
-#endif
+        m_bMotionStarted = true;
+        if(m_Log.isEnabled(AMC_LOG_TRACE))
+            m_Log.out("CAMCDrive::isDomeMoving Dome is moving\n");
     }
-    else if( (nStatus & MOVING) != 0 &&                         // not moving
-             (nStatus & HOMING) == HOMING &&                    // homing
-             (nStatus & HOMING_COMPLETE) != HOMING_COMPLETE) {  // homing has started but we haven't moved yet
+    else if( status.bZeroVelocity &&        // not moving
+             status.bHoming &&              // homing
+             !status.bHomingComplete) {     // homing has started but we haven't moved yet
         bIsMoving = true;
-#ifdef LOG_DEBUG
-        ltime = time(NULL);
-        timestamp = asctime(localtime(&ltime));
-        timestamp[strlen(timestamp) - 1] = 0;
-        fprintf(Logfile, "[%s] CAMCDrive::isDomeMoving Dome is homing but not moving yet... assuming we're moving\n", timestamp);
-        fflush(Logfile);
-#endif
+        if(m_Log.isEnabled(AMC_LOG_INFO))
+            m_Log.out("CAMCDrive::isDomeMoving Dome is homing but not moving yet... assuming we're moving\n");
+    }
+    else if(!m_bMotionStarted && (m_nMotionCmd == GOTO || m_nMotionCmd == HOME) && timer.GetElapsedSeconds() < MOTION_START_TIMEOUT) {
+        if(m_nMotionCmd == GOTO && status.bPositionValid && ticksDistance(status.nTicks, (uint32_t)m_nMotionTarget) <= m_nSettleTicks) {
+            bIsMoving = false;
+        }
+        else {
+            // the drive hasn't started the move yet
+            bIsMoving = true;
+            if(m_Log.isEnabled(AMC_LOG_TRACE))
+                m_Log.out("CAMCDrive::isDomeMoving waiting for the move to start\n");
+        }
     } else {
         bIsMoving = false;
     }
@@ -515,28 +802,20 @@ bool CAMCDrive::isDomeMoving()
     return bIsMoving;
 }
 
-bool CAMCDrive::isDomeAtHome()
+bool CAMCDrive::isDomeAtHome(const StatusSnapshot &status)
 {
     bool bAthome = false;
-    uint16_t nStatus;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-    nStatus = getStatus(STATUS_2_O);
+    if(m_Log.isEnabled(AMC_LOG_TRACE))
+        m_Log.out("CAMCDrive::isDomeAtHome nStatus : %04x\n", status.nStatus2);
 
-#ifdef LOG_DEBUG
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] CAMCDrive::isDomeAtHome nStatus : %04x\n", timestamp, nStatus);
-    fflush(Logfile);
-#endif
-
-    if( (nStatus & HOMING) == HOMING && (nStatus & IN_HOME_POSITION) != IN_HOME_POSITION)
+    if(status.bHoming && !status.bInHomePosition)
         bAthome = false;
 
-    else if((nStatus & IN_HOME_POSITION) == IN_HOME_POSITION)
+    else if(status.bInHomePosition)
         bAthome = true;
 
     return bAthome;
@@ -546,16 +825,21 @@ int CAMCDrive::syncDome(double dAz, double dEl)
 {
     int nErr = 0;
     int nPosInTicks;
+    int32_t nFromTicks;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
+    cancelPendingGoto();
     enableBridge();
 
     while(dAz >= 360)
         dAz = dAz - 360;
 
+    // keep the turn count the drive has, the cable wrap limit is measured from it
     AzToTicks(dAz, nPosInTicks);
+    if(m_nNbTicksPerRev > 0 && !currentTicks(nFromTicks))
+        nPosInTicks = nearestTicks(dAz, nFromTicks, false);
     nErr = syncTicksPosition(nPosInTicks);
     // if(nErr)
     //    return nErr;
@@ -572,9 +856,34 @@ int CAMCDrive::setNbTicksPerRev(int nTicks)
 {
     int nErr = 0;
     m_nNbTicksPerRev = nTicks;
+    m_nSettleTicks = (int)(nTicks * DEF_SETTLE_ARCMIN / (360.0 * 60.0));
+    if(m_nSettleTicks < 1)
+        m_nSettleTicks = 1;
+    setGotoTolerance(m_dGotoTolerance);
     return nErr;
 }
 
+double CAMCDrive::getGotoTolerance()
+{
+    return m_dGotoTolerance;
+}
+
+/*
+ How far from the target, in arcminutes either way, a goto or a park is done.
+ */
+void CAMCDrive::setGotoTolerance(double dArcmin)
+{
+    if(dArcmin < 0)
+        dArcmin = 0;
+    else if(dArcmin > MAX_GOTO_TOLERANCE_ARCMIN)
+        dArcmin = MAX_GOTO_TOLERANCE_ARCMIN;
+    m_dGotoTolerance = dArcmin;
+    m_nGotoToleranceTicks = (int)(m_nNbTicksPerRev * dArcmin / (360.0 * 60.0));
+    // the drive can't do better than a tick
+    if(m_nGotoToleranceTicks < 1)
+        m_nGotoToleranceTicks = 1;
+}
+
 double CAMCDrive::getHomeAz()
 {
     return m_dHomeAz;
@@ -605,10 +914,39 @@ int CAMCDrive::setParkAz(double dAz)
     return nErr;
 }
 
+double CAMCDrive::getCableWrapLimit()
+{
+    return m_dCableWrapLimit;
+}
+
+/*
+ Degrees the dome can turn from home either way, 0 for no limit. Less than
+ half a turn either way would leave some azimuths out of reach.
+ */
+void CAMCDrive::setCableWrapLimit(double dDegrees)
+{
+    if(dDegrees <= 0)
+        m_dCableWrapLimit = 0;
+    else if(dDegrees < MIN_CABLE_WRAP_LIMIT)
+        m_dCableWrapLimit = MIN_CABLE_WRAP_LIMIT;
+    else
+        m_dCableWrapLimit = dDegrees;
+}
+
 
 double CAMCDrive::getCurrentAz()
 {
-    if(m_bIsConnected)
+    StatusSnapshot status;
+
+    if(!m_bIsConnected)
+        return m_dCurrentAzPosition;
+
+    // no need to go to the drive if the poller just did
+    if(getFreshSnapshot(status) && status.bPositionValid) {
+        m_nCurrentTicks = status.nTicks;
+        m_dCurrentAzPosition = status.dAz;
+    }
+    else
         getDomeAz(m_dCurrentAzPosition);
 
     return m_dCurrentAzPosition;
@@ -636,92 +974,264 @@ int CAMCDrive::getCurrentShutterState()
 int CAMCDrive::gotoAzimuth(double dNewAz)
 {
     int nErr = 0;
-    int nPosInTicks;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-    enableBridge();
+    stopTracking();
 
     while(dNewAz >= 360)
         dNewAz = dNewAz - 360;
 
-    AzToTicks(dNewAz, nPosInTicks);
-    nErr = gotoTicksPosition(nPosInTicks);
-    // if(nErr)
-    //    return nErr;
-
+    std::lock_guard<std::mutex> lock(m_GotoLock);
+    // a new target, not isGoToComplete trying the same one again
+    if(dNewAz != m_dGotoAz)
+        m_nGotoTries = 0;
     m_dGotoAz = dNewAz;
-    return nErr;
+
+    // slaving can retarget faster than the dome settles, only the latest
+    // target of a burst goes to the drive. The poller sends it when the
+    // window is over, it has to be polling (not parked, see pollerThread).
+    if(m_bPollerRunning && m_nPollPeriodMs && m_nMotionCmd == GOTO && monotonicMs() - m_nMotionCmdMs < RETARGET_COALESCE_MS && isGotoUnderway()) {
+        if(m_bGotoPending)
+            m_nCoalescedGotos++;
+        else
+            wakePoller();
+        m_bGotoPending = true;
+        m_nGotoCancelGeneration = m_nCancelGeneration;
+        if(m_Log.isEnabled(AMC_LOG_INFO))
+            m_Log.out("CAMCDrive::gotoAzimuth holding retarget to %3.2f\n", dNewAz);
+        return nErr;
+    }
+
+    return sendGoto();
 }
 
-int CAMCDrive::goHome()
+/*
+ Send the goto to m_dGotoAz, with m_GotoLock held. If the dome is still on
+ its way to a previous target the drive changes course on the fly, there is
+ no stop in between. The poller passes pCancelGeneration, see domeTransaction.
+ */
+int CAMCDrive::sendGoto(const uint32_t *pCancelGeneration)
 {
     int nErr = 0;
-    if(!m_bIsConnected)
-        return NOT_CONNECTED;
-
-    if(m_bCalibrating) {
-        return SB_OK;
-    }
-    else if(isDomeAtHome()){
-        m_bHomed = true;
-        return OK;
-    }
+    int nPosInTicks;
 
-    enableBridge();
+    m_bGotoPending = false;
+    enableBridge(pCancelGeneration);
 
-#ifdef LOG_DEBUG
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] CAMCDrive::goHome \n", timestamp);
-    fflush(Logfile);
-#endif
+    nErr = gotoTargetTicks(m_dGotoAz, nPosInTicks);
+    if(nErr)
+        return nErr;
+    if(m_nMotionCmd == GOTO && m_bMotionStarted) {
+        m_nRetargets++;
+        if(m_Log.isEnabled(AMC_LOG_INFO))
+            m_Log.out("CAMCDrive::sendGoto retargeting to %3.2f\n", m_dGotoAz);
+    }
+    nErr = gotoTicksPosition(nPosInTicks, pCancelGeneration);
 
+    return nErr;
+}
 
-    uint16_t nCRC;
-    unsigned char cmdBuf[SERIAL_BUFFER_SIZE];
-    unsigned char szResp[SERIAL_BUFFER_SIZE];
-    uint16_t data[HOME_L];
-    uint16_t regValue;
+/*
+ Is a held retarget still waiting to be sent, a goto or park can't be
+ complete before it is. The poller normally sends it (see flushPendingGoto),
+ if it's late we do.
+ */
+bool CAMCDrive::isGotoPending(int &nErr)
+{
+    if(!m_bGotoPending)
+        return false;
+    std::lock_guard<std::mutex> lock(m_GotoLock);
+    if(!m_bGotoPending)
+        return false;
+    if(monotonicMs() - m_nMotionCmdMs >= RETARGET_COALESCE_MS)
+        nErr = sendGoto();
+    return true;
+}
 
-    // set homing bit
-    regValue = HOME_D;
+/*
+ Is the last goto still under way according to the poller : the dome is
+ moving or hasn't got to the target yet. Without a snapshot taken since the
+ goto it's assumed to be, the drive may not have started it yet.
+ */
+bool CAMCDrive::isGotoUnderway()
+{
+    StatusSnapshot status;
 
-    // write register
-    cmdBuf[0] = SOF;
-    cmdBuf[1] = DA;
-    cmdBuf[2] = CB_WRITE | (( m_cSeqNumber++ & 0x0F)<<2);
-    cmdBuf[3] = HOME_I;
-    cmdBuf[4] = HOME_O;
-    cmdBuf[5] = HOME_L;
+    if(!getFreshSnapshot(status) || !status.bPositionValid)
+        return true;
+    return !status.bZeroVelocity || ticksDistance(status.nTicks, (uint32_t)m_nMotionTarget) > m_nSettleTicks;
+}
 
-    nCRC = crc_xmodem(cmdBuf, 6);
-    cmdBuf[6] = (unsigned char) ((nCRC>> 8) & 0xff);
-    cmdBuf[7] = (unsigned char) (nCRC & 0xff);
+/*
+ Called by the poller after each snapshot, sends the held retarget once
+ RETARGET_COALESCE_MS have passed since the previous goto instead of waiting
+ for TheSkyX to ask if the goto is done. Returns the ms until it's due, 0 if
+ nothing is held.
+ */
+int CAMCDrive::flushPendingGoto()
+{
+    int nErr;
+    uint64_t nSinceMs;
+    uint32_t nGeneration;
+
+    if(!m_bGotoPending)
+        return 0;
+    std::unique_lock<std::mutex> lock(m_GotoLock, std::try_to_lock);
+    // gotoAzimuth or isGotoPending, they'll send it
+    if(!lock.owns_lock() || !m_bGotoPending)
+        return 0;
+    nSinceMs = monotonicMs() - m_nMotionCmdMs;
+    if(nSinceMs < RETARGET_COALESCE_MS)
+        return (int)(RETARGET_COALESCE_MS - nSinceMs);
+
+    // an abort since it was held drops it
+    nGeneration = m_nGotoCancelGeneration;
+    nErr = sendGoto(&nGeneration);
+    if(nErr && m_Log.isEnabled(AMC_LOG_ERROR))
+        m_Log.out("CAMCDrive::flushPendingGoto error %d sending the goto to %3.2f\n", nErr, m_dGotoAz);
+    return 0;
+}
 
-    data[0] = regValue;
-    memcpy(cmdBuf + 8, data, HOME_L*2);
+/*
+ Before a command that replaces the goto (home, sync, tracking, abort) : the
+ held retarget is dropped, one the poller is sending goes out first.
+ */
+void CAMCDrive::cancelPendingGoto()
+{
+    std::lock_guard<std::mutex> lock(m_GotoLock);
 
-    nCRC = crc_xmodem((const unsigned char *)data, HOME_L * 2);
+    m_bGotoPending = false;
+}
 
-    cmdBuf[8+(HOME_L*2)] = (unsigned char) ((nCRC>> 8) & 0xff);
-    cmdBuf[8+(HOME_L*2)+1] = (unsigned char) (nCRC & 0xff);
+/*
+ The drive counts ticks over as many turns as the dome makes, a goto to the
+ ticks of dAz between 0 and m_nNbTicksPerRev can go most of the way round.
+ Aim for the ticks of dAz nearest to where the dome is instead, see nearestTicks.
+ */
+int CAMCDrive::gotoTargetTicks(double dAz, int &nTargetTicks)
+{
+    int nErr = OK;
+    int32_t nFromTicks;
 
-#ifdef LOG_DEBUG
-    unsigned char cHexBuf[LOG_BUFFER_SIZE];
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    hexdump(cmdBuf, cHexBuf, 8+HOME_L*2 + 2 , LOG_BUFFER_SIZE);
-    fprintf(Logfile, "[%s] CAMCDrive::goHome sending for homing : %s\n", timestamp, cHexBuf);
-    fflush(Logfile);
-#endif
+    AzToTicks(dAz, nTargetTicks);
+    if(m_nNbTicksPerRev <= 0)
+        return nErr;
+
+    nErr = currentTicks(nFromTicks);
+    if(nErr)
+        return nErr;
+    nTargetTicks = nearestTicks(dAz, nFromTicks);
 
-    nErr = domeCommand(cmdBuf, 8 + HOME_L*2 + 2, szResp, SERIAL_BUFFER_SIZE);
+    if(m_Log.isEnabled(AMC_LOG_INFO))
+        m_Log.out("CAMCDrive::gotoTargetTicks %3.2f from %d ticks : %d ticks\n", dAz, nFromTicks, nTargetTicks);
+    return nErr;
+}
 
-    timer.Reset();
+/*
+ Where the dome is, turns included. Only the turn matters to gotoTargetTicks
+ and syncDome, a position that is a few hundred ms old will do : the
+ poller's snapshot or the last published position when they are fresh,
+ the position register otherwise.
+ */
+int CAMCDrive::currentTicks(int32_t &nTicks)
+{
+    int nErr = OK;
+    StatusSnapshot status;
+    DomeState state;
+    double dCurrentAz;
+
+    if(getFreshSnapshot(status) && status.bPositionValid) {
+        nTicks = (int32_t)status.nTicks;
+        return nErr;
+    }
+    getDomeState(state);
+    if(isDomeStateFresh(state)) {
+        nTicks = (int32_t)state.nTicks;
+        return nErr;
+    }
+    nErr = getDomeAz(dCurrentAz);
+    if(!nErr)
+        nTicks = (int32_t)m_nCurrentTicks;
+    return nErr;
+}
+
+/*
+ Ticks of dAz at most half a turn from nFromTicks. With a cable wrap limit
+ the dome never goes further than that from home either way, the target is
+ a turn the other way when the short way round would go past it.
+ bWrapLimit is false for a sync, the position has to stay on the turn the
+ dome is on for the limit to be measured from the right place.
+ */
+int CAMCDrive::nearestTicks(double dAz, int32_t nFromTicks, bool bWrapLimit)
+{
+    int nAzTicks;
+    int nHalfRev;
+    int nLimitTicks;
+    int32_t nDelta;
+    int32_t nTargetTicks;
+
+    AzToTicks(dAz, nAzTicks);
+    if(m_nNbTicksPerRev <= 0)
+        return nAzTicks;
+
+    nHalfRev = m_nNbTicksPerRev / 2;
+    nDelta = (nAzTicks - nFromTicks) % m_nNbTicksPerRev;
+    if(nDelta > nHalfRev)
+        nDelta -= m_nNbTicksPerRev;
+    else if(nDelta <= -nHalfRev)
+        nDelta += m_nNbTicksPerRev;
+    nTargetTicks = nFromTicks + nDelta;
+
+    if(bWrapLimit && m_dCableWrapLimit > 0) {
+        nLimitTicks = (int)(m_dCableWrapLimit * m_nNbTicksPerRev / 360.0);
+        if(nTargetTicks > nLimitTicks)
+            nTargetTicks -= m_nNbTicksPerRev;
+        else if(nTargetTicks < -nLimitTicks)
+            nTargetTicks += m_nNbTicksPerRev;
+    }
+    return nTargetTicks;
+}
+
+int CAMCDrive::goHome()
+{
+    int nErr = 0;
+    StatusSnapshot status;
+
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+
+    if(m_bCalibrating) {
+        return SB_OK;
+    }
+
+    stopTracking();
+    cancelPendingGoto();
+    getStatusSnapshot(status, false);
+    if(isDomeAtHome(status)){
+        setHomed(true);
+        return OK;
+    }
+
+    enableBridge();
+
+    if(m_Log.isEnabled(AMC_LOG_INFO))
+        m_Log.out("CAMCDrive::goHome \n");
+
+
+    unsigned char cmdBuf[HomeReg::nWriteFrameLen];
+    unsigned char szResp[MAX_FRAME_LEN];
+    int nCmdLen;
+
+    nCmdLen = encodeWrite<HomeReg>(cmdBuf, m_cSeqNumber++, HOME_D);
+
+    if(m_Log.isEnabled(AMC_LOG_TRACE))
+        m_Log.outFrame(cmdBuf, nCmdLen, "CAMCDrive::goHome sending for homing : ");
+
+    nErr = domeCommand(cmdBuf, nCmdLen, szResp, MAX_FRAME_LEN);
+
+    motionCommandSent(HOME);
     m_goto_find_home = true;
     return nErr;
 }
@@ -747,13 +1257,8 @@ int CAMCDrive::parkDome()
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
-#ifdef LOG_DEBUG
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] CAMCDrive::parkDome parking to %3.2f \n", timestamp, m_dParkAz);
-    fflush(Logfile);
-#endif
+    if(m_Log.isEnabled(AMC_LOG_INFO))
+        m_Log.out("CAMCDrive::parkDome parking to %3.2f \n", m_dParkAz);
 
     nErr = gotoAzimuth(m_dParkAz);
 
@@ -762,7 +1267,7 @@ int CAMCDrive::parkDome()
 
 int CAMCDrive::unparkDome()
 {
-    m_bParked = false;
+    setParked(false);
     m_dCurrentAzPosition = m_dParkAz;
     // syncDome(m_dCurrentAzPosition,m_dCurrentElPosition);
     return 0;
@@ -772,56 +1277,44 @@ int CAMCDrive::isGoToComplete(bool &bComplete)
 {
     int nErr = 0;
     double dDomeAz = 0;
+    StatusSnapshot status;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-    if(isDomeMoving()) {
+    if(isGotoPending(nErr)) {
         bComplete = false;
-        // getDomeAz(dDomeAz);
         return nErr;
     }
 
-    if(!isPositionReached()) {
+    // status and position come in with the same snapshot
+    if(isDomeMoving(status)) {
         bComplete = false;
-        // getDomeAz(dDomeAz);
         return nErr;
     }
 
-    getDomeAz(dDomeAz);
-    if(dDomeAz >0 && dDomeAz<1)
-        dDomeAz = 0;
-
-    while(ceil(m_dGotoAz) >= 360)
-        m_dGotoAz = ceil(m_dGotoAz) - 360;
+    if(!isPositionReached(status)) {
+        bComplete = false;
+        return nErr;
+    }
 
-    while(ceil(dDomeAz) >= 360)
-        dDomeAz = ceil(dDomeAz) - 360;
+    if(!status.bPositionValid)
+        getDomeAz(dDomeAz);
+    dDomeAz = m_dCurrentAzPosition;
 
-#ifdef LOG_DEBUG
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] CAMCDrive::isGoToComplete DomeAz = %3.2f, m_dGotoAz =  %3.2f\n", timestamp, dDomeAz, m_dGotoAz);
-    fflush(Logfile);
-#endif
+    if(m_Log.isEnabled(AMC_LOG_TRACE))
+        m_Log.out("CAMCDrive::isGoToComplete DomeAz = %3.2f, m_dGotoAz =  %3.2f\n", dDomeAz, m_dGotoAz);
 
-    // we need to test "large" depending on the heading error
-    if ((floor(m_dGotoAz) <= floor(dDomeAz)+1) && (floor(m_dGotoAz) >= floor(dDomeAz)-1)) {
+    if(isAtAzimuth(m_nCurrentTicks, m_dGotoAz)) {
         bComplete = true;
         m_nGotoTries = 0;
     }
     else {
-#ifdef LOG_DEBUG
-        ltime = time(NULL);
-        timestamp = asctime(localtime(&ltime));
-        timestamp[strlen(timestamp) - 1] = 0;
-        fprintf(Logfile, "[%s] CAMCDrive::isGoToComplete ***** ERROR **** DomeAz = %3.2f, m_dGotoAz =  %3.2f\n", timestamp, dDomeAz, m_dGotoAz);
-        fflush(Logfile);
-#endif
+        if(m_Log.isEnabled(AMC_LOG_ERROR))
+            m_Log.out("CAMCDrive::isGoToComplete ***** ERROR **** DomeAz = %3.2f, m_dGotoAz =  %3.2f\n", dDomeAz, m_dGotoAz);
         // we're not moving and we're not at the final destination !!!
         if (m_bDebugLog) {
-            snprintf(m_szLogBuffer,LOG_BUFFER_SIZE,"[CAMCDrive::isGoToComplete] domeAz = %3.2f, m_dGotoAz = %3.2f", floor(dDomeAz), floor(m_dGotoAz));
+            snprintf(m_szLogBuffer,LOG_BUFFER_SIZE,"[CAMCDrive::isGoToComplete] domeAz = %3.2f, m_dGotoAz = %3.2f", dDomeAz, m_dGotoAz);
             m_pLogger->out(m_szLogBuffer);
         }
         if(m_nGotoTries == 0) {
@@ -842,39 +1335,40 @@ int CAMCDrive::isParkComplete(bool &bComplete)
 {
     int nErr = 0;
     double dDomeAz=0;
+    StatusSnapshot status;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-    if(isDomeMoving()) {
-        // getDomeAz(dDomeAz);
+    if(isGotoPending(nErr)) {
         bComplete = false;
         return nErr;
     }
 
-    getDomeAz(dDomeAz);
+    if(isDomeMoving(status)) {
+        bComplete = false;
+        return nErr;
+    }
 
-#ifdef LOG_DEBUG
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] CAMCDrive::isParkComplete dDomeAz = %3.2f\n", timestamp, dDomeAz);
-    fprintf(Logfile, "[%s] CAMCDrive::isParkComplete m_dParkAz = %3.2f\n", timestamp, m_dParkAz);
-    fprintf(Logfile, "[%s] CAMCDrive::isParkComplete floor(dDomeAz) = %3.2f\n", timestamp, floor(dDomeAz));
-    fprintf(Logfile, "[%s] CAMCDrive::isParkComplete floor(m_dParkAz) = %3.2f\n", timestamp, floor(m_dParkAz));
-    fflush(Logfile);
-#endif
+    if(!status.bPositionValid)
+        getDomeAz(dDomeAz);
+    dDomeAz = m_dCurrentAzPosition;
+
+    if(m_Log.isEnabled(AMC_LOG_TRACE)) {
+        m_Log.out("CAMCDrive::isParkComplete dDomeAz = %3.2f\n", dDomeAz);
+        m_Log.out("CAMCDrive::isParkComplete m_dParkAz = %3.2f\n", m_dParkAz);
+    }
 
-    if (floor(m_dParkAz) == floor(dDomeAz))
+    if (isAtAzimuth(m_nCurrentTicks, m_dParkAz))
     {
-        m_bParked = true;
+        setParked(true);
         bComplete = true;
     }
     else {
         // we're not moving and we're not at the final destination !!!
         bComplete = false;
-        m_bHomed = false;
-        m_bParked = false;
+        setHomed(false);
+        setParked(false);
         nErr = ERR_CMDFAILED;
     }
 
@@ -888,7 +1382,7 @@ int CAMCDrive::isUnparkComplete(bool &bComplete)
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-    m_bParked = false;
+    setParked(false);
     bComplete = true;
 
     return nErr;
@@ -899,42 +1393,35 @@ int CAMCDrive::isFindHomeComplete(bool &bComplete)
     int nErr = 0;
     double dDomeAz;
     bool bGotComplete;
+    StatusSnapshot status;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-    if(isDomeMoving()) {
-        m_bHomed = false;
+    if(isDomeMoving(status)) {
+        setHomed(false);
         bComplete = false;
-#ifdef LOG_DEBUG
-        ltime = time(NULL);
-        timestamp = asctime(localtime(&ltime));
-        timestamp[strlen(timestamp) - 1] = 0;
-        fprintf(Logfile, "[%s] CAMCDrive::isFindHomeComplete still moving\n", timestamp);
-        fflush(Logfile);
-#endif
+        if(m_Log.isEnabled(AMC_LOG_TRACE))
+            m_Log.out("CAMCDrive::isFindHomeComplete still moving\n");
         return nErr;
     }
 
-    if(isDomeAtHome()){
-#ifdef LOG_DEBUG
-        // check all status register for debugging
-        getAllStatusReg();
-#endif
-        getDomeAz(dDomeAz);
-
-#ifdef LOG_DEBUG
-        ltime = time(NULL);
-        timestamp = asctime(localtime(&ltime));
-        timestamp[strlen(timestamp) - 1] = 0;
-        fprintf(Logfile, "[%s] CAMCDrive::isFindHomeComplete dDomeAz = %3.2f\n", timestamp, dDomeAz);
-        fprintf(Logfile, "[%s] CAMCDrive::isFindHomeComplete m_nCurrentTicks = %d\n", timestamp, m_nCurrentTicks);
-        fprintf(Logfile, "[%s] CAMCDrive::isFindHomeComplete m_goto_find_home = %s\n", timestamp, m_goto_find_home?"true":"false");
-        fflush(Logfile);
-#endif
+    if(isDomeAtHome(status)){
+        // log all status register for debugging
+        if(m_Log.isEnabled(AMC_LOG_TRACE))
+            logAllStatusReg(status);
+        if(!status.bPositionValid)
+            getDomeAz(dDomeAz);
+        dDomeAz = m_dCurrentAzPosition;
+
+        if(m_Log.isEnabled(AMC_LOG_TRACE)) {
+            m_Log.out("CAMCDrive::isFindHomeComplete dDomeAz = %3.2f\n", dDomeAz);
+            m_Log.out("CAMCDrive::isFindHomeComplete m_nCurrentTicks = %d\n", m_nCurrentTicks);
+            m_Log.out("CAMCDrive::isFindHomeComplete m_goto_find_home = %s\n", m_goto_find_home?"true":"false");
+        }
 
         if (m_goto_find_home == true) {
-            m_bHomed = false;
+            setHomed(false);
             bComplete = false;
             enableBridge();
             gotoAzimuth(m_dHomeAz);
@@ -943,23 +1430,18 @@ int CAMCDrive::isFindHomeComplete(bool &bComplete)
         }
         isGoToComplete(bGotComplete);
         if(!bGotComplete) {
-            m_bHomed = false;
+            setHomed(false);
             bComplete = false;
             return SB_OK;
         }
-        m_bHomed = true;
+        setHomed(true);
         bComplete = true;
         m_goto_find_home = true;
 
         m_nHomingTries = 0;
         enableBridge(); // let's see if this helps.
-#ifdef LOG_DEBUG
-        ltime = time(NULL);
-        timestamp = asctime(localtime(&ltime));
-        timestamp[strlen(timestamp) - 1] = 0;
-        fprintf(Logfile, "[%s] CAMCDrive::isFindHomeComplete At Home\n", timestamp);
-        fflush(Logfile);
-#endif
+        if(m_Log.isEnabled(AMC_LOG_INFO))
+            m_Log.out("CAMCDrive::isFindHomeComplete At Home\n");
     }
     else {
         // we're not moving and we're not at the home position !!!
@@ -967,20 +1449,16 @@ int CAMCDrive::isFindHomeComplete(bool &bComplete)
             snprintf(m_szLogBuffer,LOG_BUFFER_SIZE,"[CAMCDrive::isFindHomeComplete] Not moving and not at home !!!");
             m_pLogger->out(m_szLogBuffer);
         }
-#ifdef LOG_DEBUG
-        ltime = time(NULL);
-        timestamp = asctime(localtime(&ltime));
-        timestamp[strlen(timestamp) - 1] = 0;
-        fprintf(Logfile, "[%s] [CAMCDrive::isFindHomeComplete] Not moving and not at home !!!\n", timestamp);
-        fflush(Logfile);
-#endif
+        if(m_Log.isEnabled(AMC_LOG_ERROR))
+            m_Log.out("[CAMCDrive::isFindHomeComplete] Not moving and not at home !!!\n");
         bComplete = false;
-        m_bHomed = false;
-        m_bParked = false;
+        setHomed(false);
+        setParked(false);
         // sometimes we pass the home sensor so give it another try
         if(m_nHomingTries == 0 ) {
             m_nHomingTries = 1; // dome might still be homing or hasn't statrted to home yet.
             timer.Reset();
+            m_bMotionStarted = false;
         }
         else {
             m_nHomingTries = 0;
@@ -996,30 +1474,30 @@ int CAMCDrive::isCalibratingComplete(bool &bComplete)
 {
     int nErr = 0;
     double dDomeAz = 0;
+    StatusSnapshot status;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-    if(isDomeMoving()) {
-        // getDomeAz(dDomeAz);
-        m_bHomed = false;
+    if(isDomeMoving(status)) {
+        setHomed(false);
         bComplete = false;
         return nErr;
     }
 
+    if(!status.bPositionValid)
+        nErr = getDomeAz(dDomeAz);
 
-    nErr = getDomeAz(dDomeAz);
-
-    if (floor(m_dHomeAz) != floor(dDomeAz)) {
+    if(!isAtAzimuth(m_nCurrentTicks, m_dHomeAz)) {
         // We need to resync the current position to the home position.
         m_dCurrentAzPosition = m_dHomeAz;
         syncDome(m_dCurrentAzPosition,m_dCurrentElPosition);
-        m_bHomed = true;
+        setHomed(true);
         bComplete = true;
     }
 
     // nErr = getDomeTicksPerRev(m_nNbTicksPerRev);
-    m_bHomed = true;
+    setHomed(true);
     bComplete = true;
     m_bCalibrating = false;
     return nErr;
@@ -1087,14 +1565,12 @@ int CAMCDrive::isOpenComplete(bool &bComplete)
     if(nErr)
         return ERR_CMDFAILED;
     if(nState == OPEN){
-        m_bShutterOpened = true;
+        setShutterOpened(true);
         bComplete = true;
-        m_dCurrentElPosition = 90.0;
     }
     else {
-        m_bShutterOpened = false;
+        setShutterOpened(false);
         bComplete = false;
-        m_dCurrentElPosition = 0.0;
     }
 
     return nErr;
@@ -1112,14 +1588,12 @@ int CAMCDrive::isCloseComplete(bool &bComplete)
     if(nErr)
         return ERR_CMDFAILED;
     if(nState == CLOSED){
-        m_bShutterOpened = false;
+        setShutterOpened(false);
         bComplete = true;
-        m_dCurrentElPosition = 0.0;
     }
     else {
-        m_bShutterOpened = true;
+        setShutterOpened(true);
         bComplete = false;
-        m_dCurrentElPosition = 90.0;
     }
 
     return nErr;
@@ -1166,260 +1640,145 @@ DWORD WINAPI CAMCDrive::threadCallback(LPVOID param)
 int CAMCDrive::gainWriteAccess()
 {
     int nErr = 0;
-    uint16_t nCRC;
-    unsigned char cmdBuf[SERIAL_BUFFER_SIZE];
-    unsigned char szResp[SERIAL_BUFFER_SIZE];
-    uint16_t data[WR_ACCESS_L];
-
-    cmdBuf[0] = SOF;
-    cmdBuf[1] = DA;
-    cmdBuf[2] = CB_WRITE | (( m_cSeqNumber++ & 0x0F)<<2);
-    cmdBuf[3] = WR_ACCESS_I;
-    cmdBuf[4] = WR_ACCESS_O;
-    cmdBuf[5] = WR_ACCESS_L;
+    unsigned char cmdBuf[WriteAccessReg::nWriteFrameLen];
+    unsigned char szResp[MAX_FRAME_LEN];
+    int nCmdLen;
 
-    nCRC = crc_xmodem(cmdBuf, 6);
-    cmdBuf[6] = (unsigned char) ((nCRC>> 8) & 0xff);
-    cmdBuf[7] = (unsigned char) (nCRC & 0xff);
+    nCmdLen = encodeWrite<WriteAccessReg>(cmdBuf, m_cSeqNumber++, WR_ACCESS_D);
 
-    data[0] = WR_ACCESS_D;
-    memcpy(cmdBuf + 8, data, WR_ACCESS_L*2);
-    nCRC = crc_xmodem((const unsigned char *)data, WR_ACCESS_L * 2);
-
-    cmdBuf[8+(WR_ACCESS_L*2)] = (unsigned char) ((nCRC>> 8) & 0xff);
-    cmdBuf[8+(WR_ACCESS_L*2)+1] = (unsigned char) (nCRC & 0xff);
-
-#ifdef LOG_DEBUG
-    unsigned char cHexBuf[LOG_BUFFER_SIZE];
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    hexdump(cmdBuf, cHexBuf, 8+WR_ACCESS_L*2 + 2 , LOG_BUFFER_SIZE);
-    fprintf(Logfile, "[%s] CAMCDrive::gainWriteAccess sending : %s\n", timestamp, cHexBuf);
-    fflush(Logfile);
-#endif
+    if(m_Log.isEnabled(AMC_LOG_TRACE))
+        m_Log.outFrame(cmdBuf, nCmdLen, "CAMCDrive::gainWriteAccess sending : ");
 
     // send command and get response.
-    nErr = domeCommand(cmdBuf, 8+WR_ACCESS_L*2 + 2, szResp, SERIAL_BUFFER_SIZE);
+    nErr = domeCommand(cmdBuf, nCmdLen, szResp, MAX_FRAME_LEN);
 
     return nErr;
 }
 
-int CAMCDrive::enableBridge()
+/*
+ Only write the enable if the bridge isn't already enabled, as commanded by us
+ or as read back from DRIVE_BRIDGE_STATUS. If the drive drops the bridge on its
+ own (fault, protection) the next status read will tell us.
+ */
+int CAMCDrive::enableBridge(const uint32_t *pCancelGeneration)
 {
     int nErr = 0;
-    uint16_t nCRC;
-    unsigned char cmdBuf[SERIAL_BUFFER_SIZE];
-    unsigned char szResp[SERIAL_BUFFER_SIZE];
-
-    uint16_t data[BRIDGE_L];
-
-    cmdBuf[0] = SOF;
-    cmdBuf[1] = DA;
-    cmdBuf[2] = CB_WRITE | (( m_cSeqNumber++ & 0x0F)<<2);
-    cmdBuf[3] = BRIDGE_I;
-    cmdBuf[4] = BRIDGE_O;
-    cmdBuf[5] = BRIDGE_L;
-    nCRC = crc_xmodem(cmdBuf, 6);
-    cmdBuf[6] = (unsigned char) ((nCRC>> 8) & 0xff);
-    cmdBuf[7] = (unsigned char) (nCRC & 0xff);
+    unsigned char cmdBuf[BridgeReg::nWriteFrameLen];
+    unsigned char szResp[MAX_FRAME_LEN];
+    int nCmdLen;
 
-    data[0] = 0x0000;
-    memcpy(cmdBuf + 8, data, BRIDGE_L*2);
-
-    nCRC = crc_xmodem((const unsigned char *)data, BRIDGE_L * 2);
+    if((m_nBridgeState & 0x03) == BRIDGE_IS_ENABLED)
+        return nErr;
 
-    cmdBuf[8+(BRIDGE_L*2)] = (unsigned char) ((nCRC>> 8) & 0xff);
-    cmdBuf[8+(BRIDGE_L*2)+1] = (unsigned char) (nCRC & 0xff);
+    nCmdLen = encodeWrite<BridgeReg>(cmdBuf, m_cSeqNumber++, EN_BRIDGE_D);
 
-#ifdef LOG_DEBUG
-    unsigned char cHexBuf[LOG_BUFFER_SIZE];
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    hexdump(cmdBuf, cHexBuf, 8+BRIDGE_L*2 + 2 , LOG_BUFFER_SIZE);
-    fprintf(Logfile, "[%s] CAMCDrive::enableBridge sending : %s\n", timestamp, cHexBuf);
-    fflush(Logfile);
-#endif
+    if(m_Log.isEnabled(AMC_LOG_TRACE))
+        m_Log.outFrame(cmdBuf, nCmdLen, "CAMCDrive::enableBridge sending : ");
 
     // send command and get response.
-    nErr = domeCommand(cmdBuf, 8+BRIDGE_L*2 + 2, szResp, SERIAL_BUFFER_SIZE);
+    nErr = domeCommand(cmdBuf, nCmdLen, szResp, MAX_FRAME_LEN, pCancelGeneration);
+    if(nErr == MOTION_CANCELLED)
+        return nErr;
+    setBridgeState(nErr ? BRIDGE_UNKNOWN : BRIDGE_IS_ENABLED);
 
     return nErr;
 }
+
 int CAMCDrive::disableBridge()
 {
     int nErr = 0;
-    uint16_t nCRC;
-    unsigned char cmdBuf[SERIAL_BUFFER_SIZE];
-    unsigned char szResp[SERIAL_BUFFER_SIZE];
+    unsigned char cmdBuf[BridgeReg::nWriteFrameLen];
+    unsigned char szResp[MAX_FRAME_LEN];
+    int nCmdLen;
 
-    uint16_t data[BRIDGE_L];
+    nCmdLen = encodeWrite<BridgeReg>(cmdBuf, m_cSeqNumber++, DIS_BRIDGE_D);
 
-    cmdBuf[0] = SOF;
-    cmdBuf[1] = DA;
-    cmdBuf[2] = CB_WRITE | (( m_cSeqNumber++ & 0x0F)<<2);
-    cmdBuf[3] = BRIDGE_I;
-    cmdBuf[4] = BRIDGE_O;
-    cmdBuf[5] = BRIDGE_L;
-    nCRC = crc_xmodem(cmdBuf, 6);
-    cmdBuf[6] = (unsigned char) ((nCRC>> 8) & 0xff);
-    cmdBuf[7] = (unsigned char) (nCRC & 0xff);
-
-    data[0] = 0x0001;
-    memcpy(cmdBuf + 8, data, BRIDGE_L*2);
-
-    nCRC = crc_xmodem((const unsigned char *)data, BRIDGE_L * 2);
-
-    cmdBuf[8+(BRIDGE_L*2)] = (unsigned char) ((nCRC>> 8) & 0xff);
-    cmdBuf[8+(BRIDGE_L*2)+1] = (unsigned char) (nCRC & 0xff);
-
-#ifdef LOG_DEBUG
-    unsigned char cHexBuf[LOG_BUFFER_SIZE];
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    hexdump(cmdBuf, cHexBuf, 8+BRIDGE_L*2 + 2 , LOG_BUFFER_SIZE);
-    fprintf(Logfile, "[%s] CAMCDrive::disableBridge sending : %s\n", timestamp, cHexBuf);
-    fflush(Logfile);
-#endif
+    if(m_Log.isEnabled(AMC_LOG_TRACE))
+        m_Log.outFrame(cmdBuf, nCmdLen, "CAMCDrive::disableBridge sending : ");
     // send command and get response.
-    nErr = domeCommand(cmdBuf, 8+BRIDGE_L*2 + 2, szResp, SERIAL_BUFFER_SIZE);
+    nErr = domeCommand(cmdBuf, nCmdLen, szResp, MAX_FRAME_LEN);
+    setBridgeState(nErr ? BRIDGE_UNKNOWN : BRIDGE_IS_DISABLED);
     if(nErr)
         return nErr;
 
     return nErr;
 }
 
+void CAMCDrive::setBridgeState(int nState)
+{
+    int nCurrent = m_nBridgeState;
 
+    while(!m_nBridgeState.compare_exchange_weak(nCurrent, ((nCurrent & ~0x03) + 4) | nState))
+        ;
+}
 
-int CAMCDrive::syncTicksPosition(int ticks)
+/*
+ Update the bridge state from a status read, unless a bridge command was sent
+ since nBridgeState was sampled (before the read).
+ */
+void CAMCDrive::confirmBridgeState(int nBridgeState, const StatusSnapshot &status)
 {
-    int nErr = 0;
-    uint16_t nCRC;
-    unsigned char cmdBuf[SERIAL_BUFFER_SIZE];
-    unsigned char szResp[SERIAL_BUFFER_SIZE];
-    uint16_t data[SYNC_L];
-    uint16_t regValue;
-
-#ifdef LOG_DEBUG
-    unsigned char cHexBuf[LOG_BUFFER_SIZE];
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    hexdump(cmdBuf, cHexBuf, 8+SET_POSITION_L*2 + 2 , LOG_BUFFER_SIZE);
-    fprintf(Logfile, "[%s] CAMCDrive::syncTicksPosition Sync to ticks : %d\n", timestamp, ticks);
-    fflush(Logfile);
-#endif
+    if(!status.bValid)
+        return;
+    m_nBridgeState.compare_exchange_strong(nBridgeState, (nBridgeState & ~0x03) | (status.bBridgeEnabled ? BRIDGE_IS_ENABLED : BRIDGE_IS_DISABLED));
+}
 
-    // set Measured Position Value to new value
-    cmdBuf[0] = SOF;
-    cmdBuf[1] = DA;
-    cmdBuf[2] = CB_WRITE | (( m_cSeqNumber++ & 0x0F)<<2);
-    cmdBuf[3] = SET_POSITION_I;
-    cmdBuf[4] = SET_POSITION_O;
-    cmdBuf[5] = SET_POSITION_L;
 
-    nCRC = crc_xmodem(cmdBuf, 6);
-    cmdBuf[6] = (unsigned char) ((nCRC>> 8) & 0xff);
-    cmdBuf[7] = (unsigned char) (nCRC & 0xff);
 
-    memcpy(cmdBuf + 8, &ticks, SET_POSITION_L*2);
-    nCRC = crc_xmodem((const unsigned char *)&ticks, SET_POSITION_L * 2);
+int CAMCDrive::syncTicksPosition(int ticks)
+{
+    int nErr = 0;
+    unsigned char cmdBuf[SetPositionReg::nWriteFrameLen];
+    unsigned char szResp[MAX_FRAME_LEN];
+    int nCmdLen;
 
-    cmdBuf[8+(SET_POSITION_L*2)] = (unsigned char) ((nCRC>> 8) & 0xff);
-    cmdBuf[8+(SET_POSITION_L*2)+1] = (unsigned char) (nCRC & 0xff);
+    if(m_Log.isEnabled(AMC_LOG_INFO))
+        m_Log.out("CAMCDrive::syncTicksPosition Sync to ticks : %d\n", ticks);
 
-#ifdef LOG_DEBUG
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    hexdump(cmdBuf, cHexBuf, 8+GOTO_L*2 + 2 , LOG_BUFFER_SIZE);
-    fprintf(Logfile, "[%s] CAMCDrive::syncTicksPosition set Measured Position Value to %d: %s\n", timestamp, ticks, cHexBuf);
-    fflush(Logfile);
-#endif
+    // set Measured Position Value to new value
+    nCmdLen = encodeWrite<SetPositionReg>(cmdBuf, m_cSeqNumber++, ticks);
 
-    nErr = domeCommand(cmdBuf, 8 + SET_POSITION_L*2 + 2, szResp, SERIAL_BUFFER_SIZE);
+    if(m_Log.isEnabled(AMC_LOG_TRACE))
+        m_Log.outFrame(cmdBuf, nCmdLen, "CAMCDrive::syncTicksPosition set Measured Position Value to %d: ", ticks);
+
+    nErr = domeCommand(cmdBuf, nCmdLen, szResp, MAX_FRAME_LEN);
     if(nErr)
         printf("nErr = %d\n", nErr);
 
 
-    cmdBuf[0] = SOF;
-    cmdBuf[1] = DA;
-    cmdBuf[2] = CB_WRITE | (( m_cSeqNumber++ & 0x0F)<<2);
-    cmdBuf[3] = SYNC_I;
-    cmdBuf[4] = SYNC_O;
-    cmdBuf[5] = SYNC_L;
-
-    nCRC = crc_xmodem(cmdBuf, 6);
-    cmdBuf[6] = (unsigned char) ((nCRC>> 8) & 0xff);
-    cmdBuf[7] = (unsigned char) (nCRC & 0xff);
+    nCmdLen = encodeWrite<SyncReg>(cmdBuf, m_cSeqNumber++, SYNC_D);
 
-    regValue = SYNC_D;
-    data[0] = regValue;
-    memcpy(cmdBuf + 8, data, SYNC_L*2);
-    nCRC = crc_xmodem((const unsigned char *)data, SYNC_L * 2);
-
-    cmdBuf[8+(SYNC_L*2)] = (unsigned char) ((nCRC>> 8) & 0xff);
-    cmdBuf[8+(SYNC_L*2)+1] = (unsigned char) (nCRC & 0xff);
-
-#ifdef LOG_DEBUG
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    hexdump(cmdBuf, cHexBuf, 8+SYNC_L*2 + 2 , LOG_BUFFER_SIZE);
-    fprintf(Logfile, "[%s] CAMCDrive::syncTicksPosition Set Position sending : %s\n", timestamp, cHexBuf);
-    fflush(Logfile);
-#endif
+    if(m_Log.isEnabled(AMC_LOG_TRACE))
+        m_Log.outFrame(cmdBuf, nCmdLen, "CAMCDrive::syncTicksPosition Set Position sending : ");
 
-    nErr = domeCommand(cmdBuf, 8 + SYNC_L*2 + 2, szResp, SERIAL_BUFFER_SIZE);
+    nErr = domeCommand(cmdBuf, nCmdLen, szResp, MAX_FRAME_LEN);
     if(nErr)
         printf("nErr = %d\n", nErr);
 
-    timer.Reset();
+    motionCommandSent();
     return nErr;
 }
 
 
-int CAMCDrive::gotoTicksPosition(int ticks)
+int CAMCDrive::gotoTicksPosition(int ticks, const uint32_t *pCancelGeneration)
 {
     int nErr = 0;
-    uint16_t nCRC;
-    unsigned char cmdBuf[SERIAL_BUFFER_SIZE];
-    unsigned char szResp[SERIAL_BUFFER_SIZE];
+    unsigned char cmdBuf[GotoReg::nWriteFrameLen];
+    unsigned char szResp[MAX_FRAME_LEN];
+    int nCmdLen;
 
-    cmdBuf[0] = SOF;
-    cmdBuf[1] = DA;
-    cmdBuf[2] = CB_WRITE | (( m_cSeqNumber++ & 0x0F)<<2);
-    cmdBuf[3] = GOTO_I;
-    cmdBuf[4] = GOTO_O;
-    cmdBuf[5] = GOTO_L;
+    nCmdLen = encodeWrite<GotoReg>(cmdBuf, m_cSeqNumber++, ticks);
 
-    nCRC = crc_xmodem(cmdBuf, 6);
-    cmdBuf[6] = (unsigned char) ((nCRC>> 8) & 0xff);
-    cmdBuf[7] = (unsigned char) (nCRC & 0xff);
+    if(m_Log.isEnabled(AMC_LOG_TRACE))
+        m_Log.outFrame(cmdBuf, nCmdLen, "CAMCDrive::gotoTicksPosition sending data for position %d: ", ticks);
 
-    memcpy(cmdBuf + 8, &ticks, GOTO_L*2);
-    nCRC = crc_xmodem((const unsigned char *)&ticks, GOTO_L * 2);
-
-    cmdBuf[8+(GOTO_L*2)] = (unsigned char) ((nCRC>> 8) & 0xff);
-    cmdBuf[8+(GOTO_L*2)+1] = (unsigned char) (nCRC & 0xff);
-
-#ifdef LOG_DEBUG
-    unsigned char cHexBuf[LOG_BUFFER_SIZE];
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    hexdump(cmdBuf, cHexBuf, 8+GOTO_L*2 + 2 , LOG_BUFFER_SIZE);
-    fprintf(Logfile, "[%s] CAMCDrive::gotoTicksPosition sending data for position %d: %s\n", timestamp, ticks, cHexBuf);
-    fflush(Logfile);
-#endif
-
-    nErr = domeCommand(cmdBuf, 8 + GOTO_L*2 + 2, szResp, SERIAL_BUFFER_SIZE);
+    nErr = domeCommand(cmdBuf, nCmdLen, szResp, MAX_FRAME_LEN, pCancelGeneration);
+    if(nErr == MOTION_CANCELLED)
+        return nErr;
     if(nErr)
         printf("nErr = %d\n", nErr);
 
-    timer.Reset();
+    motionCommandSent(GOTO, ticks);
 
     return nErr;
 }
@@ -1429,24 +1788,15 @@ int CAMCDrive::gotoTicksPosition(int ticks)
 int CAMCDrive::getFirmwareVersion(char *szVersion, int nStrMaxLen)
 {
     int nErr = 0;
-    uint16_t nCRC;
-    unsigned char cmdBuf[SERIAL_BUFFER_SIZE];
-    unsigned char szResp[SERIAL_BUFFER_SIZE];
+    unsigned char cmdBuf[FirmwareReg::nReadFrameLen];
+    unsigned char szResp[MAX_FRAME_LEN];
+    int nCmdLen;
     size_t nMaxSize;
 
-    cmdBuf[0] = SOF;
-    cmdBuf[1] = DA;
-    cmdBuf[2] = CB_READ | (( m_cSeqNumber++ & 0x0F)<<2);
-    cmdBuf[3] = FW_I;
-    cmdBuf[4] = FW_O;
-    cmdBuf[5] = FW_L;
-
-    nCRC = crc_xmodem(cmdBuf, 6);
-    cmdBuf[6] = (unsigned char) ((nCRC>> 8) & 0xff);
-    cmdBuf[7] = (unsigned char) (nCRC & 0xff);
+    nCmdLen = encodeRead<FirmwareReg>(cmdBuf, m_cSeqNumber++);
 
     // send command and get response.
-    nErr = domeCommand(cmdBuf, 8, szResp, SERIAL_BUFFER_SIZE);
+    nErr = domeCommand(cmdBuf, nCmdLen, szResp, MAX_FRAME_LEN);
     if(nErr)
         return nErr;
 
@@ -1471,24 +1821,15 @@ int CAMCDrive::getFirmwareVersionString(char *szVersion, int nStrMaxLen)
 int CAMCDrive::getProductInformation(char *szProdInfo, int nStrMaxLen)
 {
     int nErr = 0;
-    uint16_t nCRC;
-    unsigned char cmdBuf[SERIAL_BUFFER_SIZE];
-    unsigned char szResp[SERIAL_BUFFER_SIZE];
+    unsigned char cmdBuf[ProdInfoReg::nReadFrameLen];
+    unsigned char szResp[MAX_FRAME_LEN];
+    int nCmdLen;
     size_t nMaxSize;
 
-    cmdBuf[0] = SOF;
-    cmdBuf[1] = DA;
-    cmdBuf[2] = CB_READ | (( m_cSeqNumber++ & 0x0F)<<2);
-    cmdBuf[3] = PI_I;
-    cmdBuf[4] = PI_O;
-    cmdBuf[5] = PI_L;
-
-    nCRC = crc_xmodem(cmdBuf, 6);
-    cmdBuf[6] = (unsigned char) ((nCRC>> 8) & 0xff);
-    cmdBuf[7] = (unsigned char) (nCRC & 0xff);
+    nCmdLen = encodeRead<ProdInfoReg>(cmdBuf, m_cSeqNumber++);
 
     // send command and get response.
-    nErr = domeCommand(cmdBuf, 8, szResp, SERIAL_BUFFER_SIZE);
+    nErr = domeCommand(cmdBuf, nCmdLen, szResp, MAX_FRAME_LEN);
     if(nErr)
         return nErr;
 
@@ -1516,224 +1857,754 @@ int CAMCDrive::getProductInformationString(char *szProdInfo, int nStrMaxLen)
 
 
 
+/*
+ The STOP goes out first, as a safety class request it gets the link before
+ anything else that's waiting, the rest can wait until the dome is stopping.
+ m_nStopSentMs is when we sent it, the first status showing zero velocity
+ after that gives the stop latency, see noteStopped. The poller looks for it
+ every MIN_POLL_PERIOD, so the latency doesn't depend on when TheSkyX next
+ reads the status, it's started for that if it wasn't running.
+ */
 int CAMCDrive::abortCurrentCommand()
 {
     int nErr = 0;
-    uint16_t nCRC;
-    unsigned char cmdBuf[SERIAL_BUFFER_SIZE];
-    unsigned char szResp[SERIAL_BUFFER_SIZE];
-    uint16_t data[STOP_L];
-    uint32_t regValue;
+    unsigned char cmdBuf[StopReg::nWriteFrameLen];
+    unsigned char szResp[MAX_FRAME_LEN];
+    int nCmdLen;
+    uint64_t nSentMs;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
+
+    // no tracking target or held goto from the poller after the STOP
+    m_nCancelGeneration++;
+    endTracking();
+    cancelPendingGoto();
+
+    nCmdLen = encodeWrite<StopReg>(cmdBuf, m_cSeqNumber++, STOP_D);
+    m_nStopSentMs = 0;
+    m_nStopLatencyMs = -1;
+    nSentMs = monotonicMs();
+    nErr = domeCommand(cmdBuf, nCmdLen, szResp, MAX_FRAME_LEN);
+    m_nStopCommandMs = (int)(monotonicMs() - nSentMs);
+    if(!nErr)
+        m_nStopSentMs = nSentMs;
+    motionCommandSent(STOP);
+
+    if(m_Log.isEnabled(AMC_LOG_INFO))
+        m_Log.out("CAMCDrive::abortCurrentCommand STOP acknowledged in %d ms\n", (int)m_nStopCommandMs);
+    if(m_Log.isEnabled(AMC_LOG_TRACE))
+        m_Log.outFrame(cmdBuf, nCmdLen, "CAMCDrive::abortCurrentCommand sent : ");
+
     // temp fix
     disableBridge();
     resetEvents();
     // end temp fix
+    // poll at MIN_POLL_PERIOD until the drive reports zero velocity, it
+    // parks once that's seen if it has nothing else to do
+    if(m_nStopSentMs)
+        startPoller();
 
-#ifdef LOG_DEBUG
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] CAMCDrive::abortCurrentCommand \n", timestamp);
-    fflush(Logfile);
-#endif
+    return nErr;
+}
 
-    // set STOP bit
-    regValue = STOP_D;
+/*
+ Called with every status read, the first one showing zero velocity after
+ an abort ends the stop latency measurement.
+ */
+void CAMCDrive::noteStopped(uint64_t nTimeStampMs)
+{
+    uint64_t nSentMs = m_nStopSentMs;
+
+    if(!nSentMs || nTimeStampMs < nSentMs)
+        return;
+    // the poller and the main thread can both get here
+    if(m_nStopSentMs.compare_exchange_strong(nSentMs, 0)) {
+        m_nStopLatencyMs = (int)(nTimeStampMs - nSentMs);
+        if(m_Log.isEnabled(AMC_LOG_INFO))
+            m_Log.out("CAMCDrive::noteStopped zero velocity %d ms after the STOP\n", (int)m_nStopLatencyMs);
+    }
+}
 
-    // write register
-    cmdBuf[0] = SOF;
-    cmdBuf[1] = DA;
-    cmdBuf[2] = CB_WRITE | (( m_cSeqNumber++ & 0x0F)<<2);
-    cmdBuf[3] = STOP_I;
-    cmdBuf[4] = STOP_O;
-    cmdBuf[5] = STOP_L;
+/*
+ A STOP was sent and no status showed zero velocity yet, for STOP_WATCH_MS
+ at most in case it never does (the link went down).
+ */
+bool CAMCDrive::isStopPending()
+{
+    uint64_t nSentMs = m_nStopSentMs;
 
-    nCRC = crc_xmodem(cmdBuf, 6);
-    cmdBuf[6] = (unsigned char) ((nCRC>> 8) & 0xff);
-    cmdBuf[7] = (unsigned char) (nCRC & 0xff);
+    return nSentMs && monotonicMs() - nSentMs < STOP_WATCH_MS;
+}
 
-    data[0] = regValue;
-    
-    memcpy(cmdBuf + 8, data, STOP_L*2);
+int CAMCDrive::resetEvents()
+{
+    int nErr = 0;
+    unsigned char cmdBuf[ResetEventsReg::nWriteFrameLen];
+    unsigned char szResp[MAX_FRAME_LEN];
+    int nCmdLen;
 
-    nCRC = crc_xmodem((const unsigned char *)data, STOP_L * 2);
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
 
-    cmdBuf[8+(STOP_L*2)] = (unsigned char) ((nCRC>> 8) & 0xff);
-    cmdBuf[8+(STOP_L*2)+1] = (unsigned char) (nCRC & 0xff);
+    if(m_Log.isEnabled(AMC_LOG_INFO))
+        m_Log.out("CAMCDrive::resetEvents \n");
 
-#ifdef LOG_DEBUG
-    unsigned char cHexBuf[LOG_BUFFER_SIZE];
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    hexdump(cmdBuf, cHexBuf, 8+STOP_L*2 + 2 , LOG_BUFFER_SIZE);
-    fprintf(Logfile, "[%s] CAMCDrive::abortCurrentCommand sending : %s\n", timestamp, cHexBuf);
-    fflush(Logfile);
-#endif
+    nCmdLen = encodeWrite<ResetEventsReg>(cmdBuf, m_cSeqNumber++, RST_EVT_D);
 
-    nErr = domeCommand(cmdBuf, 8 + STOP_L*2 + 2, szResp, SERIAL_BUFFER_SIZE);
+    if(m_Log.isEnabled(AMC_LOG_TRACE))
+        m_Log.outFrame(cmdBuf, nCmdLen, "CAMCDrive::resetEvents sending : ");
 
-    timer.Reset();
+    nErr = domeCommand(cmdBuf, nCmdLen, szResp, MAX_FRAME_LEN);
+
+    motionCommandSent();
     return nErr;
+
 }
 
-int CAMCDrive::resetEvents()
+bool CAMCDrive::isPositionReached(const StatusSnapshot &status)
 {
-    int nErr = 0;
-    uint16_t nCRC;
-    unsigned char cmdBuf[SERIAL_BUFFER_SIZE];
-    unsigned char szResp[SERIAL_BUFFER_SIZE];
-    uint16_t data[STOP_L];
-    uint32_t regValue;
+    return status.bPosReached;
+}
+
+/*
+ Read the whole monitor status block (index 0x02, offsets 0 to 5) in one frame
+ and decode it. If bWithPosition is set the position is read in the same
+ pipelined batch.
+ A good snapshot with position is also published for getFreshSnapshot.
+ This is called from the poller thread, don't touch the member state here
+ (the bridge state is atomic and guarded against racing a bridge command,
+ logStatusFaults only uses an atomic).
+ */
+int CAMCDrive::getStatusSnapshot(StatusSnapshot &status, bool bWithPosition)
+{
+    int nErr = OK;
+    int nNbRequests = 1;
+    int nBridgeState;
+    uint16_t nWords[NB_STATUS_REG];
+    uint32_t nTicks = 0;
+    unsigned char cmdBuf[2][FRAME_HEADER_LEN];
+    unsigned char szStatusResp[StatusBlockReg::nResponseLen];
+    unsigned char szPosResp[PositionReg::nResponseLen];
+    AMCRequest requests[2];
+
+    memset(&status, 0, sizeof(StatusSnapshot));
+    // a motion command sent while we're reading makes this snapshot stale
+    status.nMotionGeneration = m_nMotionGeneration;
+    nBridgeState = m_nBridgeState;
+
+    requests[0].nCmdSize = encodeRead<StatusBlockReg>(cmdBuf[0], m_cSeqNumber++);
+    requests[0].pCmd = cmdBuf[0];
+    requests[0].pResp = szStatusResp;
+    requests[0].nRespMaxLen = sizeof(szStatusResp);
+    if(bWithPosition) {
+        requests[1].nCmdSize = encodeRead<PositionReg>(cmdBuf[1], m_cSeqNumber++);
+        requests[1].pCmd = cmdBuf[1];
+        requests[1].pResp = szPosResp;
+        requests[1].nRespMaxLen = sizeof(szPosResp);
+        nNbRequests = 2;
+    }
+
+    nErr = domeTransaction(requests, nNbRequests);
+
+    if(!requests[0].nErr) {
+        memcpy(nWords, szStatusResp + FRAME_HEADER_LEN, NB_STATUS_REG*2);
+        status.nBridgeStatus = nWords[DRIVE_BRIDGE_STATUS_O];
+        status.nDriveProtStatus = nWords[DRIVE_PROT_STATUS_O];
+        status.nSysProtStatus = nWords[SYS_PROT_STATUS_O];
+        status.nStatus1 = nWords[STATUS_1_O];
+        status.nStatus2 = nWords[STATUS_2_O];
+        status.nStatus3 = nWords[STATUS_3_O];
+
+        status.bZeroVelocity = (status.nStatus2 & MOVING) == MOVING;
+        status.bPosReached = (status.nStatus2 & POS_REACHED) == POS_REACHED;
+        status.bInHomePosition = (status.nStatus2 & IN_HOME_POSITION) == IN_HOME_POSITION;
+        status.bHoming = (status.nStatus2 & HOMING) == HOMING;
+        status.bHomingComplete = (status.nStatus2 & HOMING_COMPLETE) == HOMING_COMPLETE;
+        status.bBridgeEnabled = (status.nBridgeStatus & BRIDGE_ENABLED) == BRIDGE_ENABLED;
+        status.bPositiveStop = (status.nBridgeStatus & POSITIVE_STOP) != 0;
+        status.bNegativeStop = (status.nBridgeStatus & NEGATIVE_STOP) != 0;
+        status.bTorqueInhibit = (status.nBridgeStatus & (POSITIVE_INHIBIT | NEGATIVE_INHIBIT)) != 0;
+        status.bDriveFault = (status.nDriveProtStatus & DRIVE_FAULT_MASK) != 0;
+        status.bSystemFault = (status.nSysProtStatus & SYS_FAULT_MASK) != 0;
+        status.bDisabled = (status.nStatus1 & (SOFTWARE_DISABLE | USER_DISABLE)) != 0;
+        status.bCurrentLimiting = (status.nStatus1 & CURRENT_LIMITING) != 0;
+        status.bFollowingError = (status.nStatus2 & (POSITION_FOLLOWING_ERROR | VELOCITY_FOLLOWING_ERROR)) != 0;
+        status.bTargetLimit = (status.nStatus2 & (MAX_TARGET_POSITION_LIMIT | MIN_TARGET_POSITION_LIMIT)) != 0;
+        status.bValid = true;
+        logStatusFaults(status);
+    }
+    confirmBridgeState(nBridgeState, status);
+
+    if(bWithPosition && !requests[1].nErr) {
+        memcpy(&nTicks, szPosResp + FRAME_HEADER_LEN, 4);
+        status.nTicks = nTicks;
+        TicksToAz(nTicks, status.dAz);
+        status.bPositionValid = true;
+    }
+
+    status.nTimeStampMs = monotonicMs();
+    if(status.bValid && status.bZeroVelocity)
+        noteStopped(status.nTimeStampMs);
+    if(status.bValid && status.bPositionValid)
+        publishSnapshot(status);
+    if(status.bPositionValid)
+        publishPosition(status.nTicks, status.dAz, status.nTimeStampMs);
+
+    return nErr;
+}
+
+#pragma mark - Published dome state
+
+/*
+ The dome state is published through a seqlock so dapiGetAzEl can read it
+ without waiting for whatever command currently owns the link.
+ Position can come from any thread, the newest read wins.
+ */
+void CAMCDrive::publishPosition(uint32_t nTicks, double dAz, uint64_t nTimeStampMs)
+{
+    m_DomeState.modify([&](DomeState &state) {
+        if(nTimeStampMs < state.nTimeStampMs)
+            return;
+        state.nTicks = nTicks;
+        state.dAz = dAz;
+        state.nTimeStampMs = nTimeStampMs;
+        state.bValid = true;
+    });
+}
+
+void CAMCDrive::publishFlags()
+{
+    bool bHomed = m_bHomed;
+    bool bParked = m_bParked;
+    int nShutterState = m_nShutterState;
+    double dEl = m_dCurrentElPosition;
+
+    m_DomeState.modify([&](DomeState &state) {
+        state.bHomed = bHomed;
+        state.bParked = bParked;
+        state.nShutterState = nShutterState;
+        state.dEl = dEl;
+    });
+}
+
+void CAMCDrive::setHomed(bool bHomed)
+{
+    m_bHomed = bHomed;
+    publishFlags();
+}
+
+void CAMCDrive::setParked(bool bParked)
+{
+    m_bParked = bParked;
+    publishFlags();
+}
+
+void CAMCDrive::setShutterOpened(bool bOpened)
+{
+    m_bShutterOpened = bOpened;
+    m_dCurrentElPosition = bOpened ? 90.0 : 0.0;
+    m_nShutterState = bOpened ? OPEN : CLOSED;
+    publishFlags();
+}
+
+void CAMCDrive::getDomeState(DomeState &state)
+{
+    m_DomeState.load(state);
+}
+
+/*
+ Is the published position recent enough to be returned as is.
+ */
+bool CAMCDrive::isDomeStateFresh(const DomeState &state)
+{
+    return state.bValid && (monotonicMs() - state.nTimeStampMs <= (uint64_t)m_nSnapshotMaxAgeMs);
+}
+
+#pragma mark - Tracking
+
+/*
+ The drive has no velocity mode we can use, the dome follows a target that
+ moves : the poller sends a new goto every TRACK_UPDATE_MS to where the slit
+ should be TRACK_LEAD from now. The drive changes course on the fly and never
+ gets to the target, so the dome doesn't stop and start like it does with a
+ series of gotos.
+ */
+int CAMCDrive::startTracking(double dAz, double dRate)
+{
+    int nErr = OK;
+    int nTicks;
+    uint32_t nGeneration;
+    double dCurrentAz;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-#ifdef LOG_DEBUG
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] CAMCDrive::resetEvents \n", timestamp);
-    fflush(Logfile);
-#endif
+    stopTracking();
+    cancelPendingGoto();
+    enableBridge();
+    nErr = getDomeAz(dCurrentAz);
+    if(nErr)
+        return nErr;
 
-    // set reset events bit
-    regValue = RST_EVT_D;
+    {
+        std::lock_guard<std::mutex> lock(m_TrackLock);
+        m_dTrackAz = dAz;
+        m_dTrackRate = dRate;
+        m_nTrackStartMs = monotonicMs();
+        m_dTrackCorrection = 0;
+        m_dTrackErrorSum = 0;
+        memset(&m_TrackStats, 0, sizeof(TrackingStats));
+        nTicks = nearestTicks(dAz + dRate * TRACK_LEAD, (int32_t)m_nCurrentTicks);
+        m_bTracking = true;
+        nGeneration = m_nCancelGeneration;
+    }
+    // not under m_TrackLock, an abort must be able to end the tracking while this is on the wire
+    nErr = sendTrackTarget(nTicks, nGeneration);
+    {
+        std::lock_guard<std::mutex> lock(m_TrackLock);
+        if(nErr) {
+            m_bTracking = false;
+            return nErr;
+        }
+        if(!m_bTracking)
+            return nErr;
+        m_nMotionTarget = nTicks;
+        m_TrackStats.nUpdates++;
+    }
+    motionCommandSent(TRACK, nTicks);
 
-    // write register
-    cmdBuf[0] = SOF;
-    cmdBuf[1] = DA;
-    cmdBuf[2] = CB_WRITE | (( m_cSeqNumber++ & 0x0F)<<2);
-    cmdBuf[3] = RST_EVT_I;
-    cmdBuf[4] = RST_EVT_O;
-    cmdBuf[5] = RST_EVT_L;
+    if(m_Log.isEnabled(AMC_LOG_INFO))
+        m_Log.out("CAMCDrive::startTracking from %3.2f at %3.4f deg/s\n", dAz, dRate);
 
-    nCRC = crc_xmodem(cmdBuf, 6);
-    cmdBuf[6] = (unsigned char) ((nCRC>> 8) & 0xff);
-    cmdBuf[7] = (unsigned char) (nCRC & 0xff);
+    startPoller();
+    return nErr;
+}
 
-    data[0] = regValue;
+/*
+ The poller stops moving the target, the dome stops on the last one it got.
+ */
+void CAMCDrive::stopTracking()
+{
+    if(endTracking() && !m_nPollPeriodMs)
+        stopPoller();
+}
 
-    memcpy(cmdBuf + 8, data, RST_EVT_L*2);
+/*
+ Once this returns no more targets go out, one the poller already decided on
+ is dropped by domeTransaction. Returns true if we were tracking.
+ */
+bool CAMCDrive::endTracking()
+{
+    std::lock_guard<std::mutex> lock(m_TrackLock);
 
-    nCRC = crc_xmodem((const unsigned char *)data, RST_EVT_L * 2);
+    if(!m_bTracking)
+        return false;
+    m_bTracking = false;
+    m_nCancelGeneration++;
+    if(m_Log.isEnabled(AMC_LOG_INFO))
+        m_Log.out("CAMCDrive::endTracking\n");
+    return true;
+}
 
-    cmdBuf[8+(RST_EVT_L*2)] = (unsigned char) ((nCRC>> 8) & 0xff);
-    cmdBuf[8+(RST_EVT_L*2)+1] = (unsigned char) (nCRC & 0xff);
+void CAMCDrive::getTrackingStats(TrackingStats &stats)
+{
+    std::lock_guard<std::mutex> lock(m_TrackLock);
 
-#ifdef LOG_DEBUG
-    unsigned char cHexBuf[LOG_BUFFER_SIZE];
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    hexdump(cmdBuf, cHexBuf, 8+RST_EVT_L*2 + 2 , LOG_BUFFER_SIZE);
-    fprintf(Logfile, "[%s] CAMCDrive::resetEvents sending : %s\n", timestamp, cHexBuf);
-    fflush(Logfile);
-#endif
+    stats = m_TrackStats;
+    stats.dMeanError = m_TrackStats.nSamples ? m_dTrackErrorSum / m_TrackStats.nSamples : 0;
+}
+
+/*
+ Called by the poller with each snapshot while tracking. The error between
+ where the dome is and where the slit should be is taken out of the target
+ TRACK_CORRECTION_GAIN at a time, this also removes the distance the drive
+ keeps between the dome and its target. The correction stays below the lead
+ or the dome would get to the target and stop.
+ */
+void CAMCDrive::trackingStep(const StatusSnapshot &status)
+{
+    double dExpectedAz;
+    double dError;
+    double dLead;
+    double dMaxCorrection;
+    int nTicks;
+    uint32_t nGeneration;
+    std::unique_lock<std::mutex> lock(m_TrackLock);
+
+    if(!m_bTracking || !status.bPositionValid || status.nMotionGeneration != m_nMotionGeneration)
+        return;
+
+    dExpectedAz = m_dTrackAz + m_dTrackRate * ((double)status.nTimeStampMs - (double)m_nTrackStartMs) / 1000.0;
+    dError = fmod(status.dAz - dExpectedAz, 360.0);
+    if(dError > 180)
+        dError -= 360;
+    else if(dError < -180)
+        dError += 360;
+
+    m_TrackStats.nSamples++;
+    m_dTrackErrorSum += fabs(dError);
+    if(fabs(dError) > m_TrackStats.dMaxError)
+        m_TrackStats.dMaxError = fabs(dError);
+
+    dLead = m_dTrackRate * TRACK_LEAD;
+    dMaxCorrection = fabs(dLead) * TRACK_MAX_CORRECTION;
+    m_dTrackCorrection -= TRACK_CORRECTION_GAIN * dError;
+    if(m_dTrackCorrection > dMaxCorrection)
+        m_dTrackCorrection = dMaxCorrection;
+    else if(m_dTrackCorrection < -dMaxCorrection)
+        m_dTrackCorrection = -dMaxCorrection;
+
+    dExpectedAz = m_dTrackAz + m_dTrackRate * (monotonicMs() - m_nTrackStartMs) / 1000.0;
+    nTicks = nearestTicks(dExpectedAz + dLead + m_dTrackCorrection, (int32_t)status.nTicks);
+    if(m_Log.isEnabled(AMC_LOG_TRACE))
+        m_Log.out("CAMCDrive::trackingStep error %3.4f deg, correction %3.4f deg, target %d ticks\n", dError, m_dTrackCorrection, nTicks);
+    if(nTicks == m_nMotionTarget)
+        return;
+
+    // the goto goes out without m_TrackLock held, see startTracking
+    nGeneration = m_nCancelGeneration;
+    lock.unlock();
+    if(sendTrackTarget(nTicks, nGeneration))
+        return;
+    lock.lock();
+    if(!m_bTracking)
+        return;
+    m_nMotionTarget = nTicks;
+    m_TrackStats.nUpdates++;
+}
 
-    nErr = domeCommand(cmdBuf, 8 + RST_EVT_L*2 + 2, szResp, SERIAL_BUFFER_SIZE);
+/*
+ Goto write for tracking. Unlike gotoTicksPosition it doesn't restart the
+ motion detection, it's the same motion. Called without m_TrackLock held,
+ the caller sets m_nMotionTarget if we are still tracking once it's sent.
+ nCancelGeneration is m_nCancelGeneration when the caller saw we were
+ tracking, the target is dropped (MOTION_CANCELLED) if tracking ended since.
+ */
+int CAMCDrive::sendTrackTarget(int nTicks, uint32_t nCancelGeneration)
+{
+    int nErr = 0;
+    unsigned char cmdBuf[GotoReg::nWriteFrameLen];
+    unsigned char szResp[MAX_FRAME_LEN];
+    int nCmdLen;
 
-    timer.Reset();
+    nCmdLen = encodeWrite<GotoReg>(cmdBuf, m_cSeqNumber++, nTicks);
+
+    if(m_Log.isEnabled(AMC_LOG_TRACE))
+        m_Log.outFrame(cmdBuf, nCmdLen, "CAMCDrive::sendTrackTarget sending data for position %d: ", nTicks);
+
+    nErr = domeCommand(cmdBuf, nCmdLen, szResp, MAX_FRAME_LEN, &nCancelGeneration);
     return nErr;
+}
+
+#pragma mark - Telemetry poller
 
+uint64_t CAMCDrive::monotonicMs()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-bool CAMCDrive::isPositionReached()
+/*
+ Every command that starts, changes or stops a motion goes through here so
+ that snapshots taken before it are no longer used.
+ nCmd is GOTO (to nTargetTicks) or HOME for the commands that start a move
+ isDomeMoving should wait for. A sync makes the position jump, the next read
+ is the new reference.
+ */
+void CAMCDrive::motionCommandSent(int nCmd, int nTargetTicks)
 {
-    uint16_t nStatus;
-    bool bReached = false;
+    timer.Reset();
+    m_nMotionGeneration++;
+    m_nMotionCmd = nCmd;
+    m_nMotionTarget = nTargetTicks;
+    m_nMotionCmdMs = monotonicMs();
+    m_bMotionStarted = false;
+    // the next read is compared with the last one, unless the position jumped
+    if(nCmd != GOTO && nCmd != HOME)
+        m_bHaveMotionTicks = false;
+    // a held retarget doesn't survive a home, stop or sync
+    if(nCmd != GOTO)
+        m_bGotoPending = false;
+
+    // get the poller to pick up the new motion now
+    wakePoller();
+}
 
-    nStatus = getStatus(STATUS_2_O);
+/*
+ Is the dome at position nTicks within m_nGotoToleranceTicks of dAz, on any turn.
+ */
+bool CAMCDrive::isAtAzimuth(uint32_t nTicks, double dAz)
+{
+    int nAzTicks;
 
-    if((nStatus & POS_REACHED) == POS_REACHED)
-        bReached = true;
+    AzToTicks(dAz, nAzTicks);
+    return ticksDistance(nTicks, (uint32_t)nAzTicks) <= m_nGotoToleranceTicks;
+}
 
-    return bReached;
+/*
+ Distance in ticks between two positions, the short way round.
+ */
+int CAMCDrive::ticksDistance(uint32_t nFrom, uint32_t nTo)
+{
+    int32_t nDelta = (int32_t)(nTo - nFrom);
+
+    if(m_nNbTicksPerRev > 0) {
+        nDelta %= m_nNbTicksPerRev;
+        if(nDelta < 0)
+            nDelta += m_nNbTicksPerRev;
+        if(nDelta > m_nNbTicksPerRev / 2)
+            nDelta = m_nNbTicksPerRev - nDelta;
+    }
+    else if(nDelta < 0)
+        nDelta = -nDelta;
+    return nDelta;
 }
 
-uint16_t CAMCDrive::getStatus(unsigned char cStatus)
+void CAMCDrive::publishSnapshot(const StatusSnapshot &status)
 {
-    int nErr = OK;
-    unsigned char cmdBuf[SERIAL_BUFFER_SIZE];
-    unsigned char szResp[SERIAL_BUFFER_SIZE];
-    uint16_t nCRC;
-    uint16_t nStatus;
+    std::lock_guard<std::mutex> lock(m_CacheLock);
+    m_CachedStatus = status;
+}
 
-    cmdBuf[0] = SOF;
-    cmdBuf[1] = DA;
-    cmdBuf[2] = CB_READ | (( m_cSeqNumber++ & 0x0F)<<2);
-    cmdBuf[3] = STATUS_I;
-    cmdBuf[4] = cStatus; // cStatus
-    cmdBuf[5] = STATUS_L;
+/*
+ Returns true and fills status if the poller is running and the last snapshot
+ is recent enough and was taken after the last motion command.
+ Recent enough is m_nSnapshotMaxAgeMs at most, the configured bound, so a
+ move we didn't command is seen that soon. When the scheduler planned the
+ next poll sooner (a goto about to arrive) it's until that poll.
+ */
+bool CAMCDrive::getFreshSnapshot(StatusSnapshot &status)
+{
+    int nMaxAgeMs;
 
-    nCRC = crc_xmodem(cmdBuf, 6);
-    cmdBuf[6] = (unsigned char) ((nCRC>> 8) & 0xff);
-    cmdBuf[7] = (unsigned char) (nCRC & 0xff);
+    if(!m_bPollerRunning)
+        return false;
 
-#ifdef LOG_DEBUG
-    unsigned char cHexBuf[LOG_BUFFER_SIZE];
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    hexdump(cmdBuf, cHexBuf, 8 , LOG_BUFFER_SIZE);
-    fprintf(Logfile, "[%s] CAMCDrive::getStatus %02x sending : %s\n", timestamp, cStatus, cHexBuf);
-    fflush(Logfile);
-#endif
+    {
+        std::lock_guard<std::mutex> lock(m_CacheLock);
+        status = m_CachedStatus;
+    }
 
-    nErr = domeCommand(cmdBuf, 8, szResp, SERIAL_BUFFER_SIZE);
-    if(nErr)
+    if(!status.bValid || status.nMotionGeneration != m_nMotionGeneration)
+        return false;
+    nMaxAgeMs = m_nNextPollMs + MIN_POLL_PERIOD;
+    if(nMaxAgeMs > m_nSnapshotMaxAgeMs)
+        nMaxAgeMs = m_nSnapshotMaxAgeMs;
+    if(monotonicMs() - status.nTimeStampMs > (uint64_t)nMaxAgeMs)
         return false;
 
-    memcpy(&nStatus, szResp+8, 2);
-#ifdef LOG_DEBUG
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] CAMCDrive::getStatus nStatus : %04x\n", timestamp, nStatus);
-    fflush(Logfile);
-#endif
+    return true;
+}
 
-    return nStatus;
+void CAMCDrive::setPollPeriod(int nPeriodMs)
+{
+    if(nPeriodMs < 0)
+        nPeriodMs = 0;
+    if(nPeriodMs && nPeriodMs < MIN_POLL_PERIOD)
+        nPeriodMs = MIN_POLL_PERIOD;
+
+    m_nPollPeriodMs = nPeriodMs;
+    if(!m_bIsConnected)
+        return;
+    // tracking needs the poller
+    if(m_nPollPeriodMs || m_bTracking)
+        startPoller();
+    else
+        stopPoller();
+}
+
+void CAMCDrive::setSnapshotMaxAge(int nMaxAgeMs)
+{
+    if(nMaxAgeMs < MIN_POLL_PERIOD)
+        nMaxAgeMs = MIN_POLL_PERIOD;
+    m_nSnapshotMaxAgeMs = nMaxAgeMs;
+}
+
+void CAMCDrive::startPoller()
+{
+    if(m_bPollerRunning) {
+        // pick up the new period right away. Taking the lock makes sure the
+        // poller is either waiting or will see the change before it does.
+        {
+            std::lock_guard<std::mutex> lock(m_PollerLock);
+        }
+        m_PollerCond.notify_all();
+        return;
+    }
+    m_bPollerRunning = true;
+    m_PollerThread = std::thread(&CAMCDrive::pollerThread, this);
 }
 
-#ifdef LOG_DEBUG
-void CAMCDrive::getAllStatusReg()
+/*
+ Poll right away, and schedule the next poll from there.
+ */
+void CAMCDrive::wakePoller()
 {
-    int nStatus;
+    if(!m_bPollerRunning)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_PollerLock);
+        m_bPollNow = true;
+    }
+    m_PollerCond.notify_all();
+}
 
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    nStatus = getStatus(DRIVE_BRIDGE_STATUS_O);
-    fprintf(Logfile, "[%s] CAMCDrive::isFindHomeComplete DRIVE_BRIDGE_STATUS = %04Xf\n", timestamp, nStatus);
+void CAMCDrive::stopPoller()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_PollerLock);
+        if(!m_bPollerRunning)
+            return;
+        m_bPollerRunning = false;
+    }
+    m_PollerCond.notify_all();
+    if(m_PollerThread.joinable())
+        m_PollerThread.join();
+}
 
-    nStatus = getStatus(DRIVE_PROT_STATUS_O);
-    fprintf(Logfile, "[%s] CAMCDrive::isFindHomeComplete DRIVE_PROT_STATUS = %04Xf\n", timestamp, nStatus);
+/*
+ Poll the status and position, as often as the scheduler says.
+ The velocity is measured from the successive positions, the drive doesn't
+ give us one.
+ */
+void CAMCDrive::pollerThread()
+{
+    StatusSnapshot status;
+    StatusSnapshot lastStatus;
+    double dVelocity = 0;
+    int nDelayMs;
+    int nGotoDueMs;
+    std::unique_lock<std::mutex> lock(m_PollerLock);
+
+    memset(&lastStatus, 0, sizeof(StatusSnapshot));
+    while(m_bPollerRunning) {
+        m_bPollNow = false;
+        lock.unlock();
+        getStatusSnapshot(status, true);
+        m_nPollCount++;
+        if(status.bPositionValid && lastStatus.bPositionValid && status.nTimeStampMs > lastStatus.nTimeStampMs)
+            dVelocity = ticksDistance(lastStatus.nTicks, status.nTicks) * 1000.0 / (status.nTimeStampMs - lastStatus.nTimeStampMs);
+        if(status.bZeroVelocity)
+            dVelocity = 0;
+        if(status.bPositionValid)
+            lastStatus = status;
+        if(m_bTracking)
+            trackingStep(status);
+        nGotoDueMs = flushPendingGoto();
+        nDelayMs = nextPollDelay(status, dVelocity);
+        // back in time to send a held retarget
+        if(nGotoDueMs && nGotoDueMs < nDelayMs)
+            nDelayMs = nGotoDueMs;
+        m_nNextPollMs = nDelayMs;
+        lock.lock();
+        m_PollerCond.wait_for(lock, std::chrono::milliseconds(nDelayMs), [this] { return !m_bPollerRunning || (!m_nPollPeriodMs && !m_bTracking && !isStopPending()) || m_bPollNow; });
+        // polling only for the tracking or an abort's stop and it's over, don't go
+        // round again until stopPoller, setPollPeriod, startTracking or the next abort
+        m_PollerCond.wait(lock, [this] { return !m_bPollerRunning || m_nPollPeriodMs || m_bTracking || isStopPending(); });
+    }
+    m_nNextPollMs = 0;
+}
 
-    nStatus = getStatus(SYS_PROT_STATUS_O);
-    fprintf(Logfile, "[%s] CAMCDrive::isFindHomeComplete SYS_PROT_STATUS = %04Xf\n", timestamp, nStatus);
+/*
+ When to poll next, in ms :
+ - right after a motion command, and while a goto is about to arrive, as often as we can (MIN_POLL_PERIOD)
+ - during a goto, after POLL_ARRIVAL_SHARE of the time to target at the measured velocity,
+   never more than m_nPollPeriodMs
+ - during any other motion, every m_nPollPeriodMs
+ - when the dome is idle, every POLL_IDLE_PERIOD
+ - while tracking, every TRACK_UPDATE_MS
+ - after an abort until zero velocity, as often as we can (see isStopPending)
+ */
+int CAMCDrive::nextPollDelay(const StatusSnapshot &status, double dVelocity)
+{
+    int nPeriodMs = m_nPollPeriodMs;
+    int nDelayMs;
+    int nCmd = m_nMotionCmd;
+    bool bMoving;
+
+    if(isStopPending())
+        return MIN_POLL_PERIOD;
+
+    if(m_bTracking)
+        return TRACK_UPDATE_MS;
+
+    if(!status.bValid)
+        return nPeriodMs;
+
+    bMoving = !status.bZeroVelocity || (status.bHoming && !status.bHomingComplete);
+    if(!bMoving) {
+        // a goto or home that hasn't started yet
+        if((nCmd == GOTO || nCmd == HOME) && status.nMotionGeneration == m_nMotionGeneration &&
+           monotonicMs() - m_nMotionCmdMs < (uint64_t)(MOTION_START_TIMEOUT * 1000))
+            return MIN_POLL_PERIOD;
+        return nPeriodMs > POLL_IDLE_PERIOD ? nPeriodMs : POLL_IDLE_PERIOD;
+    }
 
-    nStatus = getStatus(STATUS_1_O);
-    fprintf(Logfile, "[%s] CAMCDrive::isFindHomeComplete STATUS_1 = %04Xf\n", timestamp, nStatus);
+    if(nCmd != GOTO || !status.bPositionValid || dVelocity <= 0)
+        return nPeriodMs;
 
-    nStatus = getStatus(STATUS_1_O);
-    fprintf(Logfile, "[%s] CAMCDrive::isFindHomeComplete STATUS_1 = %04Xf\n", timestamp, nStatus);
+    nDelayMs = (int)(ticksDistance(status.nTicks, (uint32_t)m_nMotionTarget) * 1000.0 / dVelocity * POLL_ARRIVAL_SHARE);
+    if(nDelayMs < MIN_POLL_PERIOD)
+        nDelayMs = MIN_POLL_PERIOD;
+    if(nDelayMs > nPeriodMs)
+        nDelayMs = nPeriodMs;
+    return nDelayMs;
+}
 
-    nStatus = getStatus(STATUS_1_O);
-    fprintf(Logfile, "[%s] CAMCDrive::isFindHomeComplete STATUS_1 = %04Xf\n", timestamp, nStatus);
+uint16_t CAMCDrive::getStatus(unsigned char cStatus)
+{
+    int nErr = OK;
+    unsigned char cmdBuf[FRAME_HEADER_LEN];
+    unsigned char szResp[MAX_FRAME_LEN];
+    int nCmdLen;
+    uint16_t nStatus;
+
+    // the offset is only known at run time, no precomputed header for this one
+    nCmdLen = buildReadFrame(cmdBuf, STATUS_I, cStatus, STATUS_L);
 
-    nStatus = getStatus(STATUS_2_O);
-    fprintf(Logfile, "[%s] CAMCDrive::isFindHomeComplete STATUS_2 = %04Xf\n", timestamp, nStatus);
+    if(m_Log.isEnabled(AMC_LOG_TRACE))
+        m_Log.outFrame(cmdBuf, nCmdLen, "CAMCDrive::getStatus %02x sending : ", cStatus);
+
+    nErr = domeCommand(cmdBuf, nCmdLen, szResp, MAX_FRAME_LEN);
+    if(nErr)
+        return false;
 
-    nStatus = getStatus(STATUS_3_O);
-    fprintf(Logfile, "[%s] CAMCDrive::isFindHomeComplete STATUS_3 = %04Xf\n", timestamp, nStatus);
-    fflush(Logfile);
+    memcpy(&nStatus, szResp+8, 2);
+    if(m_Log.isEnabled(AMC_LOG_TRACE))
+        m_Log.out("CAMCDrive::getStatus nStatus : %04x\n", nStatus);
+
+    return nStatus;
+}
+
+/*
+ Log the protection words when a fault or limit bit comes up or goes away,
+ not at every poll. The poller and the X2 thread both get here, the exchange
+ makes sure only one of them logs a change.
+ */
+void CAMCDrive::logStatusFaults(const StatusSnapshot &status)
+{
+    uint32_t nFaultBits;
+
+    nFaultBits = (uint32_t)(status.nDriveProtStatus & DRIVE_FAULT_MASK) | (uint32_t)(status.nSysProtStatus & SYS_FAULT_MASK) << 16;
+    if(status.bPositiveStop || status.bNegativeStop || status.bFollowingError || status.bTargetLimit)
+        nFaultBits |= 0x80000000;
+    if(m_nLastFaultBits.exchange(nFaultBits) == nFaultBits)
+        return;
+    if(m_Log.isEnabled(AMC_LOG_ERROR))
+        m_Log.out("CAMCDrive::logStatusFaults bridge %04X, drive protection %04X, system protection %04X, status 1 %04X, status 2 %04X\n",
+                  status.nBridgeStatus, status.nDriveProtStatus, status.nSysProtStatus, status.nStatus1, status.nStatus2);
+}
+
+void CAMCDrive::logAllStatusReg(const StatusSnapshot &status)
+{
+    m_Log.out("CAMCDrive::logAllStatusReg DRIVE_BRIDGE_STATUS = %04X\n", status.nBridgeStatus);
+    m_Log.out("CAMCDrive::logAllStatusReg DRIVE_PROT_STATUS = %04X\n", status.nDriveProtStatus);
+    m_Log.out("CAMCDrive::logAllStatusReg SYS_PROT_STATUS = %04X\n", status.nSysProtStatus);
+    m_Log.out("CAMCDrive::logAllStatusReg STATUS_1 = %04X\n", status.nStatus1);
+    m_Log.out("CAMCDrive::logAllStatusReg STATUS_2 = %04X\n", status.nStatus2);
+    m_Log.out("CAMCDrive::logAllStatusReg STATUS_3 = %04X\n", status.nStatus3);
 
 }
-#endif
 
 
 #pragma mark - helper fucntions
@@ -1781,18 +2652,4 @@ int CAMCDrive::parseFields(char *pszResp, std::vector<std::string> &svFields, ch
     return nErr;
 }
 
-#ifdef LOG_DEBUG
-
-void CAMCDrive::hexdump(const unsigned char* pszInputBuffer, unsigned char *pszOutputBuffer, int nInputBufferSize, int nOutpuBufferSize)
-{
-    unsigned char *pszBuf = pszOutputBuffer;
-    int nIdx=0;
-
-    memset(pszOutputBuffer, 0, nOutpuBufferSize);
-    for(nIdx=0; nIdx < nInputBufferSize && pszBuf < (pszOutputBuffer + nOutpuBufferSize -3); nIdx++){
-        snprintf((char *)pszBuf,4,"%02X ", pszInputBuffer[nIdx]);
-        pszBuf+=3;
-    }
-}
-#endif
 
@@ -28,6 +28,11 @@
 #include <vector>
 #include <sstream>
 #include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
 
 // SB includes
 #include "../../licensedinterfaces/sberrorx.h"
@@ -36,6 +41,14 @@
 #include "../../licensedinterfaces/loggerinterface.h"
 
 #include "StopWatch.h"
+#include "AMCTransport.h"
+#include "AMCFrameDecoder.h"
+#include "AMCRegisters.h"
+#include "SeqLock.h"
+#include "LinkArbiter.h"
+#include "AMCLog.h"
+#include "AMCCapture.h"
+#include "AMCStats.h"
 
 // CRC16 stuff
 extern "C"
@@ -47,9 +60,6 @@ extern "C"
 #define MAX_TIMEOUT 1000
 #define LOG_BUFFER_SIZE 2048
 
-#define LOG_DEBUG
-
-#ifdef LOG_DEBUG
 #if defined(SB_WIN_BUILD)
 #define AMC_LOGFILENAME "C:\\AMCDriveLog.txt"
 #elif defined(SB_LINUX_BUILD)
@@ -57,102 +67,115 @@ extern "C"
 #elif defined(SB_MAC_BUILD)
 #define AMC_LOGFILENAME "/tmp/AMCDriveLog.txt"
 #endif
-#endif
 
-// header define
-#define SOF         0xA5
-#define DA          0x3F
-#define CB_WRITE    0x02
-#define CB_READ     0x01
-
-// gain write access
-#define WR_ACCESS_I 0x07
-#define WR_ACCESS_O 0x00
-#define WR_ACCESS_L 0x01
-#define WR_ACCESS_D 0x000F
-
-// Section 2.3.1 page 142 01h: Control Parameters
-// bridge access
-#define BRIDGE_I 0x01
-#define BRIDGE_O 0x00
-#define BRIDGE_L 0x01
-// enable bridge
-#define EN_BRIDGE_D 0x0000
-// disable bridge
-#define DIS_BRIDGE_D 0x0001
-
-// goto position
-#define GOTO_I  0x45
-#define GOTO_O  0x00
-#define GOTO_L  0x02
-
-// get position
-#define POS_I  0x12
-#define POS_O  0x00
-#define POS_L  0x02
-
-// get prod info
-#define PI_I  0x8C
-#define PI_O  0x00
-#define PI_L  0x31
-
-// get firmware
-#define FW_I  0x0B
-#define FW_O  0x00
-#define FW_L  0x80
-
-// Section 2.3.1 page 142 01h: Control Parameters
-// Home
-#define HOME_I 0x01
-#define HOME_O 0x00
-#define HOME_L 0x01
-#define HOME_D 0x0020
-
-// Stop
-#define STOP_I 0x01
-#define STOP_O 0x00
-#define STOP_L 0x01
-#define STOP_D 0x0040
-
-// reset events
-#define RST_EVT_I 0x01
-#define RST_EVT_O 0x00
-#define RST_EVT_L 0x01
-#define RST_EVT_D  0x1000
-
-// Sync
-#define SYNC_I 0x01
-#define SYNC_O 0x00
-#define SYNC_L 0x01
-#define SYNC_D 0x0008
-
-#define SET_POSITION_I  0x39
-#define SET_POSITION_O  0x00
-#define SET_POSITION_L  0x02
-
-// Section 2.3.3 Monitor Commands
-// Drive status
-#define STATUS_I    0x02
-#define DRIVE_BRIDGE_STATUS_O   0x00
-#define DRIVE_PROT_STATUS_O     0x01
-#define SYS_PROT_STATUS_O       0x02
-#define STATUS_1_O  0x03
-#define STATUS_2_O  0x04
-#define STATUS_3_O  0x05
-#define STATUS_L    0x01
-
-// page 155, TABLE 2.12 Drive Status Bit-field Definitions
-#define HOMING      0x1000
-#define IN_HOME_POSITION  0x040
-#define HOMING_COMPLETE  0x4000
-#define MOVING      0x0001
-#define POS_REACHED 0x0002
+// Drive status block, index 0x02 offsets 0 to 5 read in one frame
+struct StatusSnapshot {
+    uint16_t    nBridgeStatus;
+    uint16_t    nDriveProtStatus;
+    uint16_t    nSysProtStatus;
+    uint16_t    nStatus1;
+    uint16_t    nStatus2;
+    uint16_t    nStatus3;
+    // STATUS_2 bits, TABLE 2.12
+    bool        bZeroVelocity;
+    bool        bPosReached;
+    bool        bInHomePosition;
+    bool        bHoming;
+    bool        bHomingComplete;
+    // DRIVE_BRIDGE_STATUS
+    bool        bBridgeEnabled;
+    bool        bPositiveStop;          // limit switches
+    bool        bNegativeStop;
+    bool        bTorqueInhibit;
+    // faults and limits from the rest of the block, the raw words above have the details
+    bool        bDriveFault;            // DRIVE_PROT_STATUS & DRIVE_FAULT_MASK
+    bool        bSystemFault;           // SYS_PROT_STATUS & SYS_FAULT_MASK
+    bool        bDisabled;              // STATUS_1 software or user disable
+    bool        bCurrentLimiting;
+    bool        bFollowingError;        // STATUS_2 position or velocity
+    bool        bTargetLimit;           // STATUS_2 max or min target position limit
+    bool        bValid;
+    // position read in the same batch
+    bool        bPositionValid;
+    uint32_t    nTicks;
+    double      dAz;
+    // when it was taken
+    uint64_t    nTimeStampMs;
+    uint32_t    nMotionGeneration;
+};
 
 // error codes
 // Error code
-enum AMCDriveErrors {OK = 0, NOT_CONNECTED, CANT_CONNECT, BAD_CMD_RESPONSE, COMMAND_FAILED};
+enum AMCDriveErrors {OK = 0, NOT_CONNECTED, CANT_CONNECT, BAD_CMD_RESPONSE, COMMAND_FAILED, BAD_CRC, LINK_TIMEOUT, MOTION_CANCELLED};
 enum AMCDriveShutterState {OPEN = 1, OPENING, CLOSED, CLOSING, SHUTTER_ERROR};
-enum AMCDriveCmd {NONE = 0, GOTO, HOME, STOP};
+enum AMCDriveCmd {NONE = 0, GOTO, HOME, STOP, TRACK};
+enum AMCRequestState {REQ_PENDING = 0, REQ_IN_FLIGHT, REQ_DONE};
+enum AMCBridgeState {BRIDGE_UNKNOWN = 0, BRIDGE_IS_ENABLED, BRIDGE_IS_DISABLED};
+
+// Requests pipelining, how many requests we write before waiting for the first reply
+#define DEF_MAX_IN_FLIGHT   4
+#define MAX_IN_FLIGHT       8   // must stay below 16, the sequence number is only 4 bits
+#define MAX_CRC_RETRIES     1   // a request whose reply fails its CRC is sent again this many times
+#define IN_FLIGHT_RESTORE_AFTER 50  // clean transactions in stop-and-wait before we pipeline again
+
+// How long a request waits for the link before giving up with LINK_TIMEOUT, ms, 0 = no limit
+#define LINK_DEADLINE_SAFETY    0
+#define LINK_DEADLINE_MOTION    2000
+#define LINK_DEADLINE_TELEMETRY 1000
+
+// What dapiGetAzEl needs, published through a seqlock so readers never block
+struct DomeState {
+    double      dAz;
+    double      dEl;
+    uint32_t    nTicks;
+    int         nShutterState;
+    bool        bHomed;
+    bool        bParked;
+    bool        bValid;             // we have read the position at least once
+    uint64_t    nTimeStampMs;       // when the position was read
+};
+
+// Telemetry poller
+#define MIN_POLL_PERIOD         50      // ms
+#define DEF_SNAPSHOT_MAX_AGE    500     // ms, older snapshots are not used
+#define POLL_IDLE_PERIOD        2000    // ms, heartbeat when the dome isn't moving
+#define POLL_ARRIVAL_SHARE      0.5     // during a goto, poll again after this share of the predicted time to target
+#define STOP_WATCH_MS           10000   // ms, after an abort poll fast until zero velocity, at most this long
+
+// Motion detection, see isDomeMoving
+#define MOTION_START_TIMEOUT    1.0     // s, how long we wait for a goto or home to show up in the status
+#define DEF_SETTLE_ARCMIN       1.0     // settled when it moved less than this since the previous read
+
+// Gotos, see gotoTargetTicks
+#define MIN_CABLE_WRAP_LIMIT    180.0   // deg, so every azimuth stays reachable
+#define DEF_GOTO_TOLERANCE_ARCMIN   60.0    // a goto or park is done this close to the target
+#define MAX_GOTO_TOLERANCE_ARCMIN   600.0   // past that a goto could be "done" before the slit is on the target
+#define RETARGET_COALESCE_MS    250     // a goto this soon after the previous one, while it's under way, is held, the poller sends the latest
+
+// Tracking, see trackingStep
+#define TRACK_UPDATE_MS         50      // ms, the target must move before the dome gets to it or it stops
+#define TRACK_LEAD              0.2     // s, how far ahead of the slit the target is kept
+#define TRACK_CORRECTION_GAIN   0.5     // share of the measured position error taken out at each update
+#define TRACK_MAX_CORRECTION    0.9     // of the lead, so the target stays ahead of the dome
+
+struct TrackingStats {
+    int         nUpdates;           // targets sent to the drive
+    int         nSamples;           // positions compared with where the slit should be
+    double      dMeanError;         // deg
+    double      dMaxError;          // deg
+};
+
+// one request and its response buffer for domeTransaction
+struct AMCRequest {
+    const unsigned char *pCmd;
+    int             nCmdSize;
+    unsigned char   *pResp;
+    int             nRespMaxLen;
+    int             nErr;
+    int             nState;
+    int             nRetries;   // retransmits after a CRC error
+    uint64_t        nSentNs;    // for the wire capture and the latency histograms
+};
 
 class CAMCDrive
 {
@@ -164,7 +187,9 @@ public:
     void        Disconnect(void);
     bool        IsConnected(void) { return m_bIsConnected; }
 
-    void        setSerxPointer(SerXInterface *p) { m_pSerx = p; }
+    void        setSerxPointer(SerXInterface *p) { m_SerXTransport.setSerxPointer(p); m_pTransport = &m_SerXTransport; }
+    // anything else than the SerX port (simulator, replay), must be set before Connect
+    void        setTransport(CAMCTransport *pTransport) { m_pTransport = pTransport; }
     void        setSleeprPinter(SleeperInterface *p) {m_pSleeper = p; }
     void        setLogger(LoggerInterface *pLogger) { m_pLogger = pLogger; };
 
@@ -191,6 +216,19 @@ public:
     int isCalibratingComplete(bool &bComplete);
 
     int abortCurrentCommand();
+    // ms, of the last abort : until the drive acknowledged the STOP, and until
+    // a status read showed zero velocity. -1 until measured.
+    int getStopCommandLatency() { return m_nStopCommandMs; }
+    int getStopLatency() { return m_nStopLatencyMs; }
+
+    // how long each request class (AMCRequestClass) waited for the link
+    void getLinkStats(int nClass, LinkClassStats &stats) { m_LinkArbiter.getStats(nClass, stats); }
+    void resetLinkStats() { m_LinkArbiter.resetStats(); }
+
+    // per register latency histograms and error counters, see AMCStats.h
+    CAMCStats &getStats() { return m_Stats; }
+    int dumpStats();
+    const std::string &getStatsPath() { return m_sStatsPath; }
 
     // getter/setter
     int getNbTicksPerRev();
@@ -202,12 +240,45 @@ public:
     double getParkAz();
     int setParkAz(double dAz);
 
+    double getCableWrapLimit();
+    void setCableWrapLimit(double dDegrees);
+
+    double getGotoTolerance();
+    void setGotoTolerance(double dArcmin);
+    int getRetargetCount() { return m_nRetargets; }
+    int getCoalescedGotoCount() { return m_nCoalescedGotos; }
+
     double getCurrentAz();
     double getCurrentEl();
 
     int getCurrentShutterState();
 
     void setDebugLog(bool bEnable);
+    void setLogLevel(int nLevel);
+    int  getLogLevel();
+    void setWireCapture(bool bEnable);
+    bool getWireCapture();
+
+    // lock free, safe to call from any thread
+    void getDomeState(DomeState &state);
+    bool isDomeStateFresh(const DomeState &state);
+
+    int getMaxRequestsInFlight() { return m_nMaxInFlight; }
+    void setMaxRequestsInFlight(int nMaxInFlight);
+
+    // the dome follows dAz + dRate * t (deg, deg/s) until stopTracking or
+    // another motion command, the background poller moves it along
+    int startTracking(double dAz, double dRate);
+    void stopTracking();
+    bool isTracking() { return m_bTracking; }
+    void getTrackingStats(TrackingStats &stats);
+
+    // background status/position poller, 0 = off
+    int getPollPeriod() { return m_nPollPeriodMs; }
+    void setPollPeriod(int nPeriodMs);
+    uint32_t getPollCount() { return m_nPollCount; }
+    int getSnapshotMaxAge() { return m_nSnapshotMaxAgeMs; }
+    void setSnapshotMaxAge(int nMaxAgeMs);
 /*
 #if defined(SB_LINUX_BUILD) || defined(SB_MAC_BUILD)
     static void threadCallback(void *param);
@@ -223,27 +294,68 @@ protected:
     int             getShutterState(int &state);
     int             getDomeTicksPerRev(int &ticksPerRev);
 
-    bool            isDomeMoving();
-    bool            isDomeAtHome();
+    bool            isDomeMoving(StatusSnapshot &status);
+    bool            isDomeAtHome(const StatusSnapshot &status);
     int             gainWriteAccess();
-    int             enableBridge();
+    int             enableBridge(const uint32_t *pCancelGeneration = NULL);
     int             disableBridge();
-
-    int             domeCommand(const unsigned char *cmd, int nCmdSize, unsigned char *result, int resultMaxLen);
-    int             readResponse(unsigned char *respBuffer, int bufferLen);
+    void            setBridgeState(int nState);
+    void            confirmBridgeState(int nBridgeState, const StatusSnapshot &status);
+
+    int             domeCommand(const unsigned char *cmd, int nCmdSize, unsigned char *result, int resultMaxLen, const uint32_t *pCancelGeneration = NULL);
+    int             domeTransaction(AMCRequest *pRequests, int nNbRequests, const uint32_t *pCancelGeneration = NULL);
+    static int      requestClass(const unsigned char *pCmd);
+    int             buildReadFrame(unsigned char *cmdBuf, unsigned char cIndex, unsigned char cOffset, unsigned char cLen);
+    int             readResponse(unsigned char *respBuffer, int bufferLen, CStopWatch &frameTimer);
+    int             checkResponse(const unsigned char *respBuffer, uint16_t nDataCRC);
+    int             fillRxDecoder(CStopWatch &frameTimer);
+    void            dropStaleFrames();
     int             parseFields(char *pszResp, std::vector<std::string> &svFields, char cSeparator);
-    bool            isPositionReached();
+    bool            isPositionReached(const StatusSnapshot &status);
     uint16_t        getStatus(unsigned char cStatus);
+    int             getStatusSnapshot(StatusSnapshot &status, bool bWithPosition);
+
+    void            publishPosition(uint32_t nTicks, double dAz, uint64_t nTimeStampMs);
+    void            publishFlags();
+    void            setHomed(bool bHomed);
+    void            setParked(bool bParked);
+    void            setShutterOpened(bool bOpened);
+
+    void            motionCommandSent(int nCmd = NONE, int nTargetTicks = 0);
+    bool            isAtAzimuth(uint32_t nTicks, double dAz);
+    int             ticksDistance(uint32_t nFrom, uint32_t nTo);
+    void            publishSnapshot(const StatusSnapshot &status);
+    bool            getFreshSnapshot(StatusSnapshot &status);
+    void            startPoller();
+    void            stopPoller();
+    void            wakePoller();
+    void            pollerThread();
+    int             nextPollDelay(const StatusSnapshot &status, double dVelocity);
+    void            trackingStep(const StatusSnapshot &status);
+    bool            endTracking();
+    void            noteStopped(uint64_t nTimeStampMs);
+    bool            isStopPending();
+    int             sendTrackTarget(int nTicks, uint32_t nCancelGeneration);
+    static uint64_t monotonicMs();
     int             getFirmwareVersion(char *szVersion, int nStrMaxLen);
     int             getProductInformation(char *szProdInfo, int nStrMaxLen);
 
     void            AzToTicks(double pdAz, int &ticks);
     void            TicksToAz(int ticks, double &pdAz);
-    int             gotoTicksPosition(int ticks);
+    int             sendGoto(const uint32_t *pCancelGeneration = NULL);
+    bool            isGotoPending(int &nErr);
+    bool            isGotoUnderway();
+    int             flushPendingGoto();
+    void            cancelPendingGoto();
+    int             gotoTargetTicks(double dAz, int &nTargetTicks);
+    int             nearestTicks(double dAz, int32_t nFromTicks, bool bWrapLimit = true);
+    int             currentTicks(int32_t &nTicks);
+    int             gotoTicksPosition(int ticks, const uint32_t *pCancelGeneration = NULL);
     int             syncTicksPosition(int ticks);
     int             resetEvents();
     
-    SerXInterface   *m_pSerx;
+    CAMCTransport   *m_pTransport;
+    CSerXTransport  m_SerXTransport;
     SleeperInterface *m_pSleeper;
     LoggerInterface *m_pLogger;
     
@@ -258,9 +370,16 @@ protected:
     int             m_nNbTicksPerRev;
     double          m_dHomeAz;
     double          m_dParkAz;
+    double          m_dCableWrapLimit;  // deg from home either way, 0 for none
     double          m_dCurrentAzPosition;
     double          m_dCurrentElPosition;
     double          m_dGotoAz;
+    std::atomic<bool> m_bGotoPending;   // a retarget held by gotoAzimuth
+    // m_dGotoAz, m_bGotoPending and sending the held retarget, the poller sends it too
+    std::mutex      m_GotoLock;
+    uint32_t        m_nGotoCancelGeneration;    // m_nCancelGeneration when it was held
+    std::atomic<int> m_nRetargets;      // gotos sent while the dome was going to another target
+    std::atomic<int> m_nCoalescedGotos; // retargets replaced by a later one before they were sent
 
     float           m_fVersion;
 
@@ -275,18 +394,73 @@ protected:
     bool            m_goto_find_home;
     CStopWatch      timer;
 
-    unsigned char   m_cSeqNumber;
+    // motion tracking for isDomeMoving, reset by motionCommandSent
+    std::atomic<int> m_nMotionCmd;      // AMCDriveCmd, the poller reads it too
+    std::atomic<int> m_nMotionTarget;   // ticks, for a GOTO
+    std::atomic<uint64_t> m_nMotionCmdMs;   // when it was sent, monotonicMs
+    bool            m_bMotionStarted;   // the drive reported the move
+    bool            m_bHaveMotionTicks;
+    uint32_t        m_nMotionTicks;     // position at the previous read
+    int             m_nSettleTicks;
+    double          m_dGotoTolerance;   // arcmin
+    int             m_nGotoToleranceTicks;
+
+    std::atomic<unsigned char> m_cSeqNumber;
+    CAMCFrameDecoder m_RxDecoder;
+    int             m_nMaxInFlight;     // configured
+    int             m_nInFlightLimit;   // what domeTransaction uses, 1 after a timeout with requests in flight
+    int             m_nCleanTransactions;   // since that timeout
+    CLinkArbiter    m_LinkArbiter;      // who gets the link next, see domeTransaction
+    int             m_nLinkDeadlineMs[REQ_NB_CLASSES];
+    std::mutex      m_IOLock;           // taken once the arbiter gave us the link
+    // what we last commanded or read back, in the low 2 bits. The rest counts
+    // bridge commands so a status read that raced one can't overwrite it.
+    std::atomic<int> m_nBridgeState;
+
+    // telemetry poller and its cached snapshot
+    std::thread     m_PollerThread;
+    std::mutex      m_PollerLock;
+    std::condition_variable m_PollerCond;
+    std::atomic<bool> m_bPollerRunning;
+    std::atomic<int> m_nPollPeriodMs;   // the slowest poll while moving
+    std::atomic<int> m_nNextPollMs;     // what the poller scheduled after its last snapshot
+    std::atomic<bool> m_bPollNow;       // a motion command was sent, poll right away
+    std::atomic<uint32_t> m_nPollCount;
+
+    // abort latency, see abortCurrentCommand
+    std::atomic<uint64_t> m_nStopSentMs;    // 0 once zero velocity was seen
+    std::atomic<int> m_nStopCommandMs;
+    std::atomic<int> m_nStopLatencyMs;
+
+    // tracking, the poller thread updates the target under m_TrackLock
+    std::atomic<bool> m_bTracking;
+    std::mutex      m_TrackLock;
+    double          m_dTrackAz;         // deg, at m_nTrackStartMs
+    double          m_dTrackRate;       // deg/s
+    uint64_t        m_nTrackStartMs;
+    double          m_dTrackCorrection; // deg, added to the target
+    double          m_dTrackErrorSum;
+    TrackingStats   m_TrackStats;
+    int             m_nSnapshotMaxAgeMs;
+    std::atomic<uint32_t> m_nMotionGeneration;
+    // bumped by an abort and by the end of tracking, a poller write decided
+    // before that is dropped, see domeTransaction
+    std::atomic<uint32_t> m_nCancelGeneration;
+    std::mutex      m_CacheLock;
+    StatusSnapshot  m_CachedStatus;
+
+    CSeqLock<DomeState> m_DomeState;
 
-#ifdef LOG_DEBUG
     std::string m_sLogfilePath;
-    // timestamp for logs
-    char *timestamp;
-    time_t ltime;
-    FILE *Logfile;	  // LogFile
-
-    void            getAllStatusReg();
-    void            hexdump(const unsigned char* pszInputBuffer, unsigned char *pszOutputBuffer, int nInputBufferSize, int nOutpuBufferSize);
-#endif
+    CAMCLog     m_Log;
+    std::string m_sCapturePath;
+    CAMCCapture m_Capture;      // written under m_IOLock
+    std::string m_sStatsPath;
+    CAMCStats   m_Stats;
+
+    void            logAllStatusReg(const StatusSnapshot &status);
+    void            logStatusFaults(const StatusSnapshot &status);
+    std::atomic<uint32_t> m_nLastFaultBits; // so logStatusFaults only logs changes, from either thread
 };
 
 #endif
@@ -0,0 +1,181 @@
+//
+//  AMCFrameDecoder.cpp
+//  AMCDrive X2 plugin
+//
+
+#include "AMCFrameDecoder.h"
+
+CAMCFrameDecoder::CAMCFrameDecoder()
+{
+    reset();
+    m_ulDiscardedBytes = 0;
+}
+
+void CAMCFrameDecoder::reset()
+{
+    m_nHead = 0;
+    m_nCount = 0;
+    m_DataCRC.reset();
+    m_nDataCRCBytes = 0;
+    m_nLastDataCRC = 0;
+    memset(m_cRing, 0, RX_RING_SIZE);
+}
+
+/*
+ Append raw bytes from the port. Returns the number of bytes stored, if the
+ ring is full the extra bytes are counted as discarded.
+ */
+int CAMCFrameDecoder::push(const unsigned char *pData, int nLen)
+{
+    int nIdx;
+    int nStored = 0;
+
+    for(nIdx = 0; nIdx < nLen && m_nCount < RX_RING_SIZE; nIdx++) {
+        m_cRing[(m_nHead + m_nCount) & RX_RING_MASK] = pData[nIdx];
+        m_nCount++;
+        nStored++;
+    }
+    m_ulDiscardedBytes += (nLen - nStored);
+    return nStored;
+}
+
+/*
+ Copy the next complete frame to pFrame and return its length.
+ Returns 0 if we need more data.
+ */
+int CAMCFrameDecoder::nextFrame(unsigned char *pFrame, int nMaxLen)
+{
+    int nIdx;
+    int nFrameLen;
+    unsigned char cHeader[FRAME_HEADER_LEN];
+
+    while(hunt()) {
+        for(nIdx = 0; nIdx < FRAME_HEADER_LEN; nIdx++)
+            cHeader[nIdx] = peek(nIdx);
+        nFrameLen = frameLength(cHeader);
+        feedDataCRC(nFrameLen);
+
+        if(nFrameLen > nMaxLen) {
+            // valid on the wire but the caller can't take it, skip it whole.
+            if(m_nCount < nFrameLen)
+                return 0;
+            m_ulDiscardedBytes += nFrameLen;
+            drop(nFrameLen);
+            continue;
+        }
+
+        if(m_nCount < nFrameLen)
+            return 0;
+
+        for(nIdx = 0; nIdx < nFrameLen; nIdx++)
+            pFrame[nIdx] = peek(nIdx);
+        m_nLastDataCRC = m_DataCRC.value();
+        drop(nFrameLen);
+        return nFrameLen;
+    }
+    return 0;
+}
+
+/*
+ Number of bytes we still need before the current frame (or at least its
+ header) is complete. Lets the caller read exactly that much from the port.
+ */
+int CAMCFrameDecoder::bytesNeeded()
+{
+    int nIdx;
+    unsigned char cHeader[FRAME_HEADER_LEN];
+
+    if(!hunt())
+        return FRAME_HEADER_LEN - m_nCount;
+
+    for(nIdx = 0; nIdx < FRAME_HEADER_LEN; nIdx++)
+        cHeader[nIdx] = peek(nIdx);
+
+    if(m_nCount >= frameLength(cHeader))
+        return 0;
+    return frameLength(cHeader) - m_nCount;
+}
+
+/*
+ Total frame length from the header : header, data words and data CRC.
+ There is no data CRC when there is no data.
+ */
+int CAMCFrameDecoder::frameLength(const unsigned char *pHeader)
+{
+    int nDataLen = pHeader[5] * 2;
+
+    if(!nDataLen)
+        return FRAME_HEADER_LEN;
+    return FRAME_HEADER_LEN + nDataLen + FRAME_CRC_LEN;
+}
+
+/*
+ Discard bytes until the ring starts with a SOF followed by a valid header :
+ a length we can actually get and a good header CRC.
+ Returns true when a full header is sitting at the head of the ring.
+ */
+bool CAMCFrameDecoder::hunt()
+{
+    int nIdx;
+    unsigned char cHeader[FRAME_HEADER_LEN];
+
+    while(m_nCount) {
+        if(peek(0) != FRAME_SOF) {
+            drop(1);
+            m_ulDiscardedBytes++;
+            continue;
+        }
+
+        if(m_nCount < FRAME_HEADER_LEN)
+            return false;
+
+        for(nIdx = 0; nIdx < FRAME_HEADER_LEN; nIdx++)
+            cHeader[nIdx] = peek(nIdx);
+
+        // the header CRC is sent MSB first
+        if(cHeader[5] > MAX_RESPONSE_WORDS ||
+           CAMCCRC::xmodem(cHeader, 6) != ((cHeader[6] << 8) | cHeader[7])) {
+            // not a real header, resync on the next SOF
+            drop(1);
+            m_ulDiscardedBytes++;
+            continue;
+        }
+        return true;
+    }
+    return false;
+}
+
+void CAMCFrameDecoder::drop(int nLen)
+{
+    if(nLen > m_nCount)
+        nLen = m_nCount;
+    m_nHead = (m_nHead + nLen) & RX_RING_MASK;
+    m_nCount -= nLen;
+    // whatever is at the head now is a different frame
+    m_DataCRC.reset();
+    m_nDataCRCBytes = 0;
+}
+
+/*
+ Run the data CRC over the bytes of the frame at the head that came in since
+ the last call, so it's done by the time the last byte arrives. The ring can
+ wrap in the middle of the data, feed each contiguous part.
+ */
+void CAMCFrameDecoder::feedDataCRC(int nFrameLen)
+{
+    int nDataLen = nFrameLen > FRAME_HEADER_LEN ? nFrameLen - FRAME_HEADER_LEN - FRAME_CRC_LEN : 0;
+    int nAvailable = m_nCount - FRAME_HEADER_LEN;
+    int nPos;
+    int nChunk;
+
+    if(nAvailable > nDataLen)
+        nAvailable = nDataLen;
+    while(m_nDataCRCBytes < nAvailable) {
+        nPos = (m_nHead + FRAME_HEADER_LEN + m_nDataCRCBytes) & RX_RING_MASK;
+        nChunk = nAvailable - m_nDataCRCBytes;
+        if(nChunk > RX_RING_SIZE - nPos)
+            nChunk = RX_RING_SIZE - nPos;
+        m_DataCRC.update(m_cRing + nPos, (size_t)nChunk);
+        m_nDataCRCBytes += nChunk;
+    }
+}
@@ -0,0 +1,63 @@
+//
+//  AMCFrameDecoder.h
+//  AMCDrive X2 plugin
+//
+//  Streaming decoder for the A-M-C 0xA5 framed serial protocol.
+//  Raw bytes from the serial port are pushed in as they arrive and
+//  complete frames are handed back. Anything that doesn't start with a
+//  valid header is dropped byte by byte until we're back in sync.
+
+#ifndef __AMCFrameDecoder__
+#define __AMCFrameDecoder__
+
+#include <string.h>
+#include <stdint.h>
+
+#include "AMCCRC.h"
+
+// must be a power of 2
+#define RX_RING_SIZE        4096
+#define RX_RING_MASK        (RX_RING_SIZE - 1)
+
+// frame layout
+#define FRAME_SOF           0xA5
+#define FRAME_HEADER_LEN    8   // SOF, DA, CB, S1/Index, S2/Offset, Len, CRC (2 bytes)
+#define FRAME_CRC_LEN       2
+// largest block we ever read is the firmware (0x80 words), anything above that is garbage
+#define MAX_RESPONSE_WORDS  0x80
+#define MAX_FRAME_LEN       (FRAME_HEADER_LEN + MAX_RESPONSE_WORDS*2 + FRAME_CRC_LEN)
+
+class CAMCFrameDecoder
+{
+public:
+    CAMCFrameDecoder();
+
+    void            reset();
+    int             push(const unsigned char *pData, int nLen);
+    int             nextFrame(unsigned char *pFrame, int nMaxLen);
+    // data CRC we computed for the last frame nextFrame returned, 0 if it had no data
+    uint16_t        lastDataCRC() { return m_nLastDataCRC; }
+    int             bytesNeeded();
+    int             freeSpace() { return RX_RING_SIZE - m_nCount; }
+    int             bytesBuffered() { return m_nCount; }
+    unsigned long   discardedBytes() { return m_ulDiscardedBytes; }
+
+    static int      frameLength(const unsigned char *pHeader);
+
+protected:
+    bool            hunt();
+    void            drop(int nLen);
+    void            feedDataCRC(int nFrameLen);
+    unsigned char   peek(int nIdx) { return m_cRing[(m_nHead + nIdx) & RX_RING_MASK]; }
+
+    unsigned char   m_cRing[RX_RING_SIZE];
+    int             m_nHead;
+    int             m_nCount;
+    unsigned long   m_ulDiscardedBytes;
+    // running CRC of the data of the frame at the head of the ring
+    CAMCCRC         m_DataCRC;
+    int             m_nDataCRCBytes;
+    uint16_t        m_nLastDataCRC;
+};
+
+#endif
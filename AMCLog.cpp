@@ -0,0 +1,240 @@
+//
+//  AMCLog.cpp
+//  AMCDrive X2 plugin
+//
+//  Asynchronous debug log, see AMCLog.h
+
+#include <string.h>
+#include <time.h>
+#include <chrono>
+
+#include "AMCLog.h"
+
+CAMCLog::CAMCLog()
+{
+    uint64_t nIdx;
+
+    m_pSlots = new LogSlot[LOG_RING_SLOTS];
+    for(nIdx = 0; nIdx < LOG_RING_SLOTS; nIdx++)
+        m_pSlots[nIdx].nSeq.store(nIdx, std::memory_order_relaxed);
+    m_nEnqueuePos = 0;
+    m_nDequeuePos = 0;
+    m_nDropped = 0;
+    m_nDroppedReported = 0;
+    m_nLevel = AMC_LOG_OFF;
+    m_pFile = NULL;
+    m_bRunning = false;
+}
+
+CAMCLog::~CAMCLog()
+{
+    close();
+    delete [] m_pSlots;
+}
+
+bool CAMCLog::open(const char *pszPath)
+{
+    close();
+    m_pFile = fopen(pszPath, "w");
+    if(!m_pFile)
+        return false;
+    m_bRunning = true;
+    m_WriterThread = std::thread(&CAMCLog::writerThread, this);
+    return true;
+}
+
+/*
+ Stop the writer, what is still in the ring is written out first.
+ */
+void CAMCLog::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_WakeLock);
+        if(!m_bRunning)
+            return;
+        m_bRunning = false;
+    }
+    m_WakeCond.notify_all();
+    if(m_WriterThread.joinable())
+        m_WriterThread.join();
+    drain();
+    fclose(m_pFile);
+    m_pFile = NULL;
+}
+
+void CAMCLog::out(const char *pszFormat, ...)
+{
+    va_list args;
+
+    va_start(args, pszFormat);
+    vout(pszFormat, args);
+    va_end(args);
+}
+
+void CAMCLog::setLevel(int nLevel)
+{
+    if(nLevel < AMC_LOG_OFF)
+        nLevel = AMC_LOG_OFF;
+    if(nLevel > AMC_LOG_TRACE)
+        nLevel = AMC_LOG_TRACE;
+    m_nLevel.store(nLevel, std::memory_order_relaxed);
+}
+
+void CAMCLog::vout(const char *pszFormat, va_list args)
+{
+    LogSlot *pSlot;
+    int nLen;
+
+    pSlot = claimSlot();
+    if(!pSlot)
+        return;
+
+    nLen = vsnprintf(pSlot->szText, LOG_LINE_SIZE, pszFormat, args);
+    if(nLen < 0)
+        nLen = 0;
+    if(nLen >= LOG_LINE_SIZE) {
+        // truncated, keep the line terminated
+        nLen = LOG_LINE_SIZE - 1;
+        pSlot->szText[nLen - 1] = '\n';
+    }
+    publishSlot(pSlot, nLen);
+}
+
+void CAMCLog::outFrame(const unsigned char *pFrame, int nLen, const char *pszFormat, ...)
+{
+    static const char szHexDigits[] = "0123456789ABCDEF";
+    LogSlot *pSlot;
+    va_list args;
+    int nPos;
+    int nIdx;
+
+    pSlot = claimSlot();
+    if(!pSlot)
+        return;
+
+    va_start(args, pszFormat);
+    nPos = vsnprintf(pSlot->szText, LOG_LINE_SIZE, pszFormat, args);
+    va_end(args);
+    if(nPos < 0)
+        nPos = 0;
+    if(nPos > LOG_LINE_SIZE - 1)
+        nPos = LOG_LINE_SIZE - 1;
+
+    // 3 chars per byte, room is kept for the \n
+    for(nIdx = 0; nIdx < nLen && nPos + 3 < LOG_LINE_SIZE; nIdx++) {
+        pSlot->szText[nPos++] = szHexDigits[pFrame[nIdx] >> 4];
+        pSlot->szText[nPos++] = szHexDigits[pFrame[nIdx] & 0x0F];
+        pSlot->szText[nPos++] = ' ';
+    }
+    if(nPos > LOG_LINE_SIZE - 1)
+        nPos = LOG_LINE_SIZE - 1;
+    pSlot->szText[nPos++] = '\n';
+    publishSlot(pSlot, nPos);
+}
+
+/*
+ Claim the next slot of the ring, any thread can call this.
+ Returns NULL when the ring is full, we drop the line rather than wait on the writer.
+ */
+CAMCLog::LogSlot *CAMCLog::claimSlot()
+{
+    uint64_t nPos;
+    uint64_t nSeq;
+    int64_t nDiff;
+    LogSlot *pSlot;
+
+    if(!isOpen())
+        return NULL;
+
+    nPos = m_nEnqueuePos.load(std::memory_order_relaxed);
+    while(true) {
+        pSlot = &m_pSlots[nPos & (LOG_RING_SLOTS - 1)];
+        nSeq = pSlot->nSeq.load(std::memory_order_acquire);
+        nDiff = (int64_t)nSeq - (int64_t)nPos;
+        if(nDiff == 0) {
+            if(m_nEnqueuePos.compare_exchange_weak(nPos, nPos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if(nDiff < 0) {
+            m_nDropped.fetch_add(1, std::memory_order_relaxed);
+            return NULL;
+        }
+        else
+            nPos = m_nEnqueuePos.load(std::memory_order_relaxed);
+    }
+
+    pSlot->nTimeUs = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    return pSlot;
+}
+
+/*
+ Hand a filled slot to the writer. nSeq of a claimed slot is its ring position.
+ */
+void CAMCLog::publishSlot(LogSlot *pSlot, int nLen)
+{
+    pSlot->nLen = nLen;
+    pSlot->nSeq.store(pSlot->nSeq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void CAMCLog::writerThread()
+{
+    std::unique_lock<std::mutex> lock(m_WakeLock);
+
+    while(m_bRunning) {
+        m_WakeCond.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_PERIOD));
+        lock.unlock();
+        drain();
+        lock.lock();
+    }
+}
+
+/*
+ Write out everything that's been published since last time, flushed once.
+ Writer thread only (or after it's stopped).
+ */
+int CAMCLog::drain()
+{
+    LogSlot *pSlot;
+    uint64_t nDropped;
+    int nLines = 0;
+
+    while(true) {
+        pSlot = &m_pSlots[m_nDequeuePos & (LOG_RING_SLOTS - 1)];
+        if(pSlot->nSeq.load(std::memory_order_acquire) != m_nDequeuePos + 1)
+            break;
+        writeTimeStamp(pSlot->nTimeUs);
+        fwrite(pSlot->szText, 1, (size_t)pSlot->nLen, m_pFile);
+        pSlot->nSeq.store(m_nDequeuePos + LOG_RING_SLOTS, std::memory_order_release);
+        m_nDequeuePos++;
+        nLines++;
+    }
+
+    nDropped = m_nDropped.load(std::memory_order_relaxed);
+    if(nDropped != m_nDroppedReported) {
+        fprintf(m_pFile, "[CAMCLog] %llu log lines dropped, the log ring was full\n", (unsigned long long)(nDropped - m_nDroppedReported));
+        m_nDroppedReported = nDropped;
+        nLines++;
+    }
+
+    if(nLines)
+        fflush(m_pFile);
+    return nLines;
+}
+
+/*
+ Same format as asctime with the milliseconds added.
+ */
+void CAMCLog::writeTimeStamp(uint64_t nTimeUs)
+{
+    time_t nSeconds = (time_t)(nTimeUs / 1000000);
+    struct tm localTime;
+    char szTime[64];
+
+#if defined(SB_WIN_BUILD)
+    localtime_s(&localTime, &nSeconds);
+#else
+    localtime_r(&nSeconds, &localTime);
+#endif
+    strftime(szTime, sizeof(szTime), "%a %b %d %H:%M:%S", &localTime);
+    fprintf(m_pFile, "[%s.%03u %d] ", szTime, (unsigned)((nTimeUs / 1000) % 1000), localTime.tm_year + 1900);
+}
@@ -0,0 +1,94 @@
+//
+//  AMCLog.h
+//  AMCDrive X2 plugin
+//
+//  Asynchronous debug log. Callers format their line into a slot of a bounded
+//  lock-free ring (multiple producers, one consumer) and return, there is no
+//  file I/O, lock or syscall on their side. A writer thread wakes up every
+//  LOG_FLUSH_PERIOD ms, adds the time stamps and writes everything that is
+//  queued with a single flush.
+//  When the ring is full the line is dropped and counted, logging must never
+//  hold up the serial link. The writer reports the drops in the log.
+//  The level is checked by the caller before anything is formatted :
+//      if(m_Log.isEnabled(AMC_LOG_TRACE))
+//          m_Log.outFrame(cmdBuf, nCmdLen, "CAMCDrive::xxx sending : ");
+//  so a disabled line costs one load and one well predicted branch.
+
+#ifndef __AMCLog__
+#define __AMCLog__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#define LOG_RING_SLOTS      1024    // must be a power of 2
+#define LOG_LINE_SIZE       1024    // a hexdump of the biggest frame we send or read fits
+#define LOG_FLUSH_PERIOD    100     // ms
+
+enum AMCLogLevel {AMC_LOG_OFF = 0, AMC_LOG_ERROR, AMC_LOG_INFO, AMC_LOG_TRACE};
+#define DEF_LOG_LEVEL       AMC_LOG_ERROR
+
+class CAMCLog
+{
+public:
+    CAMCLog();
+    ~CAMCLog();
+
+    bool        open(const char *pszPath);
+    void        close();
+    bool        isOpen() const { return m_bRunning.load(std::memory_order_relaxed); }
+
+    void        setLevel(int nLevel);
+    int         getLevel() const { return m_nLevel.load(std::memory_order_relaxed); }
+    bool        isEnabled(int nLevel) const { return nLevel <= m_nLevel.load(std::memory_order_relaxed); }
+
+    // printf style, the line is expected to end with \n like for fprintf
+    void        out(const char *pszFormat, ...)
+#if defined(__GNUC__)
+                __attribute__((format(printf, 2, 3)))
+#endif
+                ;
+    void        vout(const char *pszFormat, va_list args);
+    // printf style prefix followed by the frame bytes in hex and \n
+    void        outFrame(const unsigned char *pFrame, int nLen, const char *pszFormat, ...)
+#if defined(__GNUC__)
+                __attribute__((format(printf, 4, 5)))
+#endif
+                ;
+
+    uint64_t    getDroppedCount() const { return m_nDropped.load(std::memory_order_relaxed); }
+
+protected:
+    struct LogSlot {
+        std::atomic<uint64_t>   nSeq;       // slot ownership, Vyukov style
+        uint64_t                nTimeUs;    // wall clock when the line was logged
+        int                     nLen;
+        char                    szText[LOG_LINE_SIZE];
+    };
+
+    LogSlot     *claimSlot();
+    void        publishSlot(LogSlot *pSlot, int nLen);
+    void        writerThread();
+    int         drain();
+    void        writeTimeStamp(uint64_t nTimeUs);
+
+    LogSlot                 *m_pSlots;
+    std::atomic<uint64_t>   m_nEnqueuePos;
+    uint64_t                m_nDequeuePos;      // writer thread only
+    std::atomic<uint64_t>   m_nDropped;
+    std::atomic<int>        m_nLevel;
+    uint64_t                m_nDroppedReported; // writer thread only
+
+    FILE                    *m_pFile;
+    std::thread             m_WriterThread;
+    std::mutex              m_WakeLock;
+    std::condition_variable m_WakeCond;
+    std::atomic<bool>       m_bRunning;
+};
+
+#endif
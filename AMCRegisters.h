@@ -0,0 +1,256 @@
+//
+//  AMCRegisters.h
+//  AMCDrive X2 plugin
+//
+//  Compile-time register descriptors for the AMC DigiFlex serial protocol.
+//  Every register gets a table of its 8 byte frame headers, one per sequence
+//  number and per direction (read/write), with the header CRC already
+//  computed by the compiler. Encoding a frame is a table lookup plus the
+//  payload CRC.
+
+#ifndef __AMCRegisters__
+#define __AMCRegisters__
+
+#include <string.h>
+#include <stdint.h>
+
+#include "AMCCRC.h"
+#include "AMCFrameDecoder.h"
+
+// header define
+#define SOF         0xA5
+#define DA          0x3F
+#define CB_WRITE    0x02
+#define CB_READ     0x01
+
+#define AMC_NB_SEQ  16      // the sequence number is 4 bits
+
+// X-Modem CRC of the 6 header bytes, from the CAMCCRC table so it runs in the compiler
+constexpr uint16_t headerCRC(unsigned char cCB, unsigned char cIndex, unsigned char cOffset, unsigned char cLen)
+{
+    return CAMCCRC::updateByte(CAMCCRC::updateByte(CAMCCRC::updateByte(CAMCCRC::updateByte(CAMCCRC::updateByte(CAMCCRC::updateByte(CRC_XMODEM_START,
+                               SOF), DA), cCB), cIndex), cOffset), cLen);
+}
+
+struct AMCFrameHeader {
+    unsigned char cBytes[FRAME_HEADER_LEN];
+};
+
+struct AMCHeaderTable {
+    AMCFrameHeader read[AMC_NB_SEQ];
+    AMCFrameHeader write[AMC_NB_SEQ];
+};
+
+constexpr AMCFrameHeader makeFrameHeader(unsigned char cCB, unsigned char cIndex, unsigned char cOffset, unsigned char cLen)
+{
+    return AMCFrameHeader {{ SOF, DA, cCB, cIndex, cOffset, cLen,
+                             (unsigned char)(headerCRC(cCB, cIndex, cOffset, cLen) >> 8),
+                             (unsigned char)(headerCRC(cCB, cIndex, cOffset, cLen) & 0xff) }};
+}
+
+template <size_t... nSeq>
+constexpr AMCHeaderTable makeHeaderTable(unsigned char cIndex, unsigned char cOffset, unsigned char cLen, AMCIndexSequence<nSeq...>)
+{
+    return AMCHeaderTable {{ makeFrameHeader((unsigned char)(CB_READ | (nSeq << 2)), cIndex, cOffset, cLen)... },
+                           { makeFrameHeader((unsigned char)(CB_WRITE | (nSeq << 2)), cIndex, cOffset, cLen)... }};
+}
+
+/*
+ Register descriptor : index, offset, length in 16 bits words and the type of
+ the value written to it. The value type must be exactly nLen words.
+ */
+template <unsigned char I, unsigned char O, unsigned char L, class V>
+struct AMCRegister {
+    typedef V value_type;
+
+    static constexpr unsigned char cIndex = I;
+    static constexpr unsigned char cOffset = O;
+    static constexpr unsigned char cLen = L;
+    static constexpr int nDataLen = L * 2;
+    static constexpr int nReadFrameLen = FRAME_HEADER_LEN;
+    static constexpr int nWriteFrameLen = FRAME_HEADER_LEN + L * 2 + FRAME_CRC_LEN;
+    static constexpr int nResponseLen = FRAME_HEADER_LEN + L * 2 + FRAME_CRC_LEN;
+
+    static constexpr AMCHeaderTable headers = makeHeaderTable(I, O, L, AMCMakeSequence<AMC_NB_SEQ>::type());
+
+    static_assert(L <= MAX_RESPONSE_WORDS, "register is longer than a frame");
+};
+
+template <unsigned char I, unsigned char O, unsigned char L, class V>
+constexpr AMCHeaderTable AMCRegister<I, O, L, V>::headers;
+
+/*
+ Build a read request for register R, returns the frame size.
+ */
+template <class R>
+inline int encodeRead(unsigned char *pFrame, unsigned char cSeq)
+{
+    memcpy(pFrame, R::headers.read[cSeq & 0x0F].cBytes, FRAME_HEADER_LEN);
+    return R::nReadFrameLen;
+}
+
+/*
+ Build a write request setting register R to value, returns the frame size.
+ pFrame must hold R::nWriteFrameLen bytes.
+ */
+template <class R>
+inline int encodeWrite(unsigned char *pFrame, unsigned char cSeq, const typename R::value_type &value)
+{
+    uint16_t nCRC;
+
+    static_assert(sizeof(typename R::value_type) == R::nDataLen, "register value type doesn't match its length");
+
+    memcpy(pFrame, R::headers.write[cSeq & 0x0F].cBytes, FRAME_HEADER_LEN);
+    memcpy(pFrame + FRAME_HEADER_LEN, &value, R::nDataLen);
+    nCRC = CAMCCRC::xmodem(pFrame + FRAME_HEADER_LEN, R::nDataLen);
+    pFrame[FRAME_HEADER_LEN + R::nDataLen] = (unsigned char) ((nCRC >> 8) & 0xff);
+    pFrame[FRAME_HEADER_LEN + R::nDataLen + 1] = (unsigned char) (nCRC & 0xff);
+
+    return R::nWriteFrameLen;
+}
+
+// AMC DigiFlex register map
+
+// gain write access
+#define WR_ACCESS_I 0x07
+#define WR_ACCESS_O 0x00
+#define WR_ACCESS_L 0x01
+#define WR_ACCESS_D 0x000F
+
+// Section 2.3.1 page 142 01h: Control Parameters
+// bridge access
+#define BRIDGE_I 0x01
+#define BRIDGE_O 0x00
+#define BRIDGE_L 0x01
+// enable bridge
+#define EN_BRIDGE_D 0x0000
+// disable bridge
+#define DIS_BRIDGE_D 0x0001
+
+// goto position
+#define GOTO_I  0x45
+#define GOTO_O  0x00
+#define GOTO_L  0x02
+
+// get position
+#define POS_I  0x12
+#define POS_O  0x00
+#define POS_L  0x02
+
+// get prod info
+#define PI_I  0x8C
+#define PI_O  0x00
+#define PI_L  0x31
+
+// get firmware
+#define FW_I  0x0B
+#define FW_O  0x00
+#define FW_L  0x80
+
+// Section 2.3.1 page 142 01h: Control Parameters
+// Home
+#define HOME_I 0x01
+#define HOME_O 0x00
+#define HOME_L 0x01
+#define HOME_D 0x0020
+
+// Stop
+#define STOP_I 0x01
+#define STOP_O 0x00
+#define STOP_L 0x01
+#define STOP_D 0x0040
+
+// reset events
+#define RST_EVT_I 0x01
+#define RST_EVT_O 0x00
+#define RST_EVT_L 0x01
+#define RST_EVT_D  0x1000
+
+// Sync
+#define SYNC_I 0x01
+#define SYNC_O 0x00
+#define SYNC_L 0x01
+#define SYNC_D 0x0008
+
+#define SET_POSITION_I  0x39
+#define SET_POSITION_O  0x00
+#define SET_POSITION_L  0x02
+
+// Section 2.3.3 Monitor Commands
+// Drive status
+#define STATUS_I    0x02
+#define DRIVE_BRIDGE_STATUS_O   0x00
+#define DRIVE_PROT_STATUS_O     0x01
+#define SYS_PROT_STATUS_O       0x02
+#define STATUS_1_O  0x03
+#define STATUS_2_O  0x04
+#define STATUS_3_O  0x05
+#define STATUS_L    0x01
+#define NB_STATUS_REG   6
+
+// register descriptors, their frame headers and header CRCs are built at compile time
+typedef AMCRegister<WR_ACCESS_I, WR_ACCESS_O, WR_ACCESS_L, uint16_t>                WriteAccessReg;
+typedef AMCRegister<BRIDGE_I, BRIDGE_O, BRIDGE_L, uint16_t>                         BridgeReg;
+typedef AMCRegister<HOME_I, HOME_O, HOME_L, uint16_t>                               HomeReg;
+typedef AMCRegister<STOP_I, STOP_O, STOP_L, uint16_t>                               StopReg;
+typedef AMCRegister<RST_EVT_I, RST_EVT_O, RST_EVT_L, uint16_t>                      ResetEventsReg;
+typedef AMCRegister<SYNC_I, SYNC_O, SYNC_L, uint16_t>                               SyncReg;
+typedef AMCRegister<GOTO_I, GOTO_O, GOTO_L, int32_t>                                GotoReg;
+typedef AMCRegister<POS_I, POS_O, POS_L, int32_t>                                   PositionReg;
+typedef AMCRegister<SET_POSITION_I, SET_POSITION_O, SET_POSITION_L, int32_t>        SetPositionReg;
+typedef AMCRegister<PI_I, PI_O, PI_L, uint16_t[PI_L]>                               ProdInfoReg;
+typedef AMCRegister<FW_I, FW_O, FW_L, uint16_t[FW_L]>                               FirmwareReg;
+typedef AMCRegister<STATUS_I, DRIVE_BRIDGE_STATUS_O, NB_STATUS_REG, uint16_t[NB_STATUS_REG]> StatusBlockReg;
+
+// Drive Bridge Status, bit 0 is set while the power bridge is enabled
+#define BRIDGE_ENABLED  0x0001
+#define POSITIVE_STOP   0x0008  // positive limit switch stop active
+#define NEGATIVE_STOP   0x0010  // negative limit switch stop active
+#define POSITIVE_INHIBIT    0x0020  // positive torque inhibit active
+#define NEGATIVE_INHIBIT    0x0040  // negative torque inhibit active
+
+// Drive Protection Status, bit 0 (drive reset) is not a fault
+#define DRIVE_INTERNAL_ERROR    0x0002
+#define SHORT_CIRCUIT           0x0004
+#define CURRENT_OVERSHOOT       0x0008
+#define UNDER_VOLTAGE           0x0010
+#define OVER_VOLTAGE            0x0020
+#define DRIVE_OVER_TEMP         0x0040
+#define DRIVE_FAULT_MASK        0x007E
+
+// System Protection Status, every bit is a fault
+#define PARAM_RESTORE_ERROR     0x0001
+#define PARAM_STORE_ERROR       0x0002
+#define INVALID_HALL_STATE      0x0004
+#define PHASE_SYNC_ERROR        0x0008
+#define MOTOR_OVER_TEMP         0x0010
+#define PHASE_DETECTION_FAULT   0x0020
+#define FEEDBACK_SENSOR_ERROR   0x0040
+#define MOTOR_OVER_SPEED        0x0080
+#define MAX_MEASURED_POSITION   0x0100
+#define MIN_MEASURED_POSITION   0x0200
+#define COMM_ERROR              0x0400
+#define BROKEN_WIRE             0x0800
+#define MOTION_ENGINE_ERROR     0x1000
+#define MOTION_ENGINE_ABORT     0x2000
+#define SYS_FAULT_MASK          0x3FFF
+
+// Drive System Status 1
+#define SOFTWARE_DISABLE        0x0002
+#define USER_DISABLE            0x0004
+#define USER_POSITIVE_INHIBIT   0x0008
+#define USER_NEGATIVE_INHIBIT   0x0010
+#define CURRENT_LIMITING        0x0020
+
+// page 155, TABLE 2.12 Drive Status Bit-field Definitions
+#define HOMING      0x1000
+#define IN_HOME_POSITION  0x040
+#define HOMING_COMPLETE  0x4000
+#define MOVING      0x0001  // "Zero Velocity", set when NOT moving
+#define POS_REACHED 0x0002
+#define VELOCITY_FOLLOWING_ERROR    0x0004
+#define POSITION_FOLLOWING_ERROR    0x0080
+#define MAX_TARGET_POSITION_LIMIT   0x0100
+#define MIN_TARGET_POSITION_LIMIT   0x0200
+
+#endif
@@ -0,0 +1,206 @@
+//
+//  AMCStats.cpp
+//  AMCDrive X2 plugin
+//
+//  Link statistics, see AMCStats.h
+
+#include "AMCStats.h"
+#include "AMCRegisters.h"
+
+#pragma mark - CAMCHistogram
+
+void CAMCHistogram::reset()
+{
+    int nBucket;
+
+    for(nBucket = 0; nBucket < HIST_NB_BUCKETS; nBucket++)
+        m_nBuckets[nBucket].store(0, std::memory_order_relaxed);
+    m_nCount.store(0, std::memory_order_relaxed);
+    m_nTotalUs.store(0, std::memory_order_relaxed);
+    m_nMaxUs.store(0, std::memory_order_relaxed);
+}
+
+/*
+ Smallest value that lands in nBucket, the inverse of bucket().
+ */
+uint32_t CAMCHistogram::bucketLowUs(int nBucket)
+{
+    int nBit;
+
+    if(nBucket < HIST_SUB_BUCKETS)
+        return (uint32_t)nBucket;
+    nBit = (nBucket >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    return (uint32_t)(HIST_SUB_BUCKETS + (nBucket & (HIST_SUB_BUCKETS - 1))) << (nBit - HIST_SUB_BITS);
+}
+
+double CAMCHistogram::meanUs() const
+{
+    uint32_t nCount = count();
+
+    return nCount ? (double)m_nTotalUs.load(std::memory_order_relaxed) / nCount : 0.0;
+}
+
+/*
+ The top of the bucket the percentile falls in, never more than the max seen.
+ */
+uint32_t CAMCHistogram::percentileUs(double dPercent) const
+{
+    uint64_t nTotal = 0;
+    uint64_t nRank;
+    uint64_t nSeen = 0;
+    uint32_t nUs = maxUs();
+    uint32_t nTop;
+    int nBucket;
+
+    for(nBucket = 0; nBucket < HIST_NB_BUCKETS; nBucket++)
+        nTotal += bucketCount(nBucket);
+    if(!nTotal)
+        return 0;
+    nRank = (uint64_t)(dPercent / 100.0 * nTotal + 0.5);
+    if(nRank < 1)
+        nRank = 1;
+
+    for(nBucket = 0; nBucket < HIST_NB_BUCKETS - 1; nBucket++) {
+        nSeen += bucketCount(nBucket);
+        if(nSeen >= nRank) {
+            nTop = bucketLowUs(nBucket + 1) - 1;
+            return nTop < nUs ? nTop : nUs;
+        }
+    }
+    return nUs;
+}
+
+#pragma mark - CAMCStats
+
+void CAMCStats::reset()
+{
+    int nIdx;
+
+    for(nIdx = 0; nIdx < HIST_NB_REGISTERS; nIdx++)
+        m_Registers[nIdx].reset();
+    for(nIdx = 0; nIdx < STAT_NB_CALLS; nIdx++)
+        m_Calls[nIdx].reset();
+    for(nIdx = 0; nIdx < STAT_NB_COUNTERS; nIdx++)
+        m_nCounters[nIdx].store(0, std::memory_order_relaxed);
+}
+
+const char *CAMCStats::registerName(int nIndex)
+{
+    switch(nIndex) {
+        case BRIDGE_I:          return "control";
+        case STATUS_I:          return "status";
+        case WR_ACCESS_I:       return "write access";
+        case FW_I:              return "firmware";
+        case POS_I:             return "position";
+        case SET_POSITION_I:    return "set position";
+        case GOTO_I:            return "goto";
+        case PI_I:              return "product info";
+        default:                return "other";
+    }
+}
+
+const char *CAMCStats::counterName(int nCounter)
+{
+    switch(nCounter) {
+        case STAT_TIMEOUTS:         return "timeouts";
+        case STAT_CRC_ERRORS:       return "crc_errors";
+        case STAT_RETRIES:          return "retries";
+        case STAT_STALE_FRAMES:     return "stale_frames";
+        case STAT_LINK_TIMEOUTS:    return "link_timeouts";
+        default:                    return "";
+    }
+}
+
+const char *CAMCStats::callName(int nCall)
+{
+    switch(nCall) {
+        case STAT_CALL_IS_GOTO_COMPLETE:    return "dapiIsGotoComplete";
+        case STAT_CALL_IS_PARK_COMPLETE:    return "dapiIsParkComplete";
+        case STAT_CALL_GET_AZ_EL:           return "dapiGetAzEl";
+        default:                            return "";
+    }
+}
+
+void CAMCStats::summary(std::string &sSummary) const
+{
+    char szLine[256];
+    int nIdx;
+
+    sSummary.clear();
+    for(nIdx = 0; nIdx < HIST_NB_REGISTERS; nIdx++) {
+        const CAMCHistogram &histogram = m_Registers[nIdx];
+        if(!histogram.count())
+            continue;
+        snprintf(szLine, sizeof(szLine), "0x%02X %-13s %7u  p50 %.2f  p99 %.2f  max %.2f ms\n", nIdx, registerName(nIdx), histogram.count(),
+                 histogram.percentileUs(50) / 1000.0, histogram.percentileUs(99) / 1000.0, histogram.maxUs() / 1000.0);
+        sSummary += szLine;
+    }
+    for(nIdx = 0; nIdx < STAT_NB_CALLS; nIdx++) {
+        const CAMCHistogram &histogram = m_Calls[nIdx];
+        if(!histogram.count())
+            continue;
+        snprintf(szLine, sizeof(szLine), "%-18s %7u  p50 %.2f  p99 %.2f  max %.2f ms\n", callName(nIdx), histogram.count(),
+                 histogram.percentileUs(50) / 1000.0, histogram.percentileUs(99) / 1000.0, histogram.maxUs() / 1000.0);
+        sSummary += szLine;
+    }
+    snprintf(szLine, sizeof(szLine), "Timeouts %u, CRC errors %u, retries %u, stale frames %u, link timeouts %u",
+             counter(STAT_TIMEOUTS), counter(STAT_CRC_ERRORS), counter(STAT_RETRIES), counter(STAT_STALE_FRAMES), counter(STAT_LINK_TIMEOUTS));
+    sSummary += szLine;
+}
+
+static void dumpHistogram(FILE *pFile, const CAMCHistogram &histogram)
+{
+    int nBucket;
+    bool bFirst = true;
+
+    fprintf(pFile, "\"count\": %u, \"mean_us\": %.1f, \"p50_us\": %u, \"p90_us\": %u, \"p99_us\": %u, \"max_us\": %u, \"buckets\": [",
+            histogram.count(), histogram.meanUs(), histogram.percentileUs(50), histogram.percentileUs(90), histogram.percentileUs(99), histogram.maxUs());
+    for(nBucket = 0; nBucket < HIST_NB_BUCKETS; nBucket++) {
+        if(!histogram.bucketCount(nBucket))
+            continue;
+        fprintf(pFile, "%s[%u, %u]", bFirst ? "" : ", ", CAMCHistogram::bucketLowUs(nBucket), histogram.bucketCount(nBucket));
+        bFirst = false;
+    }
+    fprintf(pFile, "]");
+}
+
+/*
+ Only the registers and calls that were used. Each bucket is [lowest us, count].
+ */
+bool CAMCStats::dump(const char *pszPath) const
+{
+    FILE *pFile;
+    int nIdx;
+    bool bFirst;
+
+    pFile = fopen(pszPath, "w");
+    if(!pFile)
+        return false;
+
+    fprintf(pFile, "{\n  \"counters\": {");
+    for(nIdx = 0; nIdx < STAT_NB_COUNTERS; nIdx++)
+        fprintf(pFile, "%s\"%s\": %u", nIdx ? ", " : "", counterName(nIdx), counter(nIdx));
+    fprintf(pFile, "},\n  \"registers\": [");
+    bFirst = true;
+    for(nIdx = 0; nIdx < HIST_NB_REGISTERS; nIdx++) {
+        if(!m_Registers[nIdx].count())
+            continue;
+        fprintf(pFile, "%s\n    {\"index\": %d, \"name\": \"%s\", ", bFirst ? "" : ",", nIdx, registerName(nIdx));
+        dumpHistogram(pFile, m_Registers[nIdx]);
+        fprintf(pFile, "}");
+        bFirst = false;
+    }
+    fprintf(pFile, "\n  ],\n  \"calls\": [");
+    bFirst = true;
+    for(nIdx = 0; nIdx < STAT_NB_CALLS; nIdx++) {
+        if(!m_Calls[nIdx].count())
+            continue;
+        fprintf(pFile, "%s\n    {\"name\": \"%s\", ", bFirst ? "" : ",", callName(nIdx));
+        dumpHistogram(pFile, m_Calls[nIdx]);
+        fprintf(pFile, "}");
+        bFirst = false;
+    }
+    fprintf(pFile, "\n  ]\n}\n");
+    fclose(pFile);
+    return true;
+}
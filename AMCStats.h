@@ -0,0 +1,132 @@
+//
+//  AMCStats.h
+//  AMCDrive X2 plugin
+//
+//  Always on link statistics : a latency histogram per register index (request
+//  sent to reply matched), one per X2 call we time, and counters for timeouts,
+//  CRC errors and retries. Recording is a couple of relaxed atomic adds so it
+//  never gets in the way of the link, any thread can read while it's written.
+//  Histograms are log-linear in us : HIST_SUB_BUCKETS linear steps per power
+//  of 2, so every bucket is within 25% of its value, from 1 us to about 30 s.
+
+#ifndef __AMCStats__
+#define __AMCStats__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <atomic>
+#include <chrono>
+
+#define HIST_SUB_BITS       2
+#define HIST_SUB_BUCKETS    (1 << HIST_SUB_BITS)
+#define HIST_NB_BUCKETS     96      // HIST_SUB_BUCKETS * 24 powers of 2
+#define HIST_NB_REGISTERS   256     // the register index is a byte
+
+enum AMCStatCounter {STAT_TIMEOUTS = 0, STAT_CRC_ERRORS, STAT_RETRIES, STAT_STALE_FRAMES, STAT_LINK_TIMEOUTS, STAT_NB_COUNTERS};
+// X2 calls whose mutex hold time is kept
+enum AMCStatCall {STAT_CALL_IS_GOTO_COMPLETE = 0, STAT_CALL_IS_PARK_COMPLETE, STAT_CALL_GET_AZ_EL, STAT_NB_CALLS};
+
+class CAMCHistogram
+{
+public:
+    CAMCHistogram() { reset(); }
+
+    void        record(uint32_t nUs)
+    {
+        m_nBuckets[bucket(nUs)].fetch_add(1, std::memory_order_relaxed);
+        m_nCount.fetch_add(1, std::memory_order_relaxed);
+        m_nTotalUs.fetch_add(nUs, std::memory_order_relaxed);
+        if(nUs > m_nMaxUs.load(std::memory_order_relaxed))
+            m_nMaxUs.store(nUs, std::memory_order_relaxed);
+    }
+    void        reset();
+
+    uint32_t    count() const { return m_nCount.load(std::memory_order_relaxed); }
+    uint32_t    maxUs() const { return m_nMaxUs.load(std::memory_order_relaxed); }
+    double      meanUs() const;
+    uint32_t    percentileUs(double dPercent) const;
+    uint32_t    bucketCount(int nBucket) const { return m_nBuckets[nBucket].load(std::memory_order_relaxed); }
+
+    static int  bucket(uint32_t nUs)
+    {
+        int nBit;
+        int nBucket;
+
+        if(nUs < HIST_SUB_BUCKETS)
+            return (int)nUs;
+        nBit = highestBit(nUs);
+        nBucket = ((nBit - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + (int)((nUs >> (nBit - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1));
+        return nBucket < HIST_NB_BUCKETS ? nBucket : HIST_NB_BUCKETS - 1;
+    }
+    static uint32_t bucketLowUs(int nBucket);
+
+protected:
+    static int  highestBit(uint32_t nValue)
+    {
+#if defined(__GNUC__)
+        return 31 - __builtin_clz(nValue);
+#else
+        int nBit = 0;
+        while(nValue >>= 1)
+            nBit++;
+        return nBit;
+#endif
+    }
+
+    std::atomic<uint32_t>   m_nBuckets[HIST_NB_BUCKETS];
+    std::atomic<uint32_t>   m_nCount;
+    std::atomic<uint64_t>   m_nTotalUs;
+    std::atomic<uint32_t>   m_nMaxUs;
+};
+
+class CAMCStats
+{
+public:
+    CAMCStats() { reset(); }
+
+    void        recordRequest(unsigned char cIndex, uint32_t nUs) { m_Registers[cIndex].record(nUs); }
+    void        recordCall(int nCall, uint32_t nUs) { m_Calls[nCall].record(nUs); }
+    void        count(int nCounter) { m_nCounters[nCounter].fetch_add(1, std::memory_order_relaxed); }
+    void        reset();
+
+    uint32_t    counter(int nCounter) const { return m_nCounters[nCounter].load(std::memory_order_relaxed); }
+    const CAMCHistogram &registerHistogram(int nIndex) const { return m_Registers[nIndex]; }
+    const CAMCHistogram &callHistogram(int nCall) const { return m_Calls[nCall]; }
+
+    // a few lines for the settings dialog, percentiles in ms
+    void        summary(std::string &sSummary) const;
+    // everything, buckets included, as JSON
+    bool        dump(const char *pszPath) const;
+
+    static const char *registerName(int nIndex);
+    static const char *counterName(int nCounter);
+    static const char *callName(int nCall);
+    static uint64_t nowUs()
+    {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+protected:
+    CAMCHistogram           m_Registers[HIST_NB_REGISTERS];
+    CAMCHistogram           m_Calls[STAT_NB_CALLS];
+    std::atomic<uint32_t>   m_nCounters[STAT_NB_COUNTERS];
+};
+
+/*
+ Times a scope into one of the call histograms, declared after the mutex
+ locker it measures how long the call holds the mutex.
+ */
+class CAMCCallTimer
+{
+public:
+    CAMCCallTimer(CAMCStats &stats, int nCall) : m_Stats(stats), m_nCall(nCall), m_nStartUs(CAMCStats::nowUs()) {}
+    ~CAMCCallTimer() { m_Stats.recordCall(m_nCall, (uint32_t)(CAMCStats::nowUs() - m_nStartUs)); }
+
+protected:
+    CAMCStats   &m_Stats;
+    int         m_nCall;
+    uint64_t    m_nStartUs;
+};
+
+#endif
@@ -0,0 +1,52 @@
+//
+//  AMCTransport.h
+//  AMCDrive X2 plugin
+//
+//  Byte transport under CAMCDrive. In TheSkyX this is always the SerX serial
+//  port, the abstraction is there so the driver can be run against a
+//  simulated drive (in process or on a pty) without hardware.
+
+#ifndef __AMCTransport__
+#define __AMCTransport__
+
+#include "../../licensedinterfaces/serxinterface.h"
+
+class CAMCTransport
+{
+public:
+    virtual ~CAMCTransport() {}
+
+    // all return 0 on success, like SerXInterface
+    virtual int open(const char *pszPort) = 0;
+    virtual int close() = 0;
+    virtual int readFile(void *pBuffer, unsigned long ulLen, unsigned long &ulBytesRead, unsigned long ulTimeoutMs) = 0;
+    virtual int writeFile(const void *pBuffer, unsigned long ulLen, unsigned long &ulBytesWritten) = 0;
+    virtual int bytesWaitingRx(int &nBytes) = 0;
+    virtual int flushTx() = 0;
+    virtual int purgeTxRx() = 0;
+};
+
+/*
+ The SerX serial port, what the plugin uses in TheSkyX.
+ */
+class CSerXTransport : public CAMCTransport
+{
+public:
+    CSerXTransport() : m_pSerx(NULL) {}
+
+    void setSerxPointer(SerXInterface *pSerx) { m_pSerx = pSerx; }
+
+    // 115200 8N1
+    virtual int open(const char *pszPort) { return m_pSerx->open(pszPort, 115200, SerXInterface::B_NOPARITY, "-DTR_CONTROL 1"); }
+    virtual int close() { return m_pSerx->close(); }
+    virtual int readFile(void *pBuffer, unsigned long ulLen, unsigned long &ulBytesRead, unsigned long ulTimeoutMs) { return m_pSerx->readFile(pBuffer, ulLen, ulBytesRead, ulTimeoutMs); }
+    virtual int writeFile(const void *pBuffer, unsigned long ulLen, unsigned long &ulBytesWritten) { return m_pSerx->writeFile((void *)pBuffer, ulLen, ulBytesWritten); }
+    virtual int bytesWaitingRx(int &nBytes) { return m_pSerx->bytesWaitingRx(nBytes); }
+    virtual int flushTx() { return m_pSerx->flushTx(); }
+    virtual int purgeTxRx() { return m_pSerx->purgeTxRx(); }
+
+protected:
+    SerXInterface   *m_pSerx;
+};
+
+#endif
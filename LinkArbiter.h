@@ -0,0 +1,151 @@
+//
+//  LinkArbiter.h
+//  AMCDrive X2 plugin
+//
+//  Decides who gets the serial link next when several threads want it.
+//  Requests come in three classes : safety (stop, bridge disable), motion
+//  (goto, home, sync and the other writes) and telemetry (reads). A waiting
+//  request of a higher class always goes before one of a lower class, a
+//  batch of lower class in progress gives the link up between two requests
+//  (see CLinkGrant::yield). A request that waits longer than its deadline
+//  gives up. The time each class spends waiting is kept.
+
+#ifndef __LinkArbiter__
+#define __LinkArbiter__
+
+#include <string.h>
+#include <stdint.h>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+
+enum AMCRequestClass {REQ_SAFETY = 0, REQ_MOTION, REQ_TELEMETRY, REQ_NB_CLASSES};
+
+struct LinkClassStats {
+    uint32_t    nGranted;       // times the class got the link
+    uint32_t    nMissed;        // gave up after their deadline
+    double      dTotalWaitMs;
+    double      dMaxWaitMs;
+};
+
+class CLinkArbiter
+{
+public:
+    CLinkArbiter()
+    {
+        m_bBusy = false;
+        memset(m_nWaiting, 0, sizeof(m_nWaiting));
+        memset(m_Stats, 0, sizeof(m_Stats));
+    }
+
+    // wait for the link, false if nDeadlineMs (0 = no deadline) went by first
+    bool acquire(int nClass, int nDeadlineMs)
+    {
+        std::unique_lock<std::mutex> lock(m_Lock);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        auto ready = [this, nClass] { return !m_bBusy && !higherWaiting(nClass); };
+        bool bGranted = true;
+        double dWaitMs;
+
+        m_nWaiting[nClass]++;
+        if(nDeadlineMs > 0)
+            bGranted = m_Cond.wait_for(lock, std::chrono::milliseconds(nDeadlineMs), ready);
+        else
+            m_Cond.wait(lock, ready);
+        m_nWaiting[nClass]--;
+
+        dWaitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        m_Stats[nClass].dTotalWaitMs += dWaitMs;
+        if(dWaitMs > m_Stats[nClass].dMaxWaitMs)
+            m_Stats[nClass].dMaxWaitMs = dWaitMs;
+        if(!bGranted) {
+            m_Stats[nClass].nMissed++;
+            // lower classes may have been waiting on us
+            lock.unlock();
+            m_Cond.notify_all();
+            return false;
+        }
+        m_Stats[nClass].nGranted++;
+        m_bBusy = true;
+        return true;
+    }
+
+    void release()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_Lock);
+            m_bBusy = false;
+        }
+        m_Cond.notify_all();
+    }
+
+    // is a request of a higher class than nClass waiting for the link
+    bool preempted(int nClass)
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        return higherWaiting(nClass);
+    }
+
+    void getStats(int nClass, LinkClassStats &stats)
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        stats = m_Stats[nClass];
+    }
+
+    void resetStats()
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        memset(m_Stats, 0, sizeof(m_Stats));
+    }
+
+protected:
+    bool higherWaiting(int nClass) const
+    {
+        int nHigher;
+
+        for(nHigher = 0; nHigher < nClass; nHigher++)
+            if(m_nWaiting[nHigher])
+                return true;
+        return false;
+    }
+
+    std::mutex      m_Lock;
+    std::condition_variable m_Cond;
+    bool            m_bBusy;
+    int             m_nWaiting[REQ_NB_CLASSES];
+    LinkClassStats  m_Stats[REQ_NB_CLASSES];
+};
+
+/*
+ Holds the link for a scope, like std::lock_guard.
+ */
+class CLinkGrant
+{
+public:
+    CLinkGrant(CLinkArbiter &arbiter, int nClass, int nDeadlineMs) : m_Arbiter(arbiter), m_nClass(nClass)
+    {
+        m_bOwned = m_Arbiter.acquire(nClass, nDeadlineMs);
+    }
+
+    ~CLinkGrant()
+    {
+        if(m_bOwned)
+            m_Arbiter.release();
+    }
+
+    bool owned() const { return m_bOwned; }
+
+    // let the higher class requests that are waiting go first, then take the link back
+    void yield()
+    {
+        m_Arbiter.release();
+        m_bOwned = m_Arbiter.acquire(m_nClass, 0);
+    }
+
+protected:
+    CLinkArbiter    &m_Arbiter;
+    int             m_nClass;
+    bool            m_bOwned;
+};
+
+#endif
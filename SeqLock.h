@@ -0,0 +1,95 @@
+//
+//  SeqLock.h
+//  AMCDrive X2 plugin
+//
+//  Sequence lock for small state structs that are written now and then and
+//  read a lot. Readers never block, they retry if a write happened while they
+//  were copying. Writers are serialized on a mutex.
+//  The value is kept in relaxed atomic words so there is no data race on the
+//  copy itself, T must be trivially copyable.
+
+#ifndef __SeqLock__
+#define __SeqLock__
+
+#include <string.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <type_traits>
+
+template <class T>
+class CSeqLock
+{
+public:
+    CSeqLock()
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "CSeqLock needs a trivially copyable type");
+        T empty;
+        memset(&empty, 0, sizeof(T));
+        m_nSequence = 0;
+        m_Shadow = empty;
+        storeWords(empty);
+    }
+
+    // read the current value, never blocks
+    void load(T &value) const
+    {
+        uint32_t nSeqBefore;
+        uint32_t nSeqAfter;
+        uint64_t nWords[NB_WORDS];
+        int nIdx;
+
+        do {
+            nSeqBefore = m_nSequence.load(std::memory_order_acquire);
+            for(nIdx = 0; nIdx < NB_WORDS; nIdx++)
+                nWords[nIdx] = m_nWords[nIdx].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            nSeqAfter = m_nSequence.load(std::memory_order_relaxed);
+        } while((nSeqBefore & 1) || nSeqBefore != nSeqAfter);
+
+        memcpy(&value, nWords, sizeof(T));
+    }
+
+    void store(const T &value)
+    {
+        std::lock_guard<std::mutex> lock(m_WriteLock);
+        m_Shadow = value;
+        storeWords(value);
+    }
+
+    // read-modify-write, fn gets a reference to the current value
+    template <class F>
+    void modify(F fn)
+    {
+        std::lock_guard<std::mutex> lock(m_WriteLock);
+        fn(m_Shadow);
+        storeWords(m_Shadow);
+    }
+
+protected:
+    enum { NB_WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t) };
+
+    void storeWords(const T &value)
+    {
+        uint64_t nWords[NB_WORDS];
+        uint32_t nSeq;
+        int nIdx;
+
+        memset(nWords, 0, sizeof(nWords));
+        memcpy(nWords, &value, sizeof(T));
+
+        nSeq = m_nSequence.load(std::memory_order_relaxed);
+        m_nSequence.store(nSeq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for(nIdx = 0; nIdx < NB_WORDS; nIdx++)
+            m_nWords[nIdx].store(nWords[nIdx], std::memory_order_relaxed);
+        m_nSequence.store(nSeq + 2, std::memory_order_release);
+    }
+
+    std::atomic<uint32_t>   m_nSequence;
+    std::atomic<uint64_t>   m_nWords[NB_WORDS];
+    std::mutex              m_WriteLock;
+    T                       m_Shadow;   // writer side copy, under m_WriteLock
+};
+
+#endif
@@ -0,0 +1,428 @@
+//
+//  AMCSimulator.cpp
+//  AMCDrive X2 plugin tools
+//
+//  Virtual AMC DigiFlex drive, see AMCSimulator.h
+
+#include <math.h>
+
+extern "C" {
+#include "../checksum.h"
+}
+#include "AMCSimulator.h"
+
+#define SIM_HOST_ADDRESS    0x01
+#define SIM_MAX_STEP        0.001   // s, motion integration step
+
+CAMCSimulator::CAMCSimulator()
+{
+    m_Config.nTicksPerRev = SIM_DEF_TICKS_PER_REV;
+    m_Config.dMaxVelocity = SIM_DEF_MAX_VELOCITY;
+    m_Config.dAcceleration = SIM_DEF_ACCELERATION;
+    m_Config.nHomeSensor = SIM_DEF_HOME_SENSOR;
+    m_Config.nHomeWindow = SIM_DEF_HOME_WINDOW;
+    reset();
+}
+
+void CAMCSimulator::setConfig(const AMCSimConfig &config)
+{
+    m_Config = config;
+}
+
+/*
+ Power cycle : registers cleared, dome where it was.
+ */
+void CAMCSimulator::reset()
+{
+    const char *szBoardName = "AMC DigiFlex Simulator";
+    const char *szFirmware = "AMCSIM 1.0";
+    int nIdx;
+
+    memset(m_nRegs, 0, sizeof(m_nRegs));
+    // product info, board name from byte 2, firmware name from byte 32
+    for(nIdx = 0; szBoardName[nIdx] && 2 + nIdx < PI_L * 2; nIdx++)
+        m_nRegs[PI_I][(2 + nIdx) / 2] |= (uint16_t)((unsigned char)szBoardName[nIdx]) << (((2 + nIdx) & 1) * 8);
+    for(nIdx = 0; szFirmware[nIdx] && 32 + nIdx < FW_L * 2; nIdx++)
+        m_nRegs[FW_I][(32 + nIdx) / 2] |= (uint16_t)((unsigned char)szFirmware[nIdx]) << (((32 + nIdx) & 1) * 8);
+
+    m_nRxLen = 0;
+    m_TxQueue.clear();
+
+    m_bWriteAccess = false;
+    m_bBridgeEnabled = false;
+
+    m_dLastUpdate = -1.0;
+    m_dPosition = 0.0;
+    m_dVelocity = 0.0;
+    m_dTarget = 0.0;
+    m_bHasTarget = false;
+    m_bPosReached = true;
+    m_bHoming = false;
+    m_bHomingComplete = false;
+    m_dCounterOffset = 0.0;
+    m_dStepEndTime = 0.0;
+    m_dMotionDoneTime = 0.0;
+
+    m_nRequests = 0;
+    m_nStops = 0;
+    m_nCRCErrors = 0;
+}
+
+#pragma mark - Framing
+
+/*
+ Requests are a header, plus data words and their CRC for writes.
+ A header with a bad CRC is dropped and we hunt for the next SOF, the driver
+ will time out on it like it would with a real drive.
+ */
+void CAMCSimulator::receive(const unsigned char *pData, int nLen, double dNow)
+{
+    int nIdx;
+    int nFrameLen;
+    int nSkip;
+    uint16_t nCRC;
+
+    for(nIdx = 0; nIdx < nLen; nIdx++) {
+        if(!m_nRxLen && pData[nIdx] != SOF)
+            continue;
+        m_RxBuffer[m_nRxLen++] = pData[nIdx];
+
+        while(m_nRxLen >= FRAME_HEADER_LEN) {
+            nCRC = crc_xmodem(m_RxBuffer, 6);
+            nFrameLen = FRAME_HEADER_LEN;
+            if((m_RxBuffer[2] & 0x03) == CB_WRITE)
+                nFrameLen += m_RxBuffer[5] * 2 + FRAME_CRC_LEN;
+
+            if(m_RxBuffer[6] != (nCRC >> 8) || m_RxBuffer[7] != (nCRC & 0xff) || m_RxBuffer[5] > MAX_RESPONSE_WORDS) {
+                // resync on the next SOF
+                m_nCRCErrors++;
+                for(nSkip = 1; nSkip < m_nRxLen && m_RxBuffer[nSkip] != SOF; nSkip++)
+                    ;
+                memmove(m_RxBuffer, m_RxBuffer + nSkip, m_nRxLen - nSkip);
+                m_nRxLen -= nSkip;
+                continue;
+            }
+            if(m_nRxLen < nFrameLen)
+                break;
+            processRequest(m_RxBuffer, nFrameLen, dNow);
+            m_nRxLen = 0;
+        }
+    }
+}
+
+int CAMCSimulator::transmit(unsigned char *pData, int nMaxLen)
+{
+    int nLen = 0;
+
+    while(nLen < nMaxLen && !m_TxQueue.empty()) {
+        pData[nLen++] = m_TxQueue.front();
+        m_TxQueue.pop_front();
+    }
+    return nLen;
+}
+
+void CAMCSimulator::reply(unsigned char cControl, unsigned char cS1, const uint16_t *pData, int nWords)
+{
+    unsigned char cHeader[FRAME_HEADER_LEN];
+    unsigned char cData[MAX_RESPONSE_WORDS * 2];
+    uint16_t nCRC;
+    int nIdx;
+
+    cHeader[0] = SOF;
+    cHeader[1] = SIM_HOST_ADDRESS;
+    cHeader[2] = cControl & 0x3C;   // sequence number, no command bits
+    cHeader[3] = cS1;
+    cHeader[4] = 0;
+    cHeader[5] = (unsigned char)nWords;
+    nCRC = crc_xmodem(cHeader, 6);
+    cHeader[6] = (unsigned char) ((nCRC >> 8) & 0xff);
+    cHeader[7] = (unsigned char) (nCRC & 0xff);
+    m_TxQueue.insert(m_TxQueue.end(), cHeader, cHeader + FRAME_HEADER_LEN);
+
+    if(!nWords)
+        return;
+
+    // words go out little endian
+    for(nIdx = 0; nIdx < nWords; nIdx++) {
+        cData[nIdx * 2] = (unsigned char) (pData[nIdx] & 0xff);
+        cData[nIdx * 2 + 1] = (unsigned char) ((pData[nIdx] >> 8) & 0xff);
+    }
+    nCRC = crc_xmodem(cData, nWords * 2);
+    m_TxQueue.insert(m_TxQueue.end(), cData, cData + nWords * 2);
+    m_TxQueue.push_back((unsigned char) ((nCRC >> 8) & 0xff));
+    m_TxQueue.push_back((unsigned char) (nCRC & 0xff));
+}
+
+void CAMCSimulator::processRequest(const unsigned char *pFrame, int nLen, double dNow)
+{
+    unsigned char cControl = pFrame[2];
+    unsigned char cIndex = pFrame[3];
+    unsigned char cOffset = pFrame[4];
+    int nWords = pFrame[5];
+    uint16_t nData[MAX_RESPONSE_WORDS];
+    uint16_t nCRC;
+    int nIdx;
+
+    m_nRequests++;
+    update(dNow);
+
+    if(cOffset + nWords > SIM_NB_OFFSET) {
+        reply(cControl, SIM_S1_INVALID_CMD, NULL, 0);
+        return;
+    }
+
+    switch(cIndex) {
+        case WR_ACCESS_I:
+        case BRIDGE_I:
+        case STATUS_I:
+        case POS_I:
+        case SET_POSITION_I:
+        case GOTO_I:
+        case PI_I:
+        case FW_I:
+            break;
+        default:
+            reply(cControl, SIM_S1_INVALID_CMD, NULL, 0);
+            return;
+    }
+
+    if((cControl & 0x03) == CB_READ) {
+        refreshStatus();
+        reply(cControl, SIM_S1_COMPLETE, &m_nRegs[cIndex][cOffset], nWords);
+        return;
+    }
+
+    if((cControl & 0x03) != CB_WRITE) {
+        reply(cControl, SIM_S1_INVALID_CMD, NULL, 0);
+        return;
+    }
+
+    nCRC = crc_xmodem(pFrame + FRAME_HEADER_LEN, nWords * 2);
+    if(pFrame[nLen - 2] != (nCRC >> 8) || pFrame[nLen - 1] != (nCRC & 0xff)) {
+        m_nCRCErrors++;
+        reply(cControl, SIM_S1_CRC_ERROR, NULL, 0);
+        return;
+    }
+
+    if(cIndex != WR_ACCESS_I && !m_bWriteAccess) {
+        reply(cControl, SIM_S1_NO_WRITE_ACCESS, NULL, 0);
+        return;
+    }
+
+    for(nIdx = 0; nIdx < nWords; nIdx++)
+        nData[nIdx] = (uint16_t)(pFrame[FRAME_HEADER_LEN + nIdx * 2] | (pFrame[FRAME_HEADER_LEN + nIdx * 2 + 1] << 8));
+    writeRegister(cIndex, cOffset, nData, nWords);
+    reply(cControl, SIM_S1_COMPLETE, NULL, 0);
+}
+
+#pragma mark - Registers
+
+void CAMCSimulator::writeRegister(unsigned char cIndex, unsigned char cOffset, const uint16_t *pData, int nWords)
+{
+    int32_t nValue;
+
+    memcpy(&m_nRegs[cIndex][cOffset], pData, nWords * 2);
+
+    switch(cIndex) {
+        case WR_ACCESS_I:
+            m_bWriteAccess = (pData[0] != 0);
+            break;
+
+        case BRIDGE_I:
+            if(cOffset == BRIDGE_O)
+                controlWrite(pData[0]);
+            break;
+
+        case GOTO_I:
+            if(nWords < GOTO_L)
+                break;
+            nValue = (int32_t)((uint32_t)pData[0] | ((uint32_t)pData[1] << 16));
+            m_bHoming = false;
+            m_bPosReached = false;
+            if(m_bBridgeEnabled) {
+                m_dTarget = nValue + m_dCounterOffset;
+                m_bHasTarget = true;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+/*
+ Control parameters (index 0x01 offset 0). The bridge disable bit is a level,
+ any write without it enables the bridge. Home, stop, sync and reset events
+ act on the write.
+ */
+void CAMCSimulator::controlWrite(uint16_t nValue)
+{
+    int32_t nSetPosition;
+
+    m_bBridgeEnabled = !(nValue & DIS_BRIDGE_D);
+    if(!m_bBridgeEnabled) {
+        // the motor coasts down
+        m_bHasTarget = false;
+        m_bHoming = false;
+    }
+
+    if(nValue & SYNC_D) {
+        nSetPosition = (int32_t)((uint32_t)m_nRegs[SET_POSITION_I][0] | ((uint32_t)m_nRegs[SET_POSITION_I][1] << 16));
+        m_dCounterOffset = m_dPosition - nSetPosition;
+    }
+
+    if(nValue & STOP_D) {
+        m_bHasTarget = false;
+        m_bHoming = false;
+    }
+
+    if((nValue & HOME_D) && m_bBridgeEnabled) {
+        m_bHoming = true;
+        m_bHomingComplete = false;
+        m_bHasTarget = false;
+        m_bPosReached = false;
+    }
+
+    if(nValue & RST_EVT_D) {
+        m_nRegs[STATUS_I][DRIVE_PROT_STATUS_O] = 0;
+        m_nRegs[STATUS_I][SYS_PROT_STATUS_O] = 0;
+    }
+}
+
+int32_t CAMCSimulator::reportedPosition()
+{
+    return (int32_t)lround(m_dPosition - m_dCounterOffset);
+}
+
+bool CAMCSimulator::isInHomeWindow()
+{
+    double dDelta;
+
+    dDelta = fmod(m_dPosition - m_Config.nHomeSensor, (double)m_Config.nTicksPerRev);
+    if(dDelta < 0)
+        dDelta += m_Config.nTicksPerRev;
+    if(dDelta > m_Config.nTicksPerRev / 2.0)
+        dDelta -= m_Config.nTicksPerRev;
+    return fabs(dDelta) <= m_Config.nHomeWindow;
+}
+
+void CAMCSimulator::refreshStatus()
+{
+    uint16_t nStatus2 = 0;
+    int32_t nPosition;
+
+    if(m_dVelocity == 0.0 && !m_bHoming && !m_bHasTarget)
+        nStatus2 |= MOVING;     // zero velocity
+    if(m_bPosReached)
+        nStatus2 |= POS_REACHED;
+    if(isInHomeWindow())
+        nStatus2 |= IN_HOME_POSITION;
+    if(m_bHoming)
+        nStatus2 |= HOMING;
+    if(m_bHomingComplete)
+        nStatus2 |= HOMING_COMPLETE;
+
+    m_nRegs[STATUS_I][DRIVE_BRIDGE_STATUS_O] = m_bBridgeEnabled ? BRIDGE_ENABLED : 0;
+    m_nRegs[STATUS_I][STATUS_1_O] = 0;
+    m_nRegs[STATUS_I][STATUS_2_O] = nStatus2;
+    m_nRegs[STATUS_I][STATUS_3_O] = 0;
+
+    nPosition = reportedPosition();
+    m_nRegs[POS_I][POS_O] = (uint16_t)((uint32_t)nPosition & 0xffff);
+    m_nRegs[POS_I][POS_O + 1] = (uint16_t)(((uint32_t)nPosition >> 16) & 0xffff);
+}
+
+#pragma mark - Motion
+
+void CAMCSimulator::update(double dNow)
+{
+    double dElapsed;
+    double dStep;
+
+    if(m_dLastUpdate < 0) {
+        m_dLastUpdate = dNow;
+        return;
+    }
+    // time doesn't go back, a late request is handled at the current time
+    if(dNow <= m_dLastUpdate)
+        return;
+
+    dElapsed = dNow - m_dLastUpdate;
+    m_dStepEndTime = m_dLastUpdate;
+    m_dLastUpdate = dNow;
+    while(dElapsed > 0) {
+        dStep = dElapsed > SIM_MAX_STEP ? SIM_MAX_STEP : dElapsed;
+        m_dStepEndTime += dStep;
+        stepMotion(dStep);
+        dElapsed -= dStep;
+    }
+}
+
+/*
+ Trapezoidal profile toward m_dTarget, or a ramp down to zero velocity when
+ there is no target. Homing searches in the positive direction at half speed
+ until the sensor window, then moves to the sensor and zeroes the counter there.
+ */
+void CAMCSimulator::stepMotion(double dt)
+{
+    double dDistance;
+    double dDirection;
+    double dStopping;
+    double dDeltaV = m_Config.dAcceleration * dt;
+    double dDelta;
+
+    if(m_bHoming && !m_bHasTarget) {
+        if(isInHomeWindow()) {
+            dDelta = fmod(m_dPosition - m_Config.nHomeSensor, (double)m_Config.nTicksPerRev);
+            if(dDelta < 0)
+                dDelta += m_Config.nTicksPerRev;
+            if(dDelta > m_Config.nTicksPerRev / 2.0)
+                dDelta -= m_Config.nTicksPerRev;
+            m_dTarget = m_dPosition - dDelta;
+            m_bHasTarget = true;
+        }
+        else {
+            if(m_dVelocity < m_Config.dMaxVelocity / 2)
+                m_dVelocity = fmin(m_dVelocity + dDeltaV, m_Config.dMaxVelocity / 2);
+            m_dPosition += m_dVelocity * dt;
+            return;
+        }
+    }
+
+    if(!m_bHasTarget) {
+        if(fabs(m_dVelocity) <= dDeltaV)
+            m_dVelocity = 0.0;
+        else
+            m_dVelocity -= (m_dVelocity > 0 ? dDeltaV : -dDeltaV);
+        m_dPosition += m_dVelocity * dt;
+        return;
+    }
+
+    dDistance = m_dTarget - m_dPosition;
+    dDirection = dDistance >= 0 ? 1.0 : -1.0;
+    dStopping = (m_dVelocity * m_dVelocity) / (2.0 * m_Config.dAcceleration);
+
+    if(m_dVelocity * dDirection < 0)
+        m_dVelocity += dDirection * dDeltaV;    // going the wrong way, brake
+    else if(dStopping >= fabs(dDistance))
+        m_dVelocity -= dDirection * dDeltaV;    // decelerate into the target
+    else if(fabs(m_dVelocity) < m_Config.dMaxVelocity)
+        m_dVelocity = dDirection * fmin(fabs(m_dVelocity) + dDeltaV, m_Config.dMaxVelocity);
+
+    m_dPosition += m_dVelocity * dt;
+
+    // arrived, or crossed the target on the last step
+    if((m_dTarget - m_dPosition) * dDirection <= 0.5 && fabs(m_dVelocity) <= 2 * dDeltaV + 1.0) {
+        m_dPosition = m_dTarget;
+        m_dVelocity = 0.0;
+        m_bHasTarget = false;
+        m_bPosReached = true;
+        m_dMotionDoneTime = m_dStepEndTime;
+        m_nStops++;
+        if(m_bHoming) {
+            m_bHoming = false;
+            m_bHomingComplete = true;
+            m_dCounterOffset = m_dTarget;
+        }
+    }
+}
@@ -0,0 +1,112 @@
+//
+//  AMCSimulator.h
+//  AMCDrive X2 plugin tools
+//
+//  A virtual AMC DigiFlex drive speaking the 0xA5 framed serial protocol.
+//  It implements the registers the plugin uses and a simple trapezoidal
+//  motion model with a home sensor, enough to exercise the driver and to
+//  measure its latency without a dome.
+//  The simulator doesn't read the clock, the caller passes the time in so it
+//  can run in real time (on a pty) or in simulated time (in process).
+
+#ifndef __AMCSimulator__
+#define __AMCSimulator__
+
+#include <string.h>
+#include <stdint.h>
+#include <deque>
+
+#include "../AMCRegisters.h"
+
+// register bank, index x offset in words
+#define SIM_NB_INDEX        256
+#define SIM_NB_OFFSET       MAX_RESPONSE_WORDS
+
+// s1 status codes in the reply header
+#define SIM_S1_COMPLETE         0x01
+#define SIM_S1_INVALID_CMD      0x03
+#define SIM_S1_NO_WRITE_ACCESS  0x06
+#define SIM_S1_CRC_ERROR        0x08
+
+// defaults, roughly a 1 m dome on a geared motor
+#define SIM_DEF_TICKS_PER_REV   360000
+#define SIM_DEF_MAX_VELOCITY    20000.0     // ticks/s
+#define SIM_DEF_ACCELERATION    40000.0     // ticks/s^2
+#define SIM_DEF_HOME_SENSOR     90000       // physical position of the home sensor
+#define SIM_DEF_HOME_WINDOW     500         // ticks either side of the sensor
+
+struct AMCSimConfig {
+    int     nTicksPerRev;
+    double  dMaxVelocity;
+    double  dAcceleration;
+    int     nHomeSensor;
+    int     nHomeWindow;
+};
+
+class CAMCSimulator
+{
+public:
+    CAMCSimulator();
+
+    void    setConfig(const AMCSimConfig &config);
+    void    getConfig(AMCSimConfig &config) { config = m_Config; }
+    void    reset();
+
+    // bytes from the driver, complete requests are answered right away
+    void    receive(const unsigned char *pData, int nLen, double dNow);
+    // bytes for the driver
+    int     transmit(unsigned char *pData, int nMaxLen);
+    int     bytesPending() { return (int)m_TxQueue.size(); }
+
+    // advance the motion model to dNow (seconds)
+    void    update(double dNow);
+
+    double  getPhysicalPosition() { return m_dPosition; }
+    double  getVelocity() { return m_dVelocity; }
+    bool    isMoving() { return m_dVelocity != 0.0 || m_bHoming; }
+    // when the last move or homing ended, in the caller's time base
+    double  getMotionDoneTime() { return m_dMotionDoneTime; }
+    int     getRequestCount() { return m_nRequests; }
+    // how many times the dome got to its target and stopped
+    int     getStopCount() { return m_nStops; }
+    int     getCRCErrorCount() { return m_nCRCErrors; }
+
+protected:
+    void    processRequest(const unsigned char *pFrame, int nLen, double dNow);
+    void    reply(unsigned char cControl, unsigned char cS1, const uint16_t *pData, int nWords);
+    void    writeRegister(unsigned char cIndex, unsigned char cOffset, const uint16_t *pData, int nWords);
+    void    controlWrite(uint16_t nValue);
+    void    refreshStatus();
+    int32_t reportedPosition();
+    bool    isInHomeWindow();
+    void    stepMotion(double dt);
+
+    AMCSimConfig    m_Config;
+    uint16_t        m_nRegs[SIM_NB_INDEX][SIM_NB_OFFSET];
+
+    unsigned char   m_RxBuffer[MAX_FRAME_LEN];
+    int             m_nRxLen;
+    std::deque<unsigned char> m_TxQueue;
+
+    bool            m_bWriteAccess;
+    bool            m_bBridgeEnabled;
+
+    // motion, all in physical ticks
+    double          m_dLastUpdate;
+    double          m_dPosition;
+    double          m_dVelocity;
+    double          m_dTarget;
+    bool            m_bHasTarget;
+    bool            m_bPosReached;
+    bool            m_bHoming;
+    bool            m_bHomingComplete;
+    double          m_dCounterOffset;   // reported = physical - offset
+    double          m_dStepEndTime;
+    double          m_dMotionDoneTime;
+
+    int             m_nRequests;
+    int             m_nStops;
+    int             m_nCRCErrors;
+};
+
+#endif
@@ -0,0 +1,131 @@
+//
+//  CaptureFile.cpp
+//  AMCDrive X2 plugin tools
+//
+//  Read only access to a wire capture, see CaptureFile.h
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "CaptureFile.h"
+#include "../AMCRegisters.h"
+
+CCaptureFile::CCaptureFile()
+{
+    m_nFd = -1;
+    m_pMap = NULL;
+    m_nMapSize = 0;
+    m_pHeader = NULL;
+    m_pRecords = NULL;
+    m_nFirst = 0;
+    m_nCount = 0;
+}
+
+CCaptureFile::~CCaptureFile()
+{
+    close();
+}
+
+bool CCaptureFile::open(const char *pszPath)
+{
+    struct stat fileStat;
+
+    close();
+    m_nFd = ::open(pszPath, O_RDONLY);
+    if(m_nFd < 0 || fstat(m_nFd, &fileStat) != 0) {
+        perror(pszPath);
+        close();
+        return false;
+    }
+    if((size_t)fileStat.st_size < sizeof(AMCCaptureFileHeader)) {
+        fprintf(stderr, "%s is too small to be a capture\n", pszPath);
+        close();
+        return false;
+    }
+    m_nMapSize = (size_t)fileStat.st_size;
+    m_pMap = mmap(NULL, m_nMapSize, PROT_READ, MAP_SHARED, m_nFd, 0);
+    if(m_pMap == MAP_FAILED) {
+        m_pMap = NULL;
+        perror(pszPath);
+        close();
+        return false;
+    }
+
+    m_pHeader = (const AMCCaptureFileHeader *)m_pMap;
+    m_pRecords = (const AMCCaptureRecord *)((const unsigned char *)m_pMap + sizeof(AMCCaptureFileHeader));
+    if(memcmp(m_pHeader->szMagic, CAPTURE_MAGIC, sizeof(m_pHeader->szMagic)) || m_pHeader->nVersion != CAPTURE_VERSION ||
+       m_pHeader->nRecordSize != sizeof(AMCCaptureRecord) || !m_pHeader->nCapacity ||
+       m_nMapSize < sizeof(AMCCaptureFileHeader) + m_pHeader->nCapacity * sizeof(AMCCaptureRecord)) {
+        fprintf(stderr, "%s is not a version %d capture\n", pszPath, CAPTURE_VERSION);
+        close();
+        return false;
+    }
+
+    // the file is a ring, start at the oldest record still in it
+    m_nCount = m_pHeader->nWritten < m_pHeader->nCapacity ? m_pHeader->nWritten : m_pHeader->nCapacity;
+    m_nFirst = m_pHeader->nWritten - m_nCount;
+    return true;
+}
+
+void CCaptureFile::close()
+{
+    if(m_pMap)
+        munmap(m_pMap, m_nMapSize);
+    if(m_nFd >= 0)
+        ::close(m_nFd);
+    m_nFd = -1;
+    m_pMap = NULL;
+    m_nMapSize = 0;
+    m_pHeader = NULL;
+    m_pRecords = NULL;
+    m_nFirst = 0;
+    m_nCount = 0;
+}
+
+const char *CCaptureFile::registerName(const AMCCaptureRecord &record)
+{
+    switch(record.cIndex) {
+        case WR_ACCESS_I:       return "write access";
+        case GOTO_I:            return "goto";
+        case POS_I:             return "position";
+        case SET_POSITION_I:    return "set position";
+        case PI_I:              return "product info";
+        case FW_I:              return "firmware";
+        case STATUS_I:          return "status";
+        case BRIDGE_I:
+            if(record.cOp != CB_WRITE)
+                return "control word";
+            switch(record.nRequestData) {
+                case EN_BRIDGE_D:   return "enable bridge";
+                case DIS_BRIDGE_D:  return "disable bridge";
+                case HOME_D:        return "home";
+                case STOP_D:        return "stop";
+                case RST_EVT_D:     return "reset events";
+                case SYNC_D:        return "sync";
+                default:            return "control word";
+            }
+        default:                return "";
+    }
+}
+
+uint32_t CCaptureFile::registerKey(const AMCCaptureRecord &record)
+{
+    uint32_t nData = (record.cOp == CB_WRITE && record.cIndex == BRIDGE_I) ? record.nRequestData : 0;
+
+    return (uint32_t)record.cIndex << 24 | (uint32_t)record.cOffset << 16 | (uint32_t)record.cOp << 14 | (nData & 0x3FFF);
+}
+
+const char *CCaptureFile::directionName(int nDirection)
+{
+    switch(nDirection) {
+        case CAPTURE_TX:        return "TX";
+        case CAPTURE_RX:        return "RX";
+        case CAPTURE_RX_STALE:  return "STALE";
+        case CAPTURE_TIMEOUT:   return "TIMEOUT";
+        default:                return "?";
+    }
+}
@@ -0,0 +1,47 @@
+//
+//  CaptureFile.h
+//  AMCDrive X2 plugin tools
+//
+//  Read only access to a wire capture written by the plugin (see AMCCapture.h).
+//  The file is mapped, records are returned oldest first whether the ring has
+//  wrapped or not.
+
+#ifndef __CaptureFile__
+#define __CaptureFile__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "../AMCCapture.h"
+
+class CCaptureFile
+{
+public:
+    CCaptureFile();
+    ~CCaptureFile();
+
+    // prints why on stderr when it fails
+    bool        open(const char *pszPath);
+    void        close();
+
+    const AMCCaptureFileHeader &header() const { return *m_pHeader; }
+    uint64_t    count() const { return m_nCount; }
+    uint64_t    overwritten() const { return m_nFirst; }
+    const AMCCaptureRecord &record(uint64_t nIdx) const { return m_pRecords[(m_nFirst + nIdx) % m_pHeader->nCapacity]; }
+
+    // what the plugin uses the register for, writes to the control word are told apart by their data
+    static const char *registerName(const AMCCaptureRecord &record);
+    static uint32_t registerKey(const AMCCaptureRecord &record);
+    static const char *directionName(int nDirection);
+
+protected:
+    int                         m_nFd;
+    void                        *m_pMap;
+    size_t                      m_nMapSize;
+    const AMCCaptureFileHeader  *m_pHeader;
+    const AMCCaptureRecord      *m_pRecords;
+    uint64_t                    m_nFirst;
+    uint64_t                    m_nCount;
+};
+
+#endif
@@ -0,0 +1,299 @@
+//
+//  ReplayTransport.cpp
+//  AMCDrive X2 plugin tools
+//
+//  Transport that answers CAMCDrive from a wire capture, see ReplayTransport.h
+
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+extern "C" {
+#include "../checksum.h"
+}
+#include "ReplayTransport.h"
+
+CReplayTransport::CReplayTransport(const CCaptureFile &capture, int nMode) : m_Capture(capture)
+{
+    uint64_t nIdx;
+
+    m_nMode = nMode;
+    m_nCursorNs = 0;
+    m_dCursorWallTime = now();
+    m_dLastRequest = -1;
+    resetCounters();
+
+    for(nIdx = 0; nIdx < m_Capture.count(); nIdx++) {
+        const AMCCaptureRecord &record = m_Capture.record(nIdx);
+        if(record.cDirection == CAPTURE_RX && record.cOp == CB_READ && record.nFrameLen >= FRAME_HEADER_LEN)
+            m_ReadReplies[record.cIndex].push_back(nIdx);
+    }
+}
+
+void CReplayTransport::setCursor(uint64_t nTimeNs)
+{
+    m_nCursorNs = nTimeNs;
+    m_dCursorWallTime = now();
+}
+
+void CReplayTransport::resetCounters()
+{
+    memset(&m_Counters, 0, sizeof(ReplayCounters));
+}
+
+double CReplayTransport::now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int CReplayTransport::open(const char *)
+{
+    purgeTxRx();
+    return 0;
+}
+
+int CReplayTransport::close()
+{
+    return 0;
+}
+
+int CReplayTransport::readFile(void *pBuffer, unsigned long ulLen, unsigned long &ulBytesRead, unsigned long ulTimeoutMs)
+{
+    unsigned char *pBytes = (unsigned char *)pBuffer;
+    double dDeadline = now() + ulTimeoutMs / 1000.0;
+    double dNow;
+
+    ulBytesRead = 0;
+    while(true) {
+        dNow = now();
+        while(ulBytesRead < ulLen && !m_FromDrive.empty() && m_FromDrive.front().dTime <= dNow) {
+            pBytes[ulBytesRead++] = m_FromDrive.front().cByte;
+            m_FromDrive.pop_front();
+        }
+        if(m_FromDrive.empty() && m_dLastRequest >= 0) {
+            // all the replies are in
+            m_Counters.dLinkTime += dNow - m_dLastRequest;
+            m_dLastRequest = -1;
+        }
+        if(ulBytesRead == ulLen || dNow >= dDeadline)
+            break;
+        // nothing more is coming, a real drive would make us wait for the timeout
+        if(m_FromDrive.empty() && m_nMode == REPLAY_FAST)
+            break;
+        if(m_FromDrive.empty())
+            std::this_thread::sleep_for(std::chrono::duration<double>(dDeadline - dNow));
+        else if(m_FromDrive.front().dTime > dNow)
+            std::this_thread::sleep_for(std::chrono::duration<double>(std::min(m_FromDrive.front().dTime, dDeadline) - dNow));
+    }
+    return 0;
+}
+
+/*
+ Requests can come in pieces or several at once, answer each complete one.
+ */
+int CReplayTransport::writeFile(const void *pBuffer, unsigned long ulLen, unsigned long &ulBytesWritten)
+{
+    const unsigned char *pBytes = (const unsigned char *)pBuffer;
+    int nFrameLen;
+
+    m_TxBuffer.insert(m_TxBuffer.end(), pBytes, pBytes + ulLen);
+    ulBytesWritten = ulLen;
+
+    while(!m_TxBuffer.empty()) {
+        if(m_TxBuffer[0] != SOF) {
+            m_TxBuffer.erase(m_TxBuffer.begin());
+            continue;
+        }
+        if(m_TxBuffer.size() < FRAME_HEADER_LEN)
+            break;
+        nFrameLen = FRAME_HEADER_LEN;
+        if((m_TxBuffer[2] & 0x03) == CB_WRITE && m_TxBuffer[5])
+            nFrameLen += m_TxBuffer[5] * 2 + FRAME_CRC_LEN;
+        if((int)m_TxBuffer.size() < nFrameLen)
+            break;
+        answer(m_TxBuffer.data(), nFrameLen);
+        m_TxBuffer.erase(m_TxBuffer.begin(), m_TxBuffer.begin() + nFrameLen);
+    }
+    return 0;
+}
+
+int CReplayTransport::bytesWaitingRx(int &nBytes)
+{
+    double dNow = now();
+    std::deque<TimedByte>::iterator it;
+
+    nBytes = 0;
+    for(it = m_FromDrive.begin(); it != m_FromDrive.end() && it->dTime <= dNow; ++it)
+        nBytes++;
+    return 0;
+}
+
+int CReplayTransport::flushTx()
+{
+    return 0;
+}
+
+int CReplayTransport::purgeTxRx()
+{
+    m_TxBuffer.clear();
+    m_FromDrive.clear();
+    m_dLastRequest = -1;
+    return 0;
+}
+
+void CReplayTransport::answer(const unsigned char *pRequest, int nLen)
+{
+    unsigned char cReply[MAX_FRAME_LEN];
+    int nReplyLen;
+    uint64_t nRecord;
+    double dNow = now();
+    double dLatency = 0;
+    const AMCCaptureRecord *pRecord = NULL;
+
+    (void)nLen;
+    if(m_dLastRequest < 0)
+        m_dLastRequest = dNow;
+
+    if((pRequest[2] & 0x03) == CB_WRITE) {
+        // the recorded dome ignores us, just acknowledge
+        m_Counters.nWrites++;
+    }
+    else {
+        m_Counters.nReads++;
+        if(!findReply(pRequest[3], pRequest[4], pRequest[5], nRecord)) {
+            m_Counters.nUnanswered++;
+            return;
+        }
+        pRecord = &m_Capture.record(nRecord);
+        if(m_nMode == REPLAY_REALTIME)
+            dLatency = pRecord->nLatencyUs / 1e6;
+    }
+
+    nReplyLen = buildReply(pRequest, pRecord, cReply);
+    queueReply(cReply, nReplyLen, dNow + dLatency);
+}
+
+/*
+ Find the recorded reply to a read of the same register index whose words
+ cover the ones asked for. Error replies have no data, they answer a read at
+ the same offset.
+ */
+bool CReplayTransport::findReply(unsigned char cIndex, unsigned char cOffset, unsigned char cLen, uint64_t &nRecord)
+{
+    std::map<unsigned char, std::vector<uint64_t> >::iterator itIndex;
+    std::vector<uint64_t>::iterator it;
+    std::vector<uint64_t>::iterator itFound;
+    uint64_t nTarget;
+    bool bFound = false;
+
+    itIndex = m_ReadReplies.find(cIndex);
+    if(itIndex == m_ReadReplies.end())
+        return false;
+    std::vector<uint64_t> &replies = itIndex->second;
+
+    const CCaptureFile &capture = m_Capture;
+    auto covers = [&capture, cOffset, cLen](uint64_t nIdx) {
+        const AMCCaptureRecord &record = capture.record(nIdx);
+        if(record.cFrame[3] != 1)
+            return record.cOffset == cOffset;
+        return record.cOffset <= cOffset && cOffset + cLen <= record.cOffset + record.cFrame[5];
+    };
+    auto before = [&capture](uint64_t nIdx, uint64_t nTime) { return capture.record(nIdx).nTimeNs < nTime; };
+
+    if(m_nMode == REPLAY_REALTIME)
+        nTarget = m_nCursorNs + (uint64_t)((now() - m_dCursorWallTime) * 1e9);
+    else
+        nTarget = m_nCursorNs;
+
+    // first recorded reply at or after the target
+    itFound = std::lower_bound(replies.begin(), replies.end(), nTarget, before);
+
+    if(m_nMode == REPLAY_REALTIME) {
+        // latest reply up to now
+        for(it = itFound; it != replies.begin() && !bFound; ) {
+            --it;
+            if(covers(*it)) {
+                nRecord = *it;
+                bFound = true;
+            }
+        }
+    }
+    for(it = itFound; it != replies.end() && !bFound; ++it) {
+        if(covers(*it)) {
+            nRecord = *it;
+            bFound = true;
+            if(m_nMode == REPLAY_FAST)
+                m_nCursorNs = capture.record(nRecord).nTimeNs + 1;
+        }
+    }
+    // past the end of the recording, the dome stays as it was
+    for(it = itFound; it != replies.begin() && !bFound; ) {
+        --it;
+        if(covers(*it)) {
+            nRecord = *it;
+            bFound = true;
+        }
+    }
+    return bFound;
+}
+
+/*
+ Rebuild the reply for this request : its sequence number, the words it asked
+ for out of the recorded ones, and the CRCs. pRecord is NULL for a write ack.
+ Words that were beyond what the capture keeps of a long frame read as 0.
+ */
+int CReplayTransport::buildReply(const unsigned char *pRequest, const AMCCaptureRecord *pRecord, unsigned char *pReply)
+{
+    uint16_t nCRC;
+    int nWords = 0;
+    int nWord;
+    int nSrc;
+    int nRecordedData;
+
+    pReply[0] = SOF;
+    pReply[1] = pRecord ? pRecord->cFrame[1] : 0x01;
+    pReply[2] = (unsigned char)((pRecord ? (pRecord->cFrame[2] & 0x03) : 0) | (pRequest[2] & 0x3C));
+    pReply[3] = pRecord ? pRecord->cFrame[3] : 0x01;
+    pReply[4] = pRecord ? pRecord->cFrame[4] : 0x00;
+    if(pRecord && pReply[3] == 1)
+        nWords = pRequest[5];
+    pReply[5] = (unsigned char)nWords;
+    nCRC = crc_xmodem(pReply, 6);
+    pReply[6] = (unsigned char)((nCRC >> 8) & 0xff);
+    pReply[7] = (unsigned char)(nCRC & 0xff);
+    if(!nWords)
+        return FRAME_HEADER_LEN;
+
+    nRecordedData = std::min((int)pRecord->nFrameLen, CAPTURE_FRAME_BYTES) - FRAME_HEADER_LEN;
+    for(nWord = 0; nWord < nWords; nWord++) {
+        nSrc = (pRequest[4] - pRecord->cOffset + nWord) * 2;
+        if(nSrc + 1 < nRecordedData) {
+            pReply[FRAME_HEADER_LEN + nWord * 2] = pRecord->cFrame[FRAME_HEADER_LEN + nSrc];
+            pReply[FRAME_HEADER_LEN + nWord * 2 + 1] = pRecord->cFrame[FRAME_HEADER_LEN + nSrc + 1];
+        }
+        else {
+            pReply[FRAME_HEADER_LEN + nWord * 2] = 0;
+            pReply[FRAME_HEADER_LEN + nWord * 2 + 1] = 0;
+        }
+    }
+    nCRC = crc_xmodem(pReply + FRAME_HEADER_LEN, nWords * 2);
+    pReply[FRAME_HEADER_LEN + nWords * 2] = (unsigned char)((nCRC >> 8) & 0xff);
+    pReply[FRAME_HEADER_LEN + nWords * 2 + 1] = (unsigned char)(nCRC & 0xff);
+    return FRAME_HEADER_LEN + nWords * 2 + FRAME_CRC_LEN;
+}
+
+void CReplayTransport::queueReply(const unsigned char *pReply, int nLen, double dReadyTime)
+{
+    TimedByte rxByte;
+    int nIdx;
+
+    // replies come back in order
+    if(!m_FromDrive.empty() && m_FromDrive.back().dTime > dReadyTime)
+        dReadyTime = m_FromDrive.back().dTime;
+    for(nIdx = 0; nIdx < nLen; nIdx++) {
+        rxByte.dTime = dReadyTime;
+        rxByte.cByte = pReply[nIdx];
+        m_FromDrive.push_back(rxByte);
+    }
+}
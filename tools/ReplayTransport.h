@@ -0,0 +1,83 @@
+//
+//  ReplayTransport.h
+//  AMCDrive X2 plugin tools
+//
+//  Transport that answers CAMCDrive from a wire capture instead of a drive.
+//  Register reads are answered with what the drive replied to a recorded read
+//  covering the same words, so the driver doesn't have to send exactly the
+//  requests that were recorded (a block read can answer a single register and
+//  the other way round). Writes are acknowledged and otherwise ignored, the
+//  recorded dome does what it did that night.
+//  A cursor walks through the capture :
+//  - REPLAY_REALTIME : the cursor follows the wall clock from setCursor() and
+//    reads get the latest recorded reply, delayed by its recorded latency.
+//  - REPLAY_FAST : every read moves the cursor to the next recorded reply,
+//    there is no delay. The run only depends on the order of the requests.
+
+#ifndef __ReplayTransport__
+#define __ReplayTransport__
+
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "../AMCTransport.h"
+#include "../AMCRegisters.h"
+#include "CaptureFile.h"
+
+enum ReplayMode {REPLAY_FAST = 0, REPLAY_REALTIME};
+
+struct ReplayCounters {
+    int     nReads;
+    int     nWrites;
+    int     nUnanswered;    // reads we had no recording for
+    double  dLinkTime;      // s, from each request to the end of its reply
+};
+
+class CReplayTransport : public CAMCTransport
+{
+public:
+    CReplayTransport(const CCaptureFile &capture, int nMode);
+
+    // start replaying at nTimeNs (capture monotonic clock)
+    void    setCursor(uint64_t nTimeNs);
+    uint64_t getCursor() const { return m_nCursorNs; }
+
+    void    getCounters(ReplayCounters &counters) const { counters = m_Counters; }
+    void    resetCounters();
+
+    virtual int open(const char *pszPort);
+    virtual int close();
+    virtual int readFile(void *pBuffer, unsigned long ulLen, unsigned long &ulBytesRead, unsigned long ulTimeoutMs);
+    virtual int writeFile(const void *pBuffer, unsigned long ulLen, unsigned long &ulBytesWritten);
+    virtual int bytesWaitingRx(int &nBytes);
+    virtual int flushTx();
+    virtual int purgeTxRx();
+
+    static double now();
+
+protected:
+    struct TimedByte {
+        double          dTime;
+        unsigned char   cByte;
+    };
+
+    void    answer(const unsigned char *pRequest, int nLen);
+    bool    findReply(unsigned char cIndex, unsigned char cOffset, unsigned char cLen, uint64_t &nRecord);
+    int     buildReply(const unsigned char *pRequest, const AMCCaptureRecord *pRecord, unsigned char *pReply);
+    void    queueReply(const unsigned char *pReply, int nLen, double dReadyTime);
+
+    const CCaptureFile  &m_Capture;
+    int                 m_nMode;
+    uint64_t            m_nCursorNs;
+    double              m_dCursorWallTime;  // realtime mode, when setCursor was called
+    // recorded replies to reads, in capture order, by register index
+    std::map<unsigned char, std::vector<uint64_t> > m_ReadReplies;
+    std::deque<TimedByte> m_FromDrive;
+    std::vector<unsigned char> m_TxBuffer;
+    ReplayCounters      m_Counters;
+    double              m_dLastRequest;
+};
+
+#endif
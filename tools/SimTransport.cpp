@@ -0,0 +1,152 @@
+//
+//  SimTransport.cpp
+//  AMCDrive X2 plugin tools
+//
+//  In process transport to a CAMCSimulator, see SimTransport.h
+
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+
+#include "SimTransport.h"
+
+CSimTransport::CSimTransport(CAMCSimulator &simulator) : m_Simulator(simulator)
+{
+    setLineTiming(SIM_DEF_BAUD_RATE, SIM_DEF_TURNAROUND_US);
+    m_dTxFree = 0;
+    m_dRxFree = 0;
+    m_dCorruptionRate = 0;
+    m_nCorrupted = 0;
+}
+
+/*
+ nBaudRate = 0 makes the line infinitely fast.
+ */
+void CSimTransport::setLineTiming(int nBaudRate, int nTurnaroundUs)
+{
+    m_dByteTime = nBaudRate ? 10.0 / nBaudRate : 0.0;
+    m_dTurnaround = nTurnaroundUs / 1e6;
+}
+
+double CSimTransport::now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int CSimTransport::open(const char *)
+{
+    purgeTxRx();
+    return 0;
+}
+
+int CSimTransport::close()
+{
+    return 0;
+}
+
+/*
+ Hand the requests that made it through the line to the simulator and put
+ its replies on the line back.
+ */
+void CSimTransport::pump(double dNow)
+{
+    unsigned char cReply[MAX_FRAME_LEN];
+    int nLen;
+    int nIdx;
+    TimedByte rxByte;
+
+    while(!m_ToDrive.empty() && m_ToDrive.front().dTime <= dNow) {
+        TimedBytes &request = m_ToDrive.front();
+        m_Simulator.receive(request.bytes.data(), (int)request.bytes.size(), request.dTime);
+
+        if(m_dRxFree < request.dTime + m_dTurnaround)
+            m_dRxFree = request.dTime + m_dTurnaround;
+        while((nLen = m_Simulator.transmit(cReply, sizeof(cReply))) > 0) {
+            // one request, one reply : this is a whole frame
+            if(m_dCorruptionRate > 0 && nLen > FRAME_HEADER_LEN + FRAME_CRC_LEN && rand() < m_dCorruptionRate * RAND_MAX) {
+                cReply[FRAME_HEADER_LEN + rand() % (nLen - FRAME_HEADER_LEN - FRAME_CRC_LEN)] ^= (unsigned char)(1 << (rand() % 8));
+                m_nCorrupted++;
+            }
+            for(nIdx = 0; nIdx < nLen; nIdx++) {
+                m_dRxFree += m_dByteTime;
+                rxByte.dTime = m_dRxFree;
+                rxByte.cByte = cReply[nIdx];
+                m_FromDrive.push_back(rxByte);
+            }
+        }
+        m_ToDrive.pop_front();
+    }
+    m_Simulator.update(dNow);
+}
+
+int CSimTransport::readFile(void *pBuffer, unsigned long ulLen, unsigned long &ulBytesRead, unsigned long ulTimeoutMs)
+{
+    unsigned char *pBytes = (unsigned char *)pBuffer;
+    double dDeadline = now() + ulTimeoutMs / 1000.0;
+    double dNow;
+    double dWake;
+
+    ulBytesRead = 0;
+    while(true) {
+        dNow = now();
+        pump(dNow);
+        while(ulBytesRead < ulLen && !m_FromDrive.empty() && m_FromDrive.front().dTime <= dNow) {
+            pBytes[ulBytesRead++] = m_FromDrive.front().cByte;
+            m_FromDrive.pop_front();
+        }
+        if(ulBytesRead == ulLen || dNow >= dDeadline)
+            break;
+
+        // sleep until the next byte is through or a pending request reaches the drive
+        dWake = dDeadline;
+        if(!m_FromDrive.empty() && m_FromDrive.front().dTime < dWake)
+            dWake = m_FromDrive.front().dTime;
+        if(!m_ToDrive.empty() && m_ToDrive.front().dTime < dWake)
+            dWake = m_ToDrive.front().dTime;
+        if(dWake > dNow)
+            std::this_thread::sleep_for(std::chrono::duration<double>(dWake - dNow));
+    }
+    return 0;
+}
+
+int CSimTransport::writeFile(const void *pBuffer, unsigned long ulLen, unsigned long &ulBytesWritten)
+{
+    const unsigned char *pBytes = (const unsigned char *)pBuffer;
+    TimedBytes request;
+    double dNow = now();
+
+    if(m_dTxFree < dNow)
+        m_dTxFree = dNow;
+    m_dTxFree += ulLen * m_dByteTime;
+
+    request.dTime = m_dTxFree;
+    request.bytes.assign(pBytes, pBytes + ulLen);
+    m_ToDrive.push_back(request);
+
+    ulBytesWritten = ulLen;
+    return 0;
+}
+
+int CSimTransport::bytesWaitingRx(int &nBytes)
+{
+    double dNow = now();
+    std::deque<TimedByte>::iterator it;
+
+    pump(dNow);
+    nBytes = 0;
+    for(it = m_FromDrive.begin(); it != m_FromDrive.end() && it->dTime <= dNow; ++it)
+        nBytes++;
+    return 0;
+}
+
+int CSimTransport::flushTx()
+{
+    return 0;
+}
+
+int CSimTransport::purgeTxRx()
+{
+    m_ToDrive.clear();
+    m_FromDrive.clear();
+    return 0;
+}
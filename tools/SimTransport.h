@@ -0,0 +1,65 @@
+//
+//  SimTransport.h
+//  AMCDrive X2 plugin tools
+//
+//  In process transport to a CAMCSimulator, in real time. Bytes take the time
+//  they would on a serial line at the given baud rate (10 bits per byte) and
+//  the drive takes nTurnaroundUs to start answering, so round trips measured
+//  through it are close to what the plugin sees on the wire.
+
+#ifndef __SimTransport__
+#define __SimTransport__
+
+#include <deque>
+#include <vector>
+
+#include "../AMCTransport.h"
+#include "AMCSimulator.h"
+
+#define SIM_DEF_BAUD_RATE       115200
+#define SIM_DEF_TURNAROUND_US   500
+
+class CSimTransport : public CAMCTransport
+{
+public:
+    CSimTransport(CAMCSimulator &simulator);
+
+    void    setLineTiming(int nBaudRate, int nTurnaroundUs);
+    // line noise : this fraction of the replies with data get a bit flipped in their data
+    void    setReplyCorruption(double dRate) { m_dCorruptionRate = dRate; }
+    int     getCorruptedCount() { return m_nCorrupted; }
+
+    virtual int open(const char *pszPort);
+    virtual int close();
+    virtual int readFile(void *pBuffer, unsigned long ulLen, unsigned long &ulBytesRead, unsigned long ulTimeoutMs);
+    virtual int writeFile(const void *pBuffer, unsigned long ulLen, unsigned long &ulBytesWritten);
+    virtual int bytesWaitingRx(int &nBytes);
+    virtual int flushTx();
+    virtual int purgeTxRx();
+
+    static double now();
+
+protected:
+    struct TimedBytes {
+        double  dTime;      // when the last byte is through
+        std::vector<unsigned char> bytes;
+    };
+    struct TimedByte {
+        double          dTime;
+        unsigned char   cByte;
+    };
+
+    void    pump(double dNow);
+
+    CAMCSimulator   &m_Simulator;
+    double          m_dByteTime;
+    double          m_dTurnaround;
+    double          m_dTxFree;      // when the line to the drive is free
+    double          m_dRxFree;      // when the line from the drive is free
+    double          m_dCorruptionRate;
+    int             m_nCorrupted;
+    std::deque<TimedBytes> m_ToDrive;
+    std::deque<TimedByte> m_FromDrive;
+};
+
+#endif
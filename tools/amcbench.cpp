@@ -0,0 +1,488 @@
+//
+//  amcbench.cpp
+//  AMCDrive X2 plugin tools
+//
+//  Latency benchmark of CAMCDrive against the in process simulated drive.
+//  Reports command round trip percentiles, status polls per second and the
+//  time from gotoAzimuth to isGoToComplete returning true, split between the
+//  dome motion and the detection lag. Output is JSON.
+//
+//  amcbench [-n iterations] [-b baud] [-t turnaround us] [-p goto poll ms] [-a poller period ms] [-e corruption] [-w cable wrap deg] [-o file] [-c]
+//
+//  -a runs the gotos with the background poller on, see CAMCDrive::nextPollDelay
+//  -e flips a bit in the data of that fraction of the replies (0.01 = 1%)
+//  -w limits the gotos to that many degrees from home either way
+//  -c also writes a wire capture of the run, see tools/amccapdump.cpp
+//
+//  The retarget run is a slaving burst : a goto, then a new target every
+//  BENCH_RETARGET_MS while the dome moves, and the time until it is done.
+//  The follow runs move the slit at BENCH_FOLLOW_RATE, once with a goto every
+//  BENCH_SLAVE_MS like slaving does and once with CAMCDrive::startTracking.
+//  The abort run stops a goto at full speed.
+//  The abort race runs hold the link while a tracking step waits to send its
+//  target and an abort queues its STOP behind it, gotos_after_stop must be 0.
+//  link_wait is how long each request class waited for the link, from the
+//  gotos to the abort, when the poller competes with them.
+//  registers is what CAMCDrive's own histograms saw over the whole run, see AMCStats.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "../AMCDrive.h"
+#include "AMCSimulator.h"
+#include "SimTransport.h"
+
+#define BENCH_DEF_ITERATIONS    500
+#define BENCH_DEF_GOTO_POLL_MS  100     // how often TheSkyX asks if the goto is done
+#define BENCH_POLL_DURATION     2.0     // s
+#define BENCH_GOTO_TIMEOUT      120.0   // s
+#define BENCH_TICKS_PER_REV     SIM_DEF_TICKS_PER_REV
+#define BENCH_RETARGET_START    100.0   // deg
+#define BENCH_RETARGET_STEP     0.5     // deg, between two slaving updates
+#define BENCH_RETARGETS         20
+#define BENCH_RETARGET_MS       50
+#define BENCH_FOLLOW_START      150.0   // deg
+#define BENCH_FOLLOW_RATE       1.0     // deg/s
+#define BENCH_FOLLOW_DURATION   6.0     // s
+#define BENCH_FOLLOW_SAMPLE_MS  100
+#define BENCH_SLAVE_MS          1000
+#define BENCH_ABORT_AFTER_MS    1500    // into a half turn goto
+#define BENCH_STOP_TIMEOUT      5.0     // s
+#define BENCH_RACE_ROUNDS       10
+#define BENCH_RACE_SETTLE_MS    200     // tracking before the race
+#define BENCH_RACE_QUEUE_MS     20      // for a thread to get to the link and wait
+
+// expose the protected commands we time
+class CBenchDrive : public CAMCDrive
+{
+public:
+    using CAMCDrive::getStatus;
+    using CAMCDrive::getDomeAz;
+    using CAMCDrive::gotoTicksPosition;
+    using CAMCDrive::syncTicksPosition;
+    using CAMCDrive::getStatusSnapshot;
+    using CAMCDrive::trackingStep;
+    using CAMCDrive::m_LinkArbiter;
+};
+
+// counts the gotos written after a STOP, while watching
+class CBenchTransport : public CSimTransport
+{
+public:
+    CBenchTransport(CAMCSimulator &simulator) : CSimTransport(simulator), m_bWatching(false), m_bStopSent(false), m_nGotosAfterStop(0) {}
+
+    void    watch(bool bWatching) { m_bWatching = bWatching; m_bStopSent = false; }
+    int     getGotosAfterStop() { return m_nGotosAfterStop; }
+
+    // CAMCDrive writes under its m_IOLock, one thread at a time
+    virtual int writeFile(const void *pBuffer, unsigned long ulLen, unsigned long &ulBytesWritten)
+    {
+        const unsigned char *pFrame = (const unsigned char *)pBuffer;
+
+        if(m_bWatching && ulLen > FRAME_HEADER_LEN + 1 && (pFrame[2] & 0x03) == CB_WRITE) {
+            if(pFrame[3] == BRIDGE_I && ((pFrame[FRAME_HEADER_LEN] | pFrame[FRAME_HEADER_LEN + 1] << 8) & STOP_D))
+                m_bStopSent = true;
+            else if(pFrame[3] == GOTO_I && m_bStopSent)
+                m_nGotosAfterStop++;
+        }
+        return CSimTransport::writeFile(pBuffer, ulLen, ulBytesWritten);
+    }
+
+protected:
+    bool    m_bWatching;
+    bool    m_bStopSent;
+    int     m_nGotosAfterStop;
+};
+
+struct FollowResult {
+    int     nStops;
+    int     nRequests;
+    double  dMeanError;     // deg, between the dome and the slit
+    double  dMaxError;
+};
+
+struct LatencyStats {
+    std::string sName;
+    std::vector<double> samples;    // ms
+};
+
+static double percentile(std::vector<double> &sorted, double dPct)
+{
+    size_t nIdx;
+
+    if(sorted.empty())
+        return 0;
+    nIdx = (size_t)ceil(dPct / 100.0 * sorted.size());
+    if(nIdx)
+        nIdx--;
+    if(nIdx >= sorted.size())
+        nIdx = sorted.size() - 1;
+    return sorted[nIdx];
+}
+
+static void printStats(FILE *pOut, LatencyStats &stats, bool bLast)
+{
+    std::vector<double> sorted = stats.samples;
+    double dSum = 0;
+    size_t nIdx;
+
+    std::sort(sorted.begin(), sorted.end());
+    for(nIdx = 0; nIdx < sorted.size(); nIdx++)
+        dSum += sorted[nIdx];
+
+    fprintf(pOut, "    \"%s\": {\"count\": %u, \"mean_ms\": %.3f, \"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f}%s\n",
+            stats.sName.c_str(), (unsigned)sorted.size(),
+            sorted.empty() ? 0 : dSum / sorted.size(),
+            percentile(sorted, 50), percentile(sorted, 90), percentile(sorted, 99),
+            sorted.empty() ? 0 : sorted.back(), bLast ? "" : ",");
+}
+
+template <class F>
+static void timeCommand(LatencyStats &stats, const char *pszName, int nIterations, F fn)
+{
+    int nIdx;
+    double dStart;
+
+    stats.sName = pszName;
+    for(nIdx = 0; nIdx < nIterations; nIdx++) {
+        dStart = CSimTransport::now();
+        fn(nIdx);
+        stats.samples.push_back((CSimTransport::now() - dStart) * 1000.0);
+    }
+}
+
+/*
+ Move the slit from BENCH_FOLLOW_START at BENCH_FOLLOW_RATE and sample how far
+ the dome is from it, with gotos or with tracking.
+ */
+static void followRun(CBenchDrive &drive, CAMCSimulator &sim, bool bTrack, FollowResult &result)
+{
+    bool bComplete = false;
+    int nStops;
+    int nSamples = 0;
+    double dStart;
+    double dElapsed;
+    double dLastGoto;
+    double dAz;
+    double dError;
+    double dErrorSum = 0;
+
+    memset(&result, 0, sizeof(FollowResult));
+    drive.gotoAzimuth(BENCH_FOLLOW_START);
+    dStart = CSimTransport::now();
+    while(!bComplete && CSimTransport::now() - dStart < BENCH_GOTO_TIMEOUT) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(BENCH_DEF_GOTO_POLL_MS));
+        drive.isGoToComplete(bComplete);
+    }
+
+    nStops = sim.getStopCount();
+    result.nRequests = sim.getRequestCount();
+    dStart = CSimTransport::now();
+    dLastGoto = dStart;
+    if(bTrack)
+        drive.startTracking(BENCH_FOLLOW_START, BENCH_FOLLOW_RATE);
+    while((dElapsed = CSimTransport::now() - dStart) < BENCH_FOLLOW_DURATION) {
+        if(!bTrack && CSimTransport::now() - dLastGoto >= BENCH_SLAVE_MS / 1000.0) {
+            dLastGoto = CSimTransport::now();
+            drive.gotoAzimuth(BENCH_FOLLOW_START + BENCH_FOLLOW_RATE * (dLastGoto - dStart));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(BENCH_FOLLOW_SAMPLE_MS));
+        dElapsed = CSimTransport::now() - dStart;
+        drive.getDomeAz(dAz);
+        dError = fabs(fmod(dAz - BENCH_FOLLOW_START - BENCH_FOLLOW_RATE * dElapsed + 540.0, 360.0) - 180.0);
+        dErrorSum += dError;
+        if(dError > result.dMaxError)
+            result.dMaxError = dError;
+        nSamples++;
+    }
+    if(bTrack)
+        drive.stopTracking();
+    result.nStops = sim.getStopCount() - nStops;
+    result.nRequests = sim.getRequestCount() - result.nRequests;
+    result.dMeanError = nSamples ? dErrorSum / nSamples : 0;
+}
+
+/*
+ An abort that lands while a tracking target waits for the link : we hold
+ the link, a tracking step decides on a new target and waits for it, the
+ abort's STOP queues up too, then we let go. The STOP goes first, the target
+ must not go out after it.
+ */
+static void abortRaceRun(CBenchDrive &drive, CBenchTransport &transport)
+{
+    int nRound;
+    double dAz;
+    StatusSnapshot status;
+    std::thread step;
+    std::thread abort;
+
+    for(nRound = 0; nRound < BENCH_RACE_ROUNDS; nRound++) {
+        drive.getDomeAz(dAz);
+        drive.startTracking(dAz, BENCH_FOLLOW_RATE);
+        std::this_thread::sleep_for(std::chrono::milliseconds(BENCH_RACE_SETTLE_MS));
+        drive.getStatusSnapshot(status, true);
+        transport.watch(true);
+        {
+            CLinkGrant hold(drive.m_LinkArbiter, REQ_TELEMETRY, 0);
+            step = std::thread([&] { drive.trackingStep(status); });
+            std::this_thread::sleep_for(std::chrono::milliseconds(BENCH_RACE_QUEUE_MS));
+            abort = std::thread([&] { drive.abortCurrentCommand(); });
+            std::this_thread::sleep_for(std::chrono::milliseconds(BENCH_RACE_QUEUE_MS));
+        }
+        step.join();
+        abort.join();
+        transport.watch(false);
+    }
+}
+
+static void printFollow(FILE *pOut, const char *pszName, const FollowResult &result, bool bLast)
+{
+    fprintf(pOut, "    \"%s\": {\"dome_stops\": %d, \"requests\": %d, \"mean_error_deg\": %.3f, \"max_error_deg\": %.3f}%s\n",
+            pszName, result.nStops, result.nRequests, result.dMeanError, result.dMaxError, bLast ? "" : ",");
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: amcbench [-n iterations] [-b baud] [-t turnaround us] [-p goto poll ms] [-a poller period ms] [-e corruption] [-w cable wrap deg] [-o file] [-c]\n");
+}
+
+int main(int argc, char **argv)
+{
+    CAMCSimulator sim;
+    CBenchTransport transport(sim);
+    CBenchDrive drive;
+    int nIterations = BENCH_DEF_ITERATIONS;
+    int nBaud = SIM_DEF_BAUD_RATE;
+    int nTurnaroundUs = SIM_DEF_TURNAROUND_US;
+    int nGotoPollMs = BENCH_DEF_GOTO_POLL_MS;
+    int nPollerMs = 0;
+    int nGotoRequests;
+    uint32_t nGotoPolls;
+    double dCorruption = 0;
+    double dCableWrap = 0;
+    const char *pszOutput = NULL;
+    bool bCapture = false;
+    FILE *pOut = stdout;
+    int nOpt;
+    int nErr;
+    size_t nIdx;
+    double dAz;
+    double dStart;
+    double dDone;
+    double dMotionDone;
+    int nPolls;
+    bool bComplete;
+    StatusSnapshot status;
+    std::vector<LatencyStats> commands(5);
+    LatencyStats gotoTotal, gotoMotion, gotoLag;
+    const double dTargets[] = {30.0, 120.0, 200.0, 190.0, 10.0, 350.0};
+    int nRetargetRequests;
+    int nRetargets;
+    int nCoalesced;
+    double dRetargetTotal;
+    double dRetargetAz;
+    FollowResult slaved, tracked;
+    double dAbortCall;
+    TrackingStats trackStats;
+    LinkClassStats linkStats[REQ_NB_CLASSES];
+    int nRegisters;
+    const char *pszClassNames[REQ_NB_CLASSES] = {"safety", "motion", "telemetry"};
+
+    while((nOpt = getopt(argc, argv, "n:b:t:p:a:e:w:o:c")) != -1) {
+        switch(nOpt) {
+            case 'n': nIterations = atoi(optarg); break;
+            case 'b': nBaud = atoi(optarg); break;
+            case 't': nTurnaroundUs = atoi(optarg); break;
+            case 'p': nGotoPollMs = atoi(optarg); break;
+            case 'a': nPollerMs = atoi(optarg); break;
+            case 'e': dCorruption = atof(optarg); break;
+            case 'w': dCableWrap = atof(optarg); break;
+            case 'o': pszOutput = optarg; break;
+            case 'c': bCapture = true; break;
+            default: usage(); return 1;
+        }
+    }
+
+    transport.setLineTiming(nBaud, nTurnaroundUs);
+    transport.setReplyCorruption(dCorruption);
+    drive.setTransport(&transport);
+    drive.setDebugLog(false);
+    drive.setNbTicksPerRev(BENCH_TICKS_PER_REV);
+    drive.setCableWrapLimit(dCableWrap);
+    drive.setWireCapture(bCapture);
+    nErr = drive.Connect("sim");
+    if(nErr) {
+        fprintf(stderr, "amcbench: Connect failed (%d)\n", nErr);
+        return 1;
+    }
+
+    // round trips
+    timeCommand(commands[0], "getStatus", nIterations, [&](int) { drive.getStatus(STATUS_2_O); });
+    timeCommand(commands[1], "getDomeAz", nIterations, [&](int) { drive.getDomeAz(dAz); });
+    timeCommand(commands[2], "gotoTicksPosition", nIterations, [&](int n) { drive.gotoTicksPosition(n & 1); });
+    timeCommand(commands[3], "syncTicksPosition", nIterations, [&](int n) { drive.syncTicksPosition(n & 1); });
+    timeCommand(commands[4], "abortCurrentCommand", nIterations, [&](int) { drive.abortCurrentCommand(); });
+
+    // polls per second, what the poller does
+    nPolls = 0;
+    dStart = CSimTransport::now();
+    while(CSimTransport::now() - dStart < BENCH_POLL_DURATION) {
+        drive.getStatusSnapshot(status, true);
+        nPolls++;
+    }
+    dDone = CSimTransport::now() - dStart;
+
+    // goto to completion
+    drive.resetLinkStats();
+    gotoTotal.sName = "goto_total";
+    gotoMotion.sName = "goto_motion";
+    gotoLag.sName = "goto_detection_lag";
+    drive.setPollPeriod(nPollerMs);
+    nGotoRequests = sim.getRequestCount();
+    nGotoPolls = drive.getPollCount();
+    for(nIdx = 0; nIdx < sizeof(dTargets) / sizeof(dTargets[0]); nIdx++) {
+        dStart = CSimTransport::now();
+        drive.gotoAzimuth(dTargets[nIdx]);
+        bComplete = false;
+        while(!bComplete && CSimTransport::now() - dStart < BENCH_GOTO_TIMEOUT) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(nGotoPollMs));
+            drive.isGoToComplete(bComplete);
+        }
+        dMotionDone = sim.getMotionDoneTime();
+        dAz = CSimTransport::now();
+        gotoTotal.samples.push_back((dAz - dStart) * 1000.0);
+        gotoMotion.samples.push_back((dMotionDone - dStart) * 1000.0);
+        gotoLag.samples.push_back((dAz - dMotionDone) * 1000.0);
+    }
+    nGotoRequests = sim.getRequestCount() - nGotoRequests;
+    nGotoPolls = drive.getPollCount() - nGotoPolls;
+
+    // slaving burst
+    nRetargetRequests = sim.getRequestCount();
+    nRetargets = drive.getRetargetCount();
+    nCoalesced = drive.getCoalescedGotoCount();
+    dStart = CSimTransport::now();
+    dRetargetAz = BENCH_RETARGET_START;
+    drive.gotoAzimuth(dRetargetAz);
+    for(nIdx = 0; nIdx < BENCH_RETARGETS; nIdx++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(BENCH_RETARGET_MS));
+        drive.isGoToComplete(bComplete);
+        dRetargetAz += BENCH_RETARGET_STEP;
+        drive.gotoAzimuth(dRetargetAz);
+    }
+    bComplete = false;
+    while(!bComplete && CSimTransport::now() - dStart < BENCH_GOTO_TIMEOUT) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(nGotoPollMs));
+        drive.isGoToComplete(bComplete);
+    }
+    dRetargetTotal = (CSimTransport::now() - dStart) * 1000.0;
+    nRetargetRequests = sim.getRequestCount() - nRetargetRequests;
+    nRetargets = drive.getRetargetCount() - nRetargets;
+    nCoalesced = drive.getCoalescedGotoCount() - nCoalesced;
+    drive.getDomeAz(dAz);
+
+    // following the slit
+    followRun(drive, sim, false, slaved);
+    followRun(drive, sim, true, tracked);
+    drive.getTrackingStats(trackStats);
+
+    // aborts racing a tracking step
+    abortRaceRun(drive, transport);
+
+    // abort at full speed
+    drive.gotoAzimuth(BENCH_FOLLOW_START + 180.0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(BENCH_ABORT_AFTER_MS));
+    dStart = CSimTransport::now();
+    drive.abortCurrentCommand();
+    dAbortCall = (CSimTransport::now() - dStart) * 1000.0;
+    // the poller looks for the stop, we don't read the status
+    while(drive.getStopLatency() < 0 && CSimTransport::now() - dStart < BENCH_STOP_TIMEOUT)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    drive.setPollPeriod(0);
+    for(nIdx = 0; nIdx < REQ_NB_CLASSES; nIdx++)
+        drive.getLinkStats((int)nIdx, linkStats[nIdx]);
+
+    drive.Disconnect();
+
+    if(pszOutput) {
+        pOut = fopen(pszOutput, "w");
+        if(!pOut) {
+            perror("amcbench");
+            return 1;
+        }
+    }
+
+    fprintf(pOut, "{\n");
+    fprintf(pOut, "  \"config\": {\"iterations\": %d, \"baud\": %d, \"turnaround_us\": %d, \"goto_poll_ms\": %d, \"poller_period_ms\": %d, \"corruption\": %g, \"cable_wrap\": %g},\n", nIterations, nBaud, nTurnaroundUs, nGotoPollMs, nPollerMs, dCorruption, drive.getCableWrapLimit());
+    fprintf(pOut, "  \"round_trip\": {\n");
+    for(nIdx = 0; nIdx < commands.size(); nIdx++)
+        printStats(pOut, commands[nIdx], nIdx == commands.size() - 1);
+    fprintf(pOut, "  },\n");
+    fprintf(pOut, "  \"status_polls_per_second\": %.1f,\n", nPolls / dDone);
+    fprintf(pOut, "  \"corrupted_replies\": %d,\n", transport.getCorruptedCount());
+    fprintf(pOut, "  \"goto\": {\n");
+    printStats(pOut, gotoTotal, false);
+    printStats(pOut, gotoMotion, false);
+    printStats(pOut, gotoLag, false);
+    fprintf(pOut, "    \"requests_per_goto\": %.1f,\n", (double)nGotoRequests / gotoTotal.samples.size());
+    fprintf(pOut, "    \"poller_polls_per_goto\": %.1f\n", (double)nGotoPolls / gotoTotal.samples.size());
+    fprintf(pOut, "  },\n");
+    fprintf(pOut, "  \"retarget\": {\n");
+    fprintf(pOut, "    \"updates\": %d,\n", BENCH_RETARGETS);
+    fprintf(pOut, "    \"complete\": %s,\n", bComplete ? "true" : "false");
+    fprintf(pOut, "    \"total_ms\": %.3f,\n", dRetargetTotal);
+    fprintf(pOut, "    \"final_error_deg\": %.3f,\n", fabs(dAz - dRetargetAz));
+    fprintf(pOut, "    \"retargets_sent\": %d,\n", nRetargets);
+    fprintf(pOut, "    \"coalesced\": %d,\n", nCoalesced);
+    fprintf(pOut, "    \"requests\": %d\n", nRetargetRequests);
+    fprintf(pOut, "  },\n");
+    fprintf(pOut, "  \"follow\": {\n");
+    fprintf(pOut, "    \"rate_deg_s\": %.3f,\n", BENCH_FOLLOW_RATE);
+    printFollow(pOut, "gotos", slaved, false);
+    printFollow(pOut, "tracking", tracked, false);
+    fprintf(pOut, "    \"tracking_updates\": %d\n", trackStats.nUpdates);
+    fprintf(pOut, "  },\n");
+    fprintf(pOut, "  \"abort\": {\n");
+    fprintf(pOut, "    \"stop_command_ms\": %d,\n", drive.getStopCommandLatency());
+    fprintf(pOut, "    \"abort_call_ms\": %.3f,\n", dAbortCall);
+    fprintf(pOut, "    \"stop_latency_ms\": %d\n", drive.getStopLatency());
+    fprintf(pOut, "  },\n");
+    fprintf(pOut, "  \"abort_race\": {\"rounds\": %d, \"gotos_after_stop\": %d},\n", BENCH_RACE_ROUNDS, transport.getGotosAfterStop());
+    fprintf(pOut, "  \"registers\": {\n");
+    for(nIdx = 0, nRegisters = 0; nIdx < HIST_NB_REGISTERS; nIdx++)
+        if(drive.getStats().registerHistogram((int)nIdx).count())
+            nRegisters++;
+    for(nIdx = 0; nIdx < HIST_NB_REGISTERS; nIdx++) {
+        const CAMCHistogram &histogram = drive.getStats().registerHistogram((int)nIdx);
+        if(!histogram.count())
+            continue;
+        fprintf(pOut, "    \"%s\": {\"count\": %u, \"p50_us\": %u, \"p99_us\": %u, \"max_us\": %u}%s\n",
+                CAMCStats::registerName((int)nIdx), histogram.count(), histogram.percentileUs(50), histogram.percentileUs(99), histogram.maxUs(),
+                --nRegisters ? "," : "");
+    }
+    fprintf(pOut, "  },\n");
+    fprintf(pOut, "  \"counters\": {");
+    for(nIdx = 0; nIdx < STAT_NB_COUNTERS; nIdx++)
+        fprintf(pOut, "%s\"%s\": %u", nIdx ? ", " : "", CAMCStats::counterName((int)nIdx), drive.getStats().counter((int)nIdx));
+    fprintf(pOut, "},\n");
+    fprintf(pOut, "  \"link_wait\": {\n");
+    for(nIdx = 0; nIdx < REQ_NB_CLASSES; nIdx++)
+        fprintf(pOut, "    \"%s\": {\"granted\": %u, \"missed\": %u, \"mean_ms\": %.3f, \"max_ms\": %.3f}%s\n",
+                pszClassNames[nIdx], linkStats[nIdx].nGranted, linkStats[nIdx].nMissed,
+                linkStats[nIdx].nGranted + linkStats[nIdx].nMissed ? linkStats[nIdx].dTotalWaitMs / (linkStats[nIdx].nGranted + linkStats[nIdx].nMissed) : 0.0,
+                linkStats[nIdx].dMaxWaitMs, nIdx == REQ_NB_CLASSES - 1 ? "" : ",");
+    fprintf(pOut, "  }\n");
+    fprintf(pOut, "}\n");
+
+    if(pOut != stdout)
+        fclose(pOut);
+    return 0;
+}
@@ -0,0 +1,140 @@
+//
+//  amccapdump.cpp
+//  AMCDrive X2 plugin tools
+//
+//  Decodes a wire capture written by the plugin (see AMCCapture.h).
+//  By default prints the per-register round trip statistics, -f also prints
+//  every frame. Linux and macOS only.
+//
+//  amccapdump [-f] capture.bin
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include "CaptureFile.h"
+#include "../AMCRegisters.h"
+
+struct RegisterStats {
+    std::vector<double> latencies;  // ms
+    int nTimeouts;
+    RegisterStats() : nTimeouts(0) {}
+};
+
+static double percentile(const std::vector<double> &sorted, double dPct)
+{
+    size_t nIdx;
+
+    if(sorted.empty())
+        return 0;
+    nIdx = (size_t)(dPct / 100.0 * sorted.size());
+    if(nIdx >= sorted.size())
+        nIdx = sorted.size() - 1;
+    return sorted[nIdx];
+}
+
+static void printFrame(const AMCCaptureFileHeader &header, const AMCCaptureRecord &record)
+{
+    int nLen = record.nFrameLen < CAPTURE_FRAME_BYTES ? record.nFrameLen : CAPTURE_FRAME_BYTES;
+    int nIdx;
+
+    printf("%12.6f %-7s seq %2d", (record.nTimeNs - header.nStartTimeNs) / 1e9, CCaptureFile::directionName(record.cDirection), record.cSeq);
+    if(record.cDirection != CAPTURE_RX_STALE)
+        printf(" %-5s %02X/%02X %-14s", record.cOp == CB_WRITE ? "WRITE" : "READ", record.cIndex, record.cOffset, CCaptureFile::registerName(record));
+    if(record.cDirection == CAPTURE_RX || record.cDirection == CAPTURE_TIMEOUT)
+        printf(" %8.3f ms", record.nLatencyUs / 1000.0);
+    printf(" :");
+    for(nIdx = 0; nIdx < nLen; nIdx++)
+        printf(" %02X", record.cFrame[nIdx]);
+    if(nLen < record.nFrameLen)
+        printf(" ... (%d bytes)", record.nFrameLen);
+    printf("\n");
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: amccapdump [-f] capture.bin\n");
+}
+
+int main(int argc, char **argv)
+{
+    bool bFrames = false;
+    int nOpt;
+    CCaptureFile capture;
+    uint64_t nIdx;
+    uint32_t nKey;
+    int nStale = 0;
+    time_t nStartTime;
+    std::map<uint32_t, RegisterStats> stats;
+    std::map<uint32_t, AMCCaptureRecord> firstRecord;
+    std::map<uint32_t, RegisterStats>::iterator it;
+
+    while((nOpt = getopt(argc, argv, "f")) != -1) {
+        switch(nOpt) {
+            case 'f': bFrames = true; break;
+            default: usage(); return 1;
+        }
+    }
+    if(optind >= argc) {
+        usage();
+        return 1;
+    }
+    if(!capture.open(argv[optind]))
+        return 1;
+
+    nStartTime = (time_t)(capture.header().nStartWallUs / 1000000);
+    printf("capture started %s", ctime(&nStartTime));
+    printf("%llu records", (unsigned long long)capture.count());
+    if(capture.overwritten())
+        printf(", the first %llu were overwritten", (unsigned long long)capture.overwritten());
+    printf("\n\n");
+
+    for(nIdx = 0; nIdx < capture.count(); nIdx++) {
+        const AMCCaptureRecord &record = capture.record(nIdx);
+
+        if(bFrames)
+            printFrame(capture.header(), record);
+        nKey = CCaptureFile::registerKey(record);
+        switch(record.cDirection) {
+            case CAPTURE_RX:
+                stats[nKey].latencies.push_back(record.nLatencyUs / 1000.0);
+                firstRecord.insert(std::make_pair(nKey, record));
+                break;
+            case CAPTURE_TIMEOUT:
+                stats[nKey].nTimeouts++;
+                firstRecord.insert(std::make_pair(nKey, record));
+                break;
+            case CAPTURE_RX_STALE:
+                nStale++;
+                break;
+        }
+    }
+
+    if(bFrames)
+        printf("\n");
+    printf("op    reg   name            count timeouts   mean ms    p50 ms    p90 ms    p99 ms    max ms\n");
+    for(it = stats.begin(); it != stats.end(); ++it) {
+        std::vector<double> &latencies = it->second.latencies;
+        const AMCCaptureRecord &record = firstRecord[it->first];
+        double dSum = 0;
+        size_t nSample;
+
+        std::sort(latencies.begin(), latencies.end());
+        for(nSample = 0; nSample < latencies.size(); nSample++)
+            dSum += latencies[nSample];
+        printf("%-5s %02X/%02X %-14s %6u %8d %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+               record.cOp == CB_WRITE ? "WRITE" : "READ", record.cIndex, record.cOffset, CCaptureFile::registerName(record),
+               (unsigned)latencies.size(), it->second.nTimeouts,
+               latencies.empty() ? 0 : dSum / latencies.size(),
+               percentile(latencies, 50), percentile(latencies, 90), percentile(latencies, 99),
+               latencies.empty() ? 0 : latencies.back());
+    }
+    printf("\n%d stale replies\n", nStale);
+
+    return 0;
+}
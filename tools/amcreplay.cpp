@@ -0,0 +1,206 @@
+//
+//  amcreplay.cpp
+//  AMCDrive X2 plugin tools
+//
+//  Re-runs the goto, home or park state machine of CAMCDrive against a wire
+//  capture (see AMCCapture.h and ReplayTransport.h) and reports how many
+//  round trips and how much time it took. Output is JSON.
+//
+//  amcreplay [-r] [-p poll ms] [-t ticks/rev] [-z home az] [-s start s] [-o file] (-g az | -H | -P az) capture.bin
+//
+//  -r replays at the recorded pace, otherwise as fast as possible
+//  -g goto az, -H find home, -P park at az : the command the capture was recorded with
+//  -s where to start in the capture, in seconds from its start. By default the
+//     first time the command was sent (to the same azimuth for a goto or park).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <chrono>
+#include <thread>
+
+#include "../AMCDrive.h"
+#include "CaptureFile.h"
+#include "ReplayTransport.h"
+
+#define REPLAY_DEF_TICKS_PER_REV    969840
+#define REPLAY_DEF_POLL_MS          500     // realtime, how often TheSkyX asks if the command is done
+#define REPLAY_FAST_POLL_MS         1
+#define REPLAY_TIMEOUT              300.0   // s, of replayed time
+#define REPLAY_AZ_MATCH             0.5     // deg, finding the recorded goto
+
+enum ReplayScenario {SCENARIO_NONE = 0, SCENARIO_GOTO, SCENARIO_HOME, SCENARIO_PARK};
+
+static const char *scenarioName(int nScenario)
+{
+    switch(nScenario) {
+        case SCENARIO_GOTO: return "goto";
+        case SCENARIO_HOME: return "home";
+        case SCENARIO_PARK: return "park";
+        default:            return "";
+    }
+}
+
+/*
+ First time the capture shows the scenario's command being sent, 0 if it never does.
+ For a goto or a park it has to be to the same azimuth.
+ */
+static uint64_t findCommand(const CCaptureFile &capture, int nScenario, double dAz, double dHomeAz, int nTicksPerRev)
+{
+    uint64_t nIdx;
+    int32_t nTicks;
+    double dTargetAz;
+
+    for(nIdx = 0; nIdx < capture.count(); nIdx++) {
+        const AMCCaptureRecord &record = capture.record(nIdx);
+        if(record.cDirection != CAPTURE_TX || record.cOp != CB_WRITE)
+            continue;
+        if(nScenario == SCENARIO_HOME) {
+            if(record.cIndex == BRIDGE_I && record.nRequestData == HOME_D)
+                return record.nTimeNs;
+        }
+        else if(record.cIndex == GOTO_I && record.nFrameLen >= GotoReg::nWriteFrameLen) {
+            nTicks = (int32_t)((uint32_t)record.cFrame[FRAME_HEADER_LEN] | (uint32_t)record.cFrame[FRAME_HEADER_LEN + 1] << 8 |
+                               (uint32_t)record.cFrame[FRAME_HEADER_LEN + 2] << 16 | (uint32_t)record.cFrame[FRAME_HEADER_LEN + 3] << 24);
+            dTargetAz = fmod(dHomeAz + nTicks * 360.0 / nTicksPerRev + 720.0, 360.0);
+            if(fabs(dTargetAz - dAz) < REPLAY_AZ_MATCH || fabs(dTargetAz - dAz) > 360.0 - REPLAY_AZ_MATCH)
+                return record.nTimeNs;
+        }
+    }
+    return 0;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: amcreplay [-r] [-p poll ms] [-t ticks/rev] [-z home az] [-s start s] [-o file] (-g az | -H | -P az) capture.bin\n");
+}
+
+int main(int argc, char **argv)
+{
+    CCaptureFile capture;
+    CAMCDrive drive;
+    int nMode = REPLAY_FAST;
+    int nScenario = SCENARIO_NONE;
+    int nPollMs = -1;
+    int nTicksPerRev = REPLAY_DEF_TICKS_PER_REV;
+    double dHomeAz = 0;
+    double dAz = 0;
+    double dStart = -1;
+    const char *pszOutput = NULL;
+    FILE *pOut = stdout;
+    int nOpt;
+    int nErr;
+    int nPolls = 0;
+    bool bComplete = false;
+    uint64_t nStartNs;
+    double dWallStart;
+    double dWall;
+    ReplayCounters counters;
+
+    while((nOpt = getopt(argc, argv, "rp:t:z:s:o:g:HP:")) != -1) {
+        switch(nOpt) {
+            case 'r': nMode = REPLAY_REALTIME; break;
+            case 'p': nPollMs = atoi(optarg); break;
+            case 't': nTicksPerRev = atoi(optarg); break;
+            case 'z': dHomeAz = atof(optarg); break;
+            case 's': dStart = atof(optarg); break;
+            case 'o': pszOutput = optarg; break;
+            case 'g': nScenario = SCENARIO_GOTO; dAz = atof(optarg); break;
+            case 'H': nScenario = SCENARIO_HOME; break;
+            case 'P': nScenario = SCENARIO_PARK; dAz = atof(optarg); break;
+            default: usage(); return 1;
+        }
+    }
+    if(optind >= argc || nScenario == SCENARIO_NONE) {
+        usage();
+        return 1;
+    }
+    if(!capture.open(argv[optind]))
+        return 1;
+    if(nPollMs < 0)
+        nPollMs = nMode == REPLAY_REALTIME ? REPLAY_DEF_POLL_MS : 0;
+
+    if(dStart >= 0)
+        nStartNs = capture.header().nStartTimeNs + (uint64_t)(dStart * 1e9);
+    else {
+        nStartNs = findCommand(capture, nScenario, dAz, dHomeAz, nTicksPerRev);
+        if(!nStartNs) {
+            fprintf(stderr, "amcreplay: the capture has no %s command, use -s\n", scenarioName(nScenario));
+            return 1;
+        }
+    }
+
+    CReplayTransport transport(capture, nMode);
+
+    drive.setTransport(&transport);
+    drive.setDebugLog(false);
+    drive.setNbTicksPerRev(nTicksPerRev);
+    drive.setHomeAz(dHomeAz);
+    drive.setParkAz(dAz);
+    nErr = drive.Connect("replay");
+    if(nErr) {
+        fprintf(stderr, "amcreplay: Connect failed (%d)\n", nErr);
+        return 1;
+    }
+
+    transport.setCursor(nStartNs);
+    transport.resetCounters();
+    dWallStart = CReplayTransport::now();
+    switch(nScenario) {
+        case SCENARIO_GOTO: nErr = drive.gotoAzimuth(dAz); break;
+        case SCENARIO_HOME: nErr = drive.goHome(); break;
+        case SCENARIO_PARK: nErr = drive.parkDome(); break;
+    }
+
+    while(!nErr && !bComplete) {
+        // replayed time, in fast mode that's how far the cursor went
+        if(nMode == REPLAY_FAST && transport.getCursor() > nStartNs && (transport.getCursor() - nStartNs) / 1e9 > REPLAY_TIMEOUT)
+            break;
+        if(nMode == REPLAY_REALTIME && CReplayTransport::now() - dWallStart > REPLAY_TIMEOUT)
+            break;
+        if(nPollMs)
+            std::this_thread::sleep_for(std::chrono::milliseconds(nPollMs));
+        else
+            std::this_thread::sleep_for(std::chrono::milliseconds(REPLAY_FAST_POLL_MS));
+        switch(nScenario) {
+            case SCENARIO_GOTO: nErr = drive.isGoToComplete(bComplete); break;
+            case SCENARIO_HOME: nErr = drive.isFindHomeComplete(bComplete); break;
+            case SCENARIO_PARK: nErr = drive.isParkComplete(bComplete); break;
+        }
+        nPolls++;
+    }
+    dWall = CReplayTransport::now() - dWallStart;
+    transport.getCounters(counters);
+
+    drive.Disconnect();
+
+    if(pszOutput) {
+        pOut = fopen(pszOutput, "w");
+        if(!pOut) {
+            perror("amcreplay");
+            return 1;
+        }
+    }
+
+    fprintf(pOut, "{\n");
+    fprintf(pOut, "  \"scenario\": \"%s\",\n", scenarioName(nScenario));
+    fprintf(pOut, "  \"mode\": \"%s\",\n", nMode == REPLAY_REALTIME ? "realtime" : "fast");
+    fprintf(pOut, "  \"start_s\": %.3f,\n", (nStartNs - capture.header().nStartTimeNs) / 1e9);
+    fprintf(pOut, "  \"complete\": %s,\n", bComplete ? "true" : "false");
+    fprintf(pOut, "  \"error\": %d,\n", nErr);
+    fprintf(pOut, "  \"completion_polls\": %d,\n", nPolls);
+    fprintf(pOut, "  \"round_trips\": %d,\n", counters.nReads + counters.nWrites);
+    fprintf(pOut, "  \"reads\": %d,\n", counters.nReads);
+    fprintf(pOut, "  \"writes\": %d,\n", counters.nWrites);
+    fprintf(pOut, "  \"unanswered\": %d,\n", counters.nUnanswered);
+    fprintf(pOut, "  \"replayed_s\": %.3f,\n", nMode == REPLAY_REALTIME ? dWall : (transport.getCursor() > nStartNs ? (transport.getCursor() - nStartNs) / 1e9 : 0.0));
+    fprintf(pOut, "  \"wall_ms\": %.3f,\n", dWall * 1000.0);
+    fprintf(pOut, "  \"link_ms\": %.3f\n", counters.dLinkTime * 1000.0);
+    fprintf(pOut, "}\n");
+
+    if(pOut != stdout)
+        fclose(pOut);
+    return bComplete ? 0 : 2;
+}
@@ -0,0 +1,133 @@
+//
+//  amcsim.cpp
+//  AMCDrive X2 plugin tools
+//
+//  Runs the virtual AMC drive on a pseudo terminal so the plugin (or anything
+//  else talking to a serial port) can connect to it as if it was a real drive.
+//  Linux and macOS only.
+//
+//  amcsim [-l link] [-t ticks/rev] [-v max velocity] [-a acceleration] [-h home sensor] [-b baud]
+//
+//  The slave side of the pty is printed on stdout, -l also creates a symlink to it.
+//  -b paces the replies at the given baud rate (10 bits per byte), 0 sends them at once.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <errno.h>
+#include <chrono>
+
+#include "AMCSimulator.h"
+
+static volatile sig_atomic_t bRunning = 1;
+
+static void onSignal(int)
+{
+    bRunning = 0;
+}
+
+static double nowSeconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: amcsim [-l link] [-t ticks/rev] [-v max velocity] [-a acceleration] [-h home sensor] [-b baud]\n");
+}
+
+int main(int argc, char **argv)
+{
+    CAMCSimulator sim;
+    AMCSimConfig config;
+    const char *pszLink = NULL;
+    int nBaud = 115200;
+    int nOpt;
+    int nMaster;
+    int nSlave;
+    char *pszSlave;
+    struct termios tio;
+    struct pollfd pfd;
+    unsigned char cBuf[512];
+    ssize_t nRead;
+    int nLen;
+    double dNextTx = 0;
+    double dNow;
+
+    sim.getConfig(config);
+    while((nOpt = getopt(argc, argv, "l:t:v:a:h:b:")) != -1) {
+        switch(nOpt) {
+            case 'l': pszLink = optarg; break;
+            case 't': config.nTicksPerRev = atoi(optarg); break;
+            case 'v': config.dMaxVelocity = atof(optarg); break;
+            case 'a': config.dAcceleration = atof(optarg); break;
+            case 'h': config.nHomeSensor = atoi(optarg); break;
+            case 'b': nBaud = atoi(optarg); break;
+            default: usage(); return 1;
+        }
+    }
+    sim.setConfig(config);
+
+    nMaster = posix_openpt(O_RDWR | O_NOCTTY);
+    if(nMaster < 0 || grantpt(nMaster) || unlockpt(nMaster) || !(pszSlave = ptsname(nMaster))) {
+        perror("amcsim: pty");
+        return 1;
+    }
+
+    // keep the slave open ourself so the master doesn't see EIO between client sessions
+    nSlave = open(pszSlave, O_RDWR | O_NOCTTY);
+    if(nSlave < 0) {
+        perror("amcsim: slave");
+        return 1;
+    }
+    tcgetattr(nSlave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(nSlave, TCSANOW, &tio);
+
+    if(pszLink) {
+        unlink(pszLink);
+        if(symlink(pszSlave, pszLink))
+            perror("amcsim: symlink");
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    printf("%s\n", pszSlave);
+    fflush(stdout);
+
+    pfd.fd = nMaster;
+    pfd.events = POLLIN;
+    while(bRunning) {
+        if(poll(&pfd, 1, 1) < 0 && errno != EINTR)
+            break;
+
+        dNow = nowSeconds();
+        if(pfd.revents & POLLIN) {
+            nRead = read(nMaster, cBuf, sizeof(cBuf));
+            if(nRead > 0)
+                sim.receive(cBuf, (int)nRead, dNow);
+        }
+        sim.update(dNow);
+
+        // pace the replies like the wire would
+        while(sim.bytesPending() && dNow >= dNextTx) {
+            nLen = sim.transmit(cBuf, nBaud ? 16 : (int)sizeof(cBuf));
+            if(write(nMaster, cBuf, nLen) != nLen)
+                break;
+            if(nBaud)
+                dNextTx = dNow + nLen * 10.0 / nBaud;
+        }
+    }
+
+    if(pszLink)
+        unlink(pszLink);
+    close(nSlave);
+    close(nMaster);
+    return 0;
+}
@@ -0,0 +1,106 @@
+//
+//  crcbench.cpp
+//  AMCDrive X2 plugin tools
+//
+//  Microbenchmark of the X-Modem CRC : libcrc's crc_xmodem (byte at a time)
+//  against CAMCCRC (slice-by-4), on the frame sizes the plugin sees, and
+//  CAMCCRC fed one byte at a time like the RX decoder does on a slow link.
+//  Checks that they all agree first. Output is JSON.
+//
+//  crcbench [-n iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+#include <vector>
+
+extern "C" {
+#include "../checksum.h"
+}
+#include "../AMCCRC.h"
+
+#define CRCBENCH_DEF_ITERATIONS 2000000
+
+static volatile uint16_t g_nSink;   // keeps the compiler from dropping the loops
+
+static double now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template <class F>
+static double timeCRC(int nIterations, F fn)
+{
+    int nIdx;
+    uint16_t nCRC = 0;
+    double dStart = now();
+
+    for(nIdx = 0; nIdx < nIterations; nIdx++)
+        nCRC ^= fn();
+    g_nSink = nCRC;
+    return (now() - dStart) * 1e9 / nIterations;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: crcbench [-n iterations]\n");
+}
+
+int main(int argc, char **argv)
+{
+    // header CRC, 1 and 2 word registers, status block, firmware string
+    const size_t nSizes[] = {6, 2, 4, 16, 256};
+    int nIterations = CRCBENCH_DEF_ITERATIONS;
+    int nOpt;
+    size_t nIdx;
+    size_t nByte;
+    std::vector<unsigned char> data(256);
+    double dLibcrc, dSliced, dBytewise;
+
+    while((nOpt = getopt(argc, argv, "n:")) != -1) {
+        switch(nOpt) {
+            case 'n': nIterations = atoi(optarg); break;
+            default: usage(); return 1;
+        }
+    }
+
+    srand(1);
+    for(nByte = 0; nByte < data.size(); nByte++)
+        data[nByte] = (unsigned char)rand();
+
+    for(nIdx = 0; nIdx <= data.size(); nIdx++) {
+        CAMCCRC crc;
+        for(nByte = 0; nByte < nIdx; nByte++)
+            crc.update(data[nByte]);
+        if(crc_xmodem(data.data(), nIdx) != CAMCCRC::xmodem(data.data(), nIdx) || crc.value() != CAMCCRC::xmodem(data.data(), nIdx)) {
+            fprintf(stderr, "crcbench: CRC mismatch on %u bytes\n", (unsigned)nIdx);
+            return 1;
+        }
+    }
+
+    printf("{\n");
+    printf("  \"iterations\": %d,\n", nIterations);
+    printf("  \"ns_per_crc\": [\n");
+    for(nIdx = 0; nIdx < sizeof(nSizes) / sizeof(nSizes[0]); nIdx++) {
+        size_t nLen = nSizes[nIdx];
+        unsigned char *pData = data.data();
+
+        dLibcrc = timeCRC(nIterations, [&]() { pData[0]++; return crc_xmodem(pData, nLen); });
+        dSliced = timeCRC(nIterations, [&]() { pData[0]++; return CAMCCRC::xmodem(pData, nLen); });
+        dBytewise = timeCRC(nIterations, [&]() {
+            CAMCCRC crc;
+            size_t nPos;
+            pData[0]++;
+            for(nPos = 0; nPos < nLen; nPos++)
+                crc.update(pData[nPos]);
+            return crc.value();
+        });
+        printf("    {\"bytes\": %u, \"libcrc\": %.2f, \"slice_by_4\": %.2f, \"incremental\": %.2f, \"speedup\": %.2f}%s\n",
+               (unsigned)nLen, dLibcrc, dSliced, dBytewise, dSliced > 0 ? dLibcrc / dSliced : 0,
+               nIdx == sizeof(nSizes) / sizeof(nSizes[0]) - 1 ? "" : ",");
+    }
+    printf("  ]\n");
+    printf("}\n");
+    return 0;
+}
@@ -25,6 +25,7 @@ X2Dome::X2Dome(const char* pszSelection,
     m_bHomingDome = false;
     m_bCalibratingDome = false;
     m_nBattRequest = 0;
+    m_nBusy = 0;
     
     m_AMCDrive.setSerxPointer(pSerX);
     m_AMCDrive.setSleeprPinter(pSleeper);
@@ -35,7 +36,17 @@ X2Dome::X2Dome(const char* pszSelection,
         m_AMCDrive.setHomeAz( m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_HOME_AZ, 0) );
         m_AMCDrive.setParkAz( m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_PARK_AZ, 0) );
         m_AMCDrive.setNbTicksPerRev( m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_TICKS_PER_REV, 969840) );
+        m_AMCDrive.setCableWrapLimit( m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_CABLE_WRAP_LIMIT, 0) );
+        // arcminutes
+        m_AMCDrive.setGotoTolerance( m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_GOTO_TOLERANCE, DEF_GOTO_TOLERANCE_ARCMIN) );
         m_bHasShutterControl = m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_SHUTTER_CONTROL, false);
+        // set to 1 for drives that can't queue requests
+        m_AMCDrive.setMaxRequestsInFlight( m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_MAX_IN_FLIGHT, DEF_MAX_IN_FLIGHT) );
+        m_AMCDrive.setSnapshotMaxAge( m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_SNAPSHOT_MAX_AGE, DEF_SNAPSHOT_MAX_AGE) );
+        m_AMCDrive.setPollPeriod( m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_POLL_PERIOD, 0) );
+        // off, errors, info, frame trace
+        m_AMCDrive.setLogLevel( m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_LOG_LEVEL, DEF_LOG_LEVEL) );
+        m_AMCDrive.setWireCapture( m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_WIRE_CAPTURE, false) );
     }
 
 }
@@ -69,7 +80,7 @@ int X2Dome::establishLink(void)
     int nErr;
     char szPort[DRIVER_MAX_STRING];
 
-    X2MutexLocker ml(GetMutex());
+    X2BusyMutexLocker ml(GetMutex(), m_nBusy);
     // get serial port device name
     portNameOnToCharPtr(szPort,DRIVER_MAX_STRING);
     nErr = m_AMCDrive.Connect(szPort);
@@ -85,7 +96,7 @@ int X2Dome::establishLink(void)
 
 int X2Dome::terminateLink(void)					
 {
-    X2MutexLocker ml(GetMutex());
+    X2BusyMutexLocker ml(GetMutex(), m_nBusy);
     m_AMCDrive.Disconnect();
 	m_bLinked = false;
 	return SB_OK;
@@ -125,7 +136,12 @@ int X2Dome::execModalSettingsDialog()
     char szTmpBuf[SERIAL_BUFFER_SIZE];
     double dHomeAz;
     double dParkAz;
+    double dCableWrapLimit;
+    double dGotoTolerance;
     int nTicksPerRev;
+    int nPollPeriod;
+    int nLogLevel;
+    std::string sStats;
 
     if (NULL == ui)
         return ERR_POINTER;
@@ -136,7 +152,7 @@ int X2Dome::execModalSettingsDialog()
     if (NULL == (dx = uiutil.X2DX()))
         return ERR_POINTER;
 
-    X2MutexLocker ml(GetMutex());
+    X2BusyMutexLocker ml(GetMutex(), m_nBusy);
 
     memset(szTmpBuf,0,SERIAL_BUFFER_SIZE);
     // set controls state depending on the connection state
@@ -161,6 +177,13 @@ int X2Dome::execModalSettingsDialog()
     dx->setPropertyInt("ticksPerRev","value", nTicksPerRev);
     dx->setPropertyDouble("homePosition","value", m_AMCDrive.getHomeAz());
     dx->setPropertyDouble("parkPosition","value", m_AMCDrive.getParkAz());
+    dx->setPropertyDouble("cableWrap","value", m_AMCDrive.getCableWrapLimit());
+    dx->setPropertyDouble("gotoTolerance","value", m_AMCDrive.getGotoTolerance());
+    dx->setPropertyInt("pollPeriod","value", m_AMCDrive.getPollPeriod());
+    dx->setCurrentIndex("logLevel", m_AMCDrive.getLogLevel());
+    dx->setChecked("wireCapture", m_AMCDrive.getWireCapture());
+    m_AMCDrive.getStats().summary(sStats);
+    dx->setPropertyString("linkStats", "text", sStats.c_str());
 
     m_bHomingDome = false;
     m_nBattRequest = 0;
@@ -174,18 +197,32 @@ int X2Dome::execModalSettingsDialog()
     if (bPressedOK) {
         dx->propertyDouble("homePosition", "value", dHomeAz);
         dx->propertyDouble("parkPosition", "value", dParkAz);
+        dx->propertyDouble("cableWrap", "value", dCableWrapLimit);
+        dx->propertyDouble("gotoTolerance", "value", dGotoTolerance);
         dx->propertyInt("ticksPerRev","value", nTicksPerRev);
+        dx->propertyInt("pollPeriod","value", nPollPeriod);
+        nLogLevel = dx->currentIndex("logLevel");
 
         m_bHasShutterControl = dx->isChecked("hasShutterCtrl");
         m_AMCDrive.setHomeAz(dHomeAz);
         m_AMCDrive.setParkAz(dParkAz);
+        m_AMCDrive.setCableWrapLimit(dCableWrapLimit);
+        m_AMCDrive.setGotoTolerance(dGotoTolerance);
         m_AMCDrive.setNbTicksPerRev(nTicksPerRev);
+        m_AMCDrive.setPollPeriod(nPollPeriod);
+        m_AMCDrive.setLogLevel(nLogLevel);
+        m_AMCDrive.setWireCapture(dx->isChecked("wireCapture"));
 
         // save the values to persistent storage
         nErr |= m_pIniUtil->writeDouble(PARENT_KEY, CHILD_KEY_HOME_AZ, dHomeAz);
         nErr |= m_pIniUtil->writeDouble(PARENT_KEY, CHILD_KEY_PARK_AZ, dParkAz);
+        nErr |= m_pIniUtil->writeDouble(PARENT_KEY, CHILD_KEY_CABLE_WRAP_LIMIT, m_AMCDrive.getCableWrapLimit());
+        nErr |= m_pIniUtil->writeDouble(PARENT_KEY, CHILD_KEY_GOTO_TOLERANCE, m_AMCDrive.getGotoTolerance());
         nErr |= m_pIniUtil->writeInt(PARENT_KEY, CHILD_KEY_TICKS_PER_REV, nTicksPerRev);
         nErr |= m_pIniUtil->writeInt(PARENT_KEY, CHILD_KEY_SHUTTER_CONTROL, m_bHasShutterControl);
+        nErr |= m_pIniUtil->writeInt(PARENT_KEY, CHILD_KEY_POLL_PERIOD, m_AMCDrive.getPollPeriod());
+        nErr |= m_pIniUtil->writeInt(PARENT_KEY, CHILD_KEY_LOG_LEVEL, m_AMCDrive.getLogLevel());
+        nErr |= m_pIniUtil->writeInt(PARENT_KEY, CHILD_KEY_WIRE_CAPTURE, m_AMCDrive.getWireCapture());
     }
     return nErr;
 
@@ -197,12 +234,15 @@ void X2Dome::uiEvent(X2GUIExchangeInterface* uiex, const char* pszEvent)
     int nErr;
     char szTmpBuf[SERIAL_BUFFER_SIZE];    
     char szErrorMessage[LOG_BUFFER_SIZE];
+    std::string sStats;
 
     if (!strcmp(pszEvent, "on_pushButtonCancel_clicked"))
         m_AMCDrive.abortCurrentCommand();
 
     if (!strcmp(pszEvent, "on_timer"))
     {
+        m_AMCDrive.getStats().summary(sStats);
+        uiex->setPropertyString("linkStats", "text", sStats.c_str());
         m_bHasShutterControl = uiex->isChecked("hasShutterCtrl");
         if(m_bLinked) {
             // are we going to Home position to calibrate ?
@@ -258,6 +298,18 @@ void X2Dome::uiEvent(X2GUIExchangeInterface* uiex, const char* pszEvent)
         }
     }
 
+    if (!strcmp(pszEvent, "on_pushButtonResetStats_clicked"))
+        m_AMCDrive.getStats().reset();
+
+    if (!strcmp(pszEvent, "on_pushButtonDumpStats_clicked"))
+    {
+        if(m_AMCDrive.dumpStats() == OK)
+            snprintf(szErrorMessage, LOG_BUFFER_SIZE, "Link statistics written to %s", m_AMCDrive.getStatsPath().c_str());
+        else
+            snprintf(szErrorMessage, LOG_BUFFER_SIZE, "Can't write %s", m_AMCDrive.getStatsPath().c_str());
+        uiex->messageBox("AMCDrive Link statistics", szErrorMessage);
+    }
+
     if (!strcmp(pszEvent, "on_pushButton_clicked"))
     {
         if(m_bLinked) {
@@ -355,7 +407,18 @@ int X2Dome::dapiGetAzEl(double* pdAz, double* pdEl)
     if(!m_bLinked)
         return ERR_NOLINK;
 
-    X2MutexLocker ml(GetMutex());
+    DomeState domeState;
+
+    // never wait behind a slew or another command, answer from the published state
+    m_AMCDrive.getDomeState(domeState);
+    if(domeState.bValid && (m_nBusy || m_AMCDrive.isDomeStateFresh(domeState))) {
+        *pdAz = domeState.dAz;
+        *pdEl = domeState.dEl;
+        return SB_OK;
+    }
+
+    X2BusyMutexLocker ml(GetMutex(), m_nBusy);
+    CAMCCallTimer holdTime(m_AMCDrive.getStats(), STAT_CALL_GET_AZ_EL);
 
     *pdAz = m_AMCDrive.getCurrentAz();
     *pdEl = m_AMCDrive.getCurrentEl();
@@ -369,7 +432,7 @@ int X2Dome::dapiGotoAzEl(double dAz, double dEl)
     if(!m_bLinked)
         return ERR_NOLINK;
 
-    X2MutexLocker ml(GetMutex());
+    X2BusyMutexLocker ml(GetMutex(), m_nBusy);
 
 
     nErr = m_AMCDrive.gotoAzimuth(dAz);
@@ -386,7 +449,7 @@ int X2Dome::dapiAbort(void)
     if(!m_bLinked)
         return ERR_NOLINK;
 
-    X2MutexLocker ml(GetMutex());
+    X2BusyMutexLocker ml(GetMutex(), m_nBusy);
 
     m_AMCDrive.abortCurrentCommand();
 
@@ -400,7 +463,7 @@ int X2Dome::dapiOpen(void)
     if(!m_bLinked)
         return ERR_NOLINK;
 
-    X2MutexLocker ml(GetMutex());
+    X2BusyMutexLocker ml(GetMutex(), m_nBusy);
 
 
     if(!m_bHasShutterControl)
@@ -420,7 +483,7 @@ int X2Dome::dapiClose(void)
     if(!m_bLinked)
         return ERR_NOLINK;
 
-    X2MutexLocker ml(GetMutex());
+    X2BusyMutexLocker ml(GetMutex(), m_nBusy);
 
 
     if(!m_bHasShutterControl)
@@ -440,7 +503,7 @@ int X2Dome::dapiPark(void)
     if(!m_bLinked)
         return ERR_NOLINK;
 
-    X2MutexLocker ml(GetMutex());
+    X2BusyMutexLocker ml(GetMutex(), m_nBusy);
 
     /*
     if(m_bHasShutterControl)
@@ -465,7 +528,7 @@ int X2Dome::dapiUnpark(void)
     if(!m_bLinked)
         return ERR_NOLINK;
 
-    X2MutexLocker ml(GetMutex());
+    X2BusyMutexLocker ml(GetMutex(), m_nBusy);
 
     /*
     if(m_bHasShutterControl)
@@ -490,7 +553,7 @@ int X2Dome::dapiFindHome(void)
     if(!m_bLinked)
         return ERR_NOLINK;
 
-    X2MutexLocker ml(GetMutex());
+    X2BusyMutexLocker ml(GetMutex(), m_nBusy);
 
     nErr = m_AMCDrive.goHome();
     if(nErr)
@@ -506,7 +569,8 @@ int X2Dome::dapiIsGotoComplete(bool* pbComplete)
     if(!m_bLinked)
         return ERR_NOLINK;
 
-    X2MutexLocker ml(GetMutex());
+    X2BusyMutexLocker ml(GetMutex(), m_nBusy);
+    CAMCCallTimer holdTime(m_AMCDrive.getStats(), STAT_CALL_IS_GOTO_COMPLETE);
 
     nErr = m_AMCDrive.isGoToComplete(*pbComplete);
     if(nErr)
@@ -521,7 +585,7 @@ int X2Dome::dapiIsOpenComplete(bool* pbComplete)
     if(!m_bLinked)
         return ERR_NOLINK;
 
-    X2MutexLocker ml(GetMutex());
+    X2BusyMutexLocker ml(GetMutex(), m_nBusy);
 
     if(!m_bHasShutterControl) {
         *pbComplete = true;
@@ -542,7 +606,7 @@ int	X2Dome::dapiIsCloseComplete(bool* pbComplete)
     if(!m_bLinked)
         return ERR_NOLINK;
 
-    X2MutexLocker ml(GetMutex());
+    X2BusyMutexLocker ml(GetMutex(), m_nBusy);
 
     if(!m_bHasShutterControl) {
         *pbComplete = true;
@@ -563,7 +627,8 @@ int X2Dome::dapiIsParkComplete(bool* pbComplete)
     if(!m_bLinked)
         return ERR_NOLINK;
 
-    X2MutexLocker ml(GetMutex());
+    X2BusyMutexLocker ml(GetMutex(), m_nBusy);
+    CAMCCallTimer holdTime(m_AMCDrive.getStats(), STAT_CALL_IS_PARK_COMPLETE);
 
     nErr = m_AMCDrive.isParkComplete(*pbComplete);
     if(nErr)
@@ -579,7 +644,7 @@ int X2Dome::dapiIsUnparkComplete(bool* pbComplete)
     if(!m_bLinked)
         return ERR_NOLINK;
 
-    X2MutexLocker ml(GetMutex());
+    X2BusyMutexLocker ml(GetMutex(), m_nBusy);
 
     nErr = m_AMCDrive.isUnparkComplete(*pbComplete);
     if(nErr)
@@ -595,7 +660,7 @@ int X2Dome::dapiIsFindHomeComplete(bool* pbComplete)
     if(!m_bLinked)
         return ERR_NOLINK;
 
-    X2MutexLocker ml(GetMutex());
+    X2BusyMutexLocker ml(GetMutex(), m_nBusy);
 
     nErr = m_AMCDrive.isFindHomeComplete(*pbComplete);
     if(nErr)
@@ -611,7 +676,7 @@ int X2Dome::dapiSync(double dAz, double dEl)
     if(!m_bLinked)
         return ERR_NOLINK;
 
-    X2MutexLocker ml(GetMutex());
+    X2BusyMutexLocker ml(GetMutex(), m_nBusy);
 
     nErr = m_AMCDrive.syncDome(dAz, dEl);
     if(nErr)
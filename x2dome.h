@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <string.h>
+#include <atomic>
 
 #include "../../licensedinterfaces/domedriverinterface.h"
 #include "../../licensedinterfaces/serialportparams2interface.h"
@@ -36,7 +37,14 @@ class TickCountInterface;
 #define CHILD_KEY_TICKS_PER_REV "NbTicksPerRev"
 #define CHILD_KEY_HOME_AZ "HomeAzimuth"
 #define CHILD_KEY_PARK_AZ "ParkAzimuth"
+#define CHILD_KEY_CABLE_WRAP_LIMIT "CableWrapLimit"
+#define CHILD_KEY_GOTO_TOLERANCE "GotoTolerance"
 #define CHILD_KEY_SHUTTER_CONTROL "ShutterCtrl"
+#define CHILD_KEY_MAX_IN_FLIGHT "MaxRequestsInFlight"
+#define CHILD_KEY_POLL_PERIOD "PollPeriod"
+#define CHILD_KEY_SNAPSHOT_MAX_AGE "SnapshotMaxAge"
+#define CHILD_KEY_LOG_LEVEL "LogLevel"
+#define CHILD_KEY_WIRE_CAPTURE "WireCapture"
 
 #if defined(SB_WIN_BUILD)
 #define DEF_PORT_NAME					"COM1"
@@ -47,6 +55,32 @@ class TickCountInterface;
 #endif
 
 #define LOG_BUFFER_SIZE 2048
+
+/*
+ Same as X2MutexLocker but flags the driver as busy while waiting for and holding the mutex,
+ so dapiGetAzEl knows it would block and can answer from the published dome state instead.
+ */
+class X2BusyMutexLocker
+{
+public:
+    X2BusyMutexLocker(MutexInterface* pMutex, std::atomic<int> &nBusy) : m_nBusy(nBusy), m_pMutex(pMutex)
+    {
+        m_nBusy++;
+        if(m_pMutex)
+            m_pMutex->lock();
+    }
+    ~X2BusyMutexLocker()
+    {
+        if(m_pMutex)
+            m_pMutex->unlock();
+        m_nBusy--;
+    }
+
+private:
+    std::atomic<int>    &m_nBusy;
+    MutexInterface      *m_pMutex;
+};
+
 /*!
 \brief The X2Dome example.
 
@@ -167,6 +201,7 @@ private:
     bool        m_bCalibratingDome;
     char        m_szLogBuffer[LOG_BUFFER_SIZE];
     int         m_nBattRequest;
+    std::atomic<int> m_nBusy;
 
     // bool        mIsRollOffRoof;
 };